@@ -0,0 +1,39 @@
+#ifndef INC_6502_ALU_H
+#define INC_6502_ALU_H
+
+#include <stdint.h>
+
+/*
+ * Precomputed results of the ALU operations, generated at build time by
+ * alu_gen.c. Flags are stored already in their status register position so
+ * a handler merges them into cpu.sr with a mask and an or.
+ *
+ * ADC/SBC entries are indexed by carry in, accumulator and operand, the low
+ * byte holds the result and the high byte the N, V, Z and C flags.
+ * */
+#define ALU_INDEX(c, a, b) (((uint32_t)(c) << 16) | ((uint32_t)(a) << 8) | (b))
+#define ALU_ENTRIES (2 * 256 * 256)
+
+// status register bits written by the different groups of instructions
+#define ALU_NVZC 0xC3
+#define ALU_NZC 0x83
+#define ALU_NZ 0x82
+
+// [0] binary mode, [1] decimal mode, indexed with the D flag
+extern const uint16_t* const alu_adc[2];
+extern const uint16_t* const alu_sbc[2];
+
+// N and Z of a value
+extern const uint8_t alu_nz[0x100];
+
+// N, Z and C of a comparison, indexed by (register << 8) | operand
+extern const uint8_t alu_cmp[0x10000];
+
+// shifts and rotations, result in the low byte and N, Z, C in the high one.
+// Rotations are indexed by (carry << 8) | operand
+extern const uint16_t alu_asl[0x100];
+extern const uint16_t alu_lsr[0x100];
+extern const uint16_t alu_rol[0x200];
+extern const uint16_t alu_ror[0x200];
+
+#endif
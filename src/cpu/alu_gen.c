@@ -0,0 +1,179 @@
+/*
+ * ALU tables generator, run by the Makefile to produce the C source holding
+ * the tables declared in alu.h:
+ *
+ *      ./bin/alu_gen > bin/alu_tables.c
+ *
+ * Everything the ALU does is looked up instead of computed, so the decimal
+ * mode costs exactly as much as the binary one and the handlers don't branch
+ * to compute flags (the D flag itself is used as an index). Decimal results
+ * follow the NMOS 6502 behaviour, see:
+ * http://www.6502.org/tutorials/decimal_mode.html
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "alu.h"
+#include "cpu.h"
+
+/**
+ * pack: builds a table entry
+ * @param res The 8-bit result
+ * @param n The negative flag
+ * @param v The overflow flag
+ * @param z The zero flag
+ * @param c The carry flag
+ * @return the entry
+ * */
+static uint16_t pack(uint8_t res, int n, int v, int z, int c) {
+    uint8_t flags = ((n != 0) << N) | ((v != 0) << V) | ((z != 0) << Z) |
+                    ((c != 0) << C);
+    return ((uint16_t)flags << 8) | res;
+}
+
+/**
+ * binary_adc: two's complement addition, SBC is the same with the operand
+ * inverted
+ * @param a The accumulator
+ * @param b The operand
+ * @param c The carry in
+ * @return the entry
+ * */
+static uint16_t binary_adc(uint8_t a, uint8_t b, uint8_t c) {
+    uint16_t tmp = (uint16_t)a + b + c;
+
+    return pack(tmp & 0xFF, tmp & 0x80, (~(a ^ b) & (a ^ tmp)) & 0x80,
+                (tmp & 0xFF) == 0, tmp > 0xFF);
+}
+
+/**
+ * decimal_adc: BCD addition. On the NMOS part Z comes from the binary sum,
+ * while N and V are taken from the intermediate result before the high
+ * nibble gets adjusted.
+ * @param a The accumulator
+ * @param b The operand
+ * @param c The carry in
+ * @return the entry
+ * */
+static uint16_t decimal_adc(uint8_t a, uint8_t b, uint8_t c) {
+    int lo = (a & 0x0F) + (b & 0x0F) + c;
+    if (lo >= 0x0A) lo = ((lo + 0x06) & 0x0F) + 0x10;
+
+    int sum = (a & 0xF0) + (b & 0xF0) + lo;
+
+    // N and V use the signed intermediate sum
+    int ssum = (int8_t)(a & 0xF0) + (int8_t)(b & 0xF0) + lo;
+
+    if (sum >= 0xA0) sum += 0x60;
+
+    return pack(sum & 0xFF, ssum & 0x80, ssum < -128 || ssum > 127,
+                ((a + b + c) & 0xFF) == 0, sum >= 0x100);
+}
+
+/**
+ * decimal_sbc: BCD subtraction. On the NMOS part every flag is the same as
+ * in binary mode, only the accumulator is adjusted.
+ * @param a The accumulator
+ * @param b The operand
+ * @param c The carry in (1 means no borrow)
+ * @return the entry
+ * */
+static uint16_t decimal_sbc(uint8_t a, uint8_t b, uint8_t c) {
+    int lo = (a & 0x0F) - (b & 0x0F) + c - 1;
+    if (lo < 0) lo = ((lo - 0x06) & 0x0F) - 0x10;
+
+    int diff = (a & 0xF0) - (b & 0xF0) + lo;
+    if (diff < 0) diff -= 0x60;
+
+    uint16_t flags = binary_adc(a, b ^ 0xFF, c) & 0xFF00;
+    return flags | (diff & 0xFF);
+}
+
+// N and Z of a value
+static uint8_t nz(uint8_t val) {
+    return (pack(val, val & 0x80, 0, val == 0, 0) >> 8);
+}
+
+/**
+ * shift: entry of a shift or a rotation
+ * @param res The shifted value
+ * @param carry The bit that went out
+ * @return the entry
+ * */
+static uint16_t shift(uint8_t res, int carry) {
+    return pack(res, res & 0x80, 0, res == 0, carry);
+}
+
+/*
+ * =============================================
+ * OUTPUT
+ * =============================================
+ */
+
+/**
+ * entry: computes an entry of one of the tables
+ * @param kind The table, see main()
+ * @param i The index of the entry
+ * @return the entry
+ * */
+static unsigned long entry(int kind, unsigned long i) {
+    uint8_t c = (i >> 16) & 1, a = (i >> 8) & 0xFF, b = i & 0xFF;
+    uint16_t reg = i >> 8;
+
+    switch (kind) {
+        case 0: return binary_adc(a, b, c);
+        case 1: return decimal_adc(a, b, c);
+        case 2: return binary_adc(a, b ^ 0xFF, c);
+        case 3: return decimal_sbc(a, b, c);
+        case 4: return nz(i);
+        // comparisons are a subtraction without borrow that keeps N, Z and C
+        case 5: return (binary_adc(reg, b ^ 0xFF, 1) >> 8) & ALU_NZC;
+        case 6: return shift(i << 1, i & 0x80);
+        case 7: return shift(i >> 1, i & 0x01);
+        case 8: return shift((i << 1) | (i >> 8), i & 0x80);
+        case 9: return shift(i >> 1, i & 0x01);
+    }
+
+    return 0;
+}
+
+/**
+ * emit: prints a table as a C array
+ * @param type The C type of the entries, with its qualifiers
+ * @param name The name of the array
+ * @param kind The table, see entry()
+ * @param size The number of entries
+ * @return void
+ * */
+static void emit(const char* type, const char* name, int kind, unsigned long size) {
+    printf("%s %s[0x%lX] = {", type, name, size);
+
+    for (unsigned long i = 0; i < size; i++) {
+        if (i % 16 == 0) printf("\n");
+        printf("%lu,", entry(kind, i));
+    }
+
+    printf("\n};\n\n");
+}
+
+int main(void) {
+    printf("/* generated by src/cpu/alu_gen.c, do not edit */\n\n");
+    printf("#include \"../src/cpu/alu.h\"\n\n");
+
+    emit("static const uint16_t", "adc_bin", 0, ALU_ENTRIES);
+    emit("static const uint16_t", "adc_dec", 1, ALU_ENTRIES);
+    emit("static const uint16_t", "sbc_bin", 2, ALU_ENTRIES);
+    emit("static const uint16_t", "sbc_dec", 3, ALU_ENTRIES);
+    emit("const uint8_t", "alu_nz", 4, 0x100);
+    emit("const uint8_t", "alu_cmp", 5, 0x10000);
+    emit("const uint16_t", "alu_asl", 6, 0x100);
+    emit("const uint16_t", "alu_lsr", 7, 0x100);
+    emit("const uint16_t", "alu_rol", 8, 0x200);
+    emit("const uint16_t", "alu_ror", 9, 0x200);
+
+    printf("const uint16_t* const alu_adc[2] = {adc_bin, adc_dec};\n");
+    printf("const uint16_t* const alu_sbc[2] = {sbc_bin, sbc_dec};\n");
+
+    return 0;
+}
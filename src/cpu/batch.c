@@ -0,0 +1,733 @@
+#include "batch.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * The AVX2 kernels are built whatever the compiler flags and picked at run
+ * time when the host has AVX2, -DBATCH_NO_AVX2 leaves them out.
+ * */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(BATCH_NO_AVX2)
+#define BATCH_AVX2
+#include <immintrin.h>
+#endif
+
+#include "../mem/mem.h"
+#include "alu.h"
+#include "cpu.h"
+#include "instructions.h"
+
+/**
+ * How a batch step works:
+ *
+ * The running lane with the lowest pc is the leader, every running lane on the
+ * same pc (with the same instruction bytes, in case of self-modifying code)
+ * forms the group executing it. Lanes are independent so their clocks needn't
+ * agree, and picking the lowest pc lets the lanes that skipped ahead over an
+ * if wait for the others to catch up. Registers and flags are updated for the
+ * whole group at once: the commits, the logic, compare and binary ADC/SBC
+ * kernels have AVX2 versions (one lane per byte of a 256-bit register) used
+ * when the host has it, and plain loops over the group mask otherwise.
+ * Memory accesses are gathered lane by lane from each 64K image.
+ *
+ * Instructions without a kernel (stack juggling, interrupts, illegal
+ * opcodes...) and a few corner cases run through the scalar core, one lane at
+ * a time, with cpu_step_on().
+ * */
+
+// instruction families with a lane kernel
+#define K_SCALAR 0
+#define K_LOAD 1   // LDA, LDX, LDY: arg is the register
+#define K_STORE 2  // STA, STX, STY: arg is the register
+#define K_ADC 3
+#define K_SBC 4
+#define K_AND 5
+#define K_ORA 6
+#define K_EOR 7
+#define K_CMP 8    // CMP, CPX, CPY: arg is the register
+#define K_STEP 9   // INX, INY, DEX, DEY: arg is the register, +1 or -1 in arg2
+#define K_MOVE 10  // TAX, TAY, TXA, TYA: arg is the source, arg2 the dest
+#define K_MODIFY 11 // INC, DEC: +1 or -1 in arg2
+#define K_FLAG 12  // flag set/clear: arg is the bit, arg2 the value
+#define K_BRANCH 13 // arg is the flag tested, arg2 the value to branch on
+#define K_JMP 14
+#define K_JSR 15
+#define K_RTS 16
+
+#define R_A 0
+#define R_X 1
+#define R_Y 2
+
+static uint8_t kernel[256], arg[256], arg2[256];
+
+// variant the kernel tables were filled for, -1 if not yet
+static int kernels_variant = -1;
+
+// set when the host runs the AVX2 kernels, see batch_init()
+static uint8_t use_avx2 = 0;
+
+/**
+ * init_kernels: Fills the kernel tables from the instruction names of the
+ *               selected variant
+ * @param void
+ * @return void
+ * */
+static void init_kernels(void) {
+    static const struct {
+        const char* name;
+        uint8_t kernel, arg, arg2;
+    } names[] = {
+        {"LDA", K_LOAD, R_A, 0},   {"LDX", K_LOAD, R_X, 0},   {"LDY", K_LOAD, R_Y, 0},
+        {"STA", K_STORE, R_A, 0},  {"STX", K_STORE, R_X, 0},  {"STY", K_STORE, R_Y, 0},
+        {"ADC", K_ADC, 0, 0},      {"SBC", K_SBC, 0, 0},      {"AND", K_AND, 0, 0},
+        {"ORA", K_ORA, 0, 0},      {"EOR", K_EOR, 0, 0},      {"CMP", K_CMP, R_A, 0},
+        {"CPX", K_CMP, R_X, 0},    {"CPY", K_CMP, R_Y, 0},    {"INX", K_STEP, R_X, 1},
+        {"INY", K_STEP, R_Y, 1},   {"DEX", K_STEP, R_X, 0xFF}, {"DEY", K_STEP, R_Y, 0xFF},
+        {"TAX", K_MOVE, R_A, R_X}, {"TAY", K_MOVE, R_A, R_Y}, {"TXA", K_MOVE, R_X, R_A},
+        {"TYA", K_MOVE, R_Y, R_A}, {"INC", K_MODIFY, 0, 1},   {"DEC", K_MODIFY, 0, 0xFF},
+        {"CLC", K_FLAG, C, 0},     {"SEC", K_FLAG, C, 1},     {"CLD", K_FLAG, D, 0},
+        {"SED", K_FLAG, D, 1},     {"CLI", K_FLAG, I, 0},     {"SEI", K_FLAG, I, 1},
+        {"CLV", K_FLAG, V, 0},     {"BPL", K_BRANCH, N, 0},   {"BMI", K_BRANCH, N, 1},
+        {"BVC", K_BRANCH, V, 0},   {"BVS", K_BRANCH, V, 1},   {"BCC", K_BRANCH, C, 0},
+        {"BCS", K_BRANCH, C, 1},   {"BNE", K_BRANCH, Z, 0},   {"BEQ", K_BRANCH, Z, 1},
+        {"JSR", K_JSR, 0, 0},      {"RTS", K_RTS, 0, 0},
+    };
+
+    for (int op = 0; op < 256; op++) {
+        kernel[op] = K_SCALAR;
+
+        for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+            if (strcmp(lookup[op].name, names[i].name) != 0) continue;
+
+            kernel[op] = names[i].kernel;
+            arg[op] = names[i].arg;
+            arg2[op] = names[i].arg2;
+        }
+    }
+
+    // JMP (ind) stays scalar, so do NOPs: the core's NOP skips a byte
+    kernel[0x4C] = K_JMP;
+
+    // the 65C02 sets N and Z in decimal mode, the ALU tables hold the NMOS flags
+    if (inst_variant == CPU_65C02) {
+        for (int op = 0; op < 256; op++) {
+            if (kernel[op] == K_ADC || kernel[op] == K_SBC) kernel[op] = K_SCALAR;
+        }
+    }
+
+    kernels_variant = inst_variant;
+}
+
+/**
+ * batch_init: Allocate the lanes, with zeroed memory and reset
+ * @param b The batch
+ * @param lanes The number of lanes, up to BATCH_LANES
+ * @return 0 if success, 1 if failure
+ * */
+int batch_init(struct batch* b, uint8_t lanes) {
+    if (lanes == 0 || lanes > BATCH_LANES) return 1;
+
+    // lanes can be used without the core ever being initialised
+    if (!lookup[0].op) inst_select(CPU_VARIANT);
+
+#ifdef BATCH_AVX2
+    __builtin_cpu_init();
+    use_avx2 = __builtin_cpu_supports("avx2") != 0;
+#endif
+
+    memset(b, 0, sizeof(*b));
+    b->lanes = lanes;
+
+    for (uint8_t l = 0; l < lanes; l++) {
+        b->mem[l] = calloc(1, sizeof(struct mem));
+        if (!b->mem[l]) {
+            batch_free(b);
+            return 1;
+        }
+    }
+
+    batch_reset(b);
+    return 0;
+}
+
+void batch_free(struct batch* b) {
+    for (uint8_t l = 0; l < BATCH_LANES; l++) {
+        free(b->mem[l]);
+        b->mem[l] = NULL;
+    }
+    b->lanes = 0;
+}
+
+/**
+ * batch_mem: Memory of a lane as a flat 64K image
+ * @param b The batch
+ * @param lane The lane
+ * @return the image
+ * */
+uint8_t* batch_mem(struct batch* b, uint8_t lane) { return (uint8_t*)b->mem[lane]; }
+
+/**
+ * batch_reset: Reset every lane like reset() does, memory is left untouched
+ * @param b The batch
+ * @return void
+ * */
+void batch_reset(struct batch* b) {
+    for (uint8_t l = 0; l < b->lanes; l++) {
+        b->pc[l] = ROM;
+        b->a[l] = b->x[l] = b->y[l] = 0;
+        b->sp[l] = 0xFD;
+        b->sr[l] = 0x00;
+        b->clock[l] += 8;
+        b->state[l] = BATCH_RUNNING;
+    }
+}
+
+/*
+ * =============================================
+ * LANE KERNELS
+ * =============================================
+ */
+
+#ifdef BATCH_AVX2
+#define AVX2 __attribute__((target("avx2")))
+
+// one 0xFF byte per lane set in the mask
+static AVX2 __m256i expand_mask(uint32_t mask) {
+    const __m256i shuffle = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+                                             2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+    const __m256i bits = _mm256_set1_epi64x(0x8040201008040201LL);
+
+    __m256i bytes = _mm256_shuffle_epi8(_mm256_set1_epi32(mask), shuffle);
+    return _mm256_cmpeq_epi8(_mm256_and_si256(bytes, bits), bits);
+}
+
+// N and Z of each byte, in their place in the status register
+static AVX2 __m256i nz_of(__m256i v) {
+    __m256i n = _mm256_and_si256(v, _mm256_set1_epi8((char)0x80));
+    __m256i z = _mm256_and_si256(_mm256_cmpeq_epi8(v, _mm256_setzero_si256()),
+                                 _mm256_set1_epi8(1 << Z));
+    return _mm256_or_si256(n, z);
+}
+
+// 0xFF in the bytes where a < b, unsigned
+static AVX2 __m256i below(__m256i a, __m256i b) {
+    return _mm256_andnot_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(a, b), a), _mm256_set1_epi8(-1));
+}
+
+/**
+ * store_sr: Replaces some flags of the lanes selected
+ * @param b The batch
+ * @param keep The flags left untouched
+ * @param flags The new flags, one byte per lane
+ * @param sel The lanes, 0xFF bytes
+ * @return void
+ * */
+static AVX2 void store_sr(struct batch* b, uint8_t keep, __m256i flags, __m256i sel) {
+    __m256i sr = _mm256_loadu_si256((const __m256i*)b->sr);
+    __m256i nsr = _mm256_or_si256(_mm256_and_si256(sr, _mm256_set1_epi8((char)keep)), flags);
+
+    _mm256_storeu_si256((__m256i*)b->sr, _mm256_blendv_epi8(sr, nsr, sel));
+}
+
+static AVX2 void commit_nz_avx2(struct batch* b, uint8_t* reg, const uint8_t* val, uint32_t mask) {
+    __m256i sel = expand_mask(mask);
+    __m256i v = _mm256_loadu_si256((const __m256i*)val);
+
+    if (reg) {
+        __m256i r = _mm256_loadu_si256((const __m256i*)reg);
+        _mm256_storeu_si256((__m256i*)reg, _mm256_blendv_epi8(r, v, sel));
+    }
+    store_sr(b, ~ALU_NZ, nz_of(v), sel);
+}
+
+static AVX2 void commit_sr_avx2(struct batch* b, uint8_t keep, const uint8_t* flags, uint32_t mask) {
+    store_sr(b, keep, _mm256_loadu_si256((const __m256i*)flags), expand_mask(mask));
+}
+
+static AVX2 void logic_avx2(struct batch* b, uint8_t k, const uint8_t* val, uint32_t mask) {
+    __m256i a = _mm256_loadu_si256((const __m256i*)b->a);
+    __m256i v = _mm256_loadu_si256((const __m256i*)val);
+    __m256i sel = expand_mask(mask);
+
+    v = k == K_AND ? _mm256_and_si256(a, v) : k == K_ORA ? _mm256_or_si256(a, v) : _mm256_xor_si256(a, v);
+
+    _mm256_storeu_si256((__m256i*)b->a, _mm256_blendv_epi8(a, v, sel));
+    store_sr(b, ~ALU_NZ, nz_of(v), sel);
+}
+
+static AVX2 void compare_avx2(struct batch* b, const uint8_t* reg, const uint8_t* val, uint32_t mask) {
+    __m256i r = _mm256_loadu_si256((const __m256i*)reg);
+    __m256i v = _mm256_loadu_si256((const __m256i*)val);
+
+    // C when reg >= val, N and Z from reg - val
+    __m256i c = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(r, v), r), _mm256_set1_epi8(1 << C));
+
+    store_sr(b, ~ALU_NZC, _mm256_or_si256(nz_of(_mm256_sub_epi8(r, v)), c), expand_mask(mask));
+}
+
+// binary mode only, SBC is an ADC of the complement
+static AVX2 void add_avx2(struct batch* b, uint8_t sub, const uint8_t* val, uint32_t mask) {
+    __m256i a = _mm256_loadu_si256((const __m256i*)b->a);
+    __m256i v = _mm256_loadu_si256((const __m256i*)val);
+    __m256i sr = _mm256_loadu_si256((const __m256i*)b->sr);
+    __m256i sel = expand_mask(mask);
+
+    if (sub) v = _mm256_xor_si256(v, _mm256_set1_epi8(-1));
+
+    // the carry out is set if either addition wraps
+    __m256i part = _mm256_add_epi8(a, v);
+    __m256i res = _mm256_add_epi8(part, _mm256_and_si256(sr, _mm256_set1_epi8(1 << C)));
+    __m256i c = _mm256_or_si256(below(part, a), below(res, part));
+
+    // V when both operands have the same sign and the result doesn't, 0x80 of
+    // each byte moved to 0x40 (16-bit shift, the bit coming in is masked off)
+    __m256i ov = _mm256_and_si256(_mm256_and_si256(_mm256_xor_si256(a, res), _mm256_xor_si256(v, res)),
+                                  _mm256_set1_epi8((char)0x80));
+    ov = _mm256_and_si256(_mm256_srli_epi16(ov, 7 - V), _mm256_set1_epi8(1 << V));
+
+    __m256i flags = _mm256_or_si256(_mm256_or_si256(nz_of(res), ov),
+                                    _mm256_and_si256(c, _mm256_set1_epi8(1 << C)));
+
+    _mm256_storeu_si256((__m256i*)b->a, _mm256_blendv_epi8(a, res, sel));
+    store_sr(b, ~ALU_NVZC, flags, sel);
+}
+
+/**
+ * decimal_lanes: The lanes of a mask with the D flag set
+ * @param b The batch
+ * @param mask The lanes
+ * @return their mask
+ * */
+static AVX2 uint32_t decimal_lanes(struct batch* b, uint32_t mask) {
+    __m256i d = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)b->sr), _mm256_set1_epi8(1 << D));
+    return mask & (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(d, _mm256_set1_epi8(1 << D)));
+}
+#endif
+
+/**
+ * commit_nz: Writes a value in a register of the lanes of a group, setting N
+ *            and Z like the loads and transfers do
+ * @param b The batch
+ * @param reg The register array, NULL to only set the flags
+ * @param val The values, one per lane
+ * @param mask The lanes of the group
+ * @return void
+ * */
+static void commit_nz(struct batch* b, uint8_t* reg, const uint8_t* val, uint32_t mask) {
+#ifdef BATCH_AVX2
+    if (use_avx2) {
+        commit_nz_avx2(b, reg, val, mask);
+        return;
+    }
+#endif
+    for (uint8_t l = 0; l < BATCH_LANES; l++) {
+        if (!((mask >> l) & 1)) continue;
+
+        if (reg) reg[l] = val[l];
+        b->sr[l] = (b->sr[l] & ~ALU_NZ) | alu_nz[val[l]];
+    }
+}
+
+/**
+ * commit_sr: Replaces some flags of the lanes of a group
+ * @param b The batch
+ * @param keep The flags left untouched
+ * @param flags The new flags, one byte per lane
+ * @param mask The lanes of the group
+ * @return void
+ * */
+static void commit_sr(struct batch* b, uint8_t keep, const uint8_t* flags, uint32_t mask) {
+#ifdef BATCH_AVX2
+    if (use_avx2) {
+        commit_sr_avx2(b, keep, flags, mask);
+        return;
+    }
+#endif
+    for (uint8_t l = 0; l < BATCH_LANES; l++) {
+        if ((mask >> l) & 1) b->sr[l] = (b->sr[l] & keep) | flags[l];
+    }
+}
+
+/**
+ * logic: AND, ORA or EOR of the accumulator of the lanes of a group
+ * @param b The batch
+ * @param k K_AND, K_ORA or K_EOR
+ * @param val The operands, one per lane
+ * @param mask The lanes of the group
+ * @return void
+ * */
+static void logic(struct batch* b, uint8_t k, const uint8_t* val, uint32_t mask) {
+    uint8_t res[BATCH_LANES];
+
+#ifdef BATCH_AVX2
+    if (use_avx2) {
+        logic_avx2(b, k, val, mask);
+        return;
+    }
+#endif
+    for (uint8_t l = 0; l < BATCH_LANES; l++) {
+        res[l] = k == K_AND ? b->a[l] & val[l] : k == K_ORA ? b->a[l] | val[l] : b->a[l] ^ val[l];
+    }
+    commit_nz(b, b->a, res, mask);
+}
+
+/**
+ * compare: CMP, CPX or CPY of the lanes of a group
+ * @param b The batch
+ * @param reg The register compared
+ * @param val The operands, one per lane
+ * @param mask The lanes of the group
+ * @return void
+ * */
+static void compare(struct batch* b, const uint8_t* reg, const uint8_t* val, uint32_t mask) {
+    uint8_t flags[BATCH_LANES];
+
+#ifdef BATCH_AVX2
+    if (use_avx2) {
+        compare_avx2(b, reg, val, mask);
+        return;
+    }
+#endif
+    for (uint8_t l = 0; l < BATCH_LANES; l++) flags[l] = alu_cmp[(reg[l] << 8) | val[l]];
+    commit_sr(b, ~ALU_NZC, flags, mask);
+}
+
+/**
+ * add: ADC or SBC of the lanes of a group, lanes in decimal mode go through
+ *      the ALU tables
+ * @param b The batch
+ * @param sub 1 for SBC
+ * @param val The operands, one per lane
+ * @param mask The lanes of the group
+ * @return void
+ * */
+static void add(struct batch* b, uint8_t sub, const uint8_t* val, uint32_t mask) {
+    uint8_t flags[BATCH_LANES];
+
+#ifdef BATCH_AVX2
+    if (use_avx2) {
+        uint32_t decimal = decimal_lanes(b, mask);
+
+        add_avx2(b, sub, val, mask & ~decimal);
+        mask = decimal;
+    }
+#endif
+    for (uint8_t l = 0; l < BATCH_LANES; l++) {
+        if (!((mask >> l) & 1)) continue;
+
+        const uint16_t* table = (sub ? alu_sbc : alu_adc)[(b->sr[l] >> D) & 1];
+        uint16_t res = table[ALU_INDEX(b->sr[l] & 1, b->a[l], val[l])];
+
+        b->a[l] = res & 0xFF;
+        flags[l] = res >> 8;
+    }
+    commit_sr(b, ~ALU_NVZC, flags, mask);
+}
+
+// the register array of a R_* id
+static uint8_t* reg_of(struct batch* b, uint8_t r) {
+    return r == R_A ? b->a : r == R_X ? b->x : b->y;
+}
+
+// length of the instructions, by addressing mode
+static const uint8_t mode_len[] = {1, 2, 2, 2, 2, 3, 3, 3, 3, 2, 2, 2, 2, 3};
+
+/**
+ * lane_addr: Effective address of the operand of an instruction for a lane
+ * @param b The batch
+ * @param l The lane
+ * @param mode The INST_* addressing mode
+ * @param pc The address of the instruction
+ * @param cross Set to 1 if indexing crossed a page
+ * @return the address
+ * */
+static uint16_t lane_addr(struct batch* b, uint8_t l, uint8_t mode, uint16_t pc, uint8_t* cross) {
+    const uint8_t* m = batch_mem(b, l);
+    uint8_t lo = m[(uint16_t)(pc + 1)];
+    uint16_t base = lo | (m[(uint16_t)(pc + 2)] << 8);
+    uint16_t addr;
+
+    *cross = 0;
+
+    switch (mode) {
+        case INST_IMM: return pc + 1;
+        case INST_ZP0: return lo;
+        case INST_ZPX: return (uint8_t)(lo + b->x[l]);
+        case INST_ZPY: return (uint8_t)(lo + b->y[l]);
+        case INST_ABS: return base;
+        case INST_ABX:
+            addr = base + b->x[l];
+            *cross = (addr & 0xFF00) != (base & 0xFF00);
+            return addr;
+        case INST_ABY:
+            addr = base + b->y[l];
+            *cross = (addr & 0xFF00) != (base & 0xFF00);
+            return addr;
+        case INST_IZX:
+            lo = lo + b->x[l];
+            return m[lo] | (m[(uint8_t)(lo + 1)] << 8);
+        case INST_IZP:
+            return m[lo] | (m[(uint8_t)(lo + 1)] << 8);
+        case INST_IZY:
+            base = m[lo] | (m[(uint8_t)(lo + 1)] << 8);
+            addr = base + b->y[l];
+            *cross = (addr & 0xFF00) != (base & 0xFF00);
+            return addr;
+    }
+
+    return 0;
+}
+
+/**
+ * run_scalar: Executes the instruction of a group through the core
+ * @param b The batch
+ * @param ids The lanes of the group
+ * @param n Their number
+ * @return void
+ * */
+static void run_scalar(struct batch* b, const uint8_t* ids, uint8_t n) {
+    for (uint8_t i = 0; i < n; i++) {
+        uint8_t l = ids[i];
+        struct central_processing_unit regs = {b->pc[l], b->sp[l], b->a[l],
+                                               b->x[l], b->y[l], b->sr[l]};
+
+        b->clock[l] += cpu_step_on(&regs, b->mem[l]);
+
+        b->pc[l] = regs.pc;
+        b->sp[l] = regs.sp;
+        b->a[l] = regs.ac;
+        b->x[l] = regs.x;
+        b->y[l] = regs.y;
+        b->sr[l] = regs.sr;
+    }
+
+    b->scalar += n;
+}
+
+/**
+ * run_group: Executes the instruction at pc on a group of lanes
+ * @param b The batch
+ * @param ids The lanes of the group
+ * @param n Their number
+ * @param pc The address of the instruction
+ * @return void
+ * */
+static void run_group(struct batch* b, const uint8_t* ids, uint8_t n, uint16_t pc) {
+    const uint8_t* code = batch_mem(b, ids[0]);
+    uint8_t op = code[pc], mode = inst_mode(op), k = kernel[op];
+    uint16_t next = pc + mode_len[mode];
+
+    uint16_t addr[BATCH_LANES];
+    uint8_t val[BATCH_LANES], flags[BATCH_LANES], cross[BATCH_LANES];
+    uint32_t mask = 0;
+
+    if (k == K_SCALAR || (k == K_JMP && mode != INST_ABS)) {
+        run_scalar(b, ids, n);
+        return;
+    }
+
+    for (uint8_t i = 0; i < n; i++) {
+        uint8_t l = ids[i];
+        mask |= 1u << l;
+
+        if (mode == INST_IMP || mode == INST_REL) continue;
+
+        addr[l] = lane_addr(b, l, mode, pc, &cross[l]);
+        val[l] = batch_mem(b, l)[addr[l]];
+
+        // cpu_fetch() moves the pc past the byte following the instruction
+        // when the operand is read from there, keep that behaviour
+        if (addr[l] == next || next < 0x0100) {
+            run_scalar(b, ids, n);
+            return;
+        }
+    }
+
+    uint8_t cycles = lookup[op].cycles;
+    uint8_t* reg = reg_of(b, arg[op]);
+
+    switch (k) {
+        case K_LOAD:
+            commit_nz(b, reg, val, mask);
+            break;
+
+        case K_STORE:
+            for (uint8_t i = 0; i < n; i++) batch_mem(b, ids[i])[addr[ids[i]]] = reg[ids[i]];
+            break;
+
+        case K_ADC:
+        case K_SBC:
+            add(b, k == K_SBC, val, mask);
+            break;
+
+        case K_AND:
+        case K_ORA:
+        case K_EOR:
+            logic(b, k, val, mask);
+            break;
+
+        case K_CMP:
+            compare(b, reg, val, mask);
+            break;
+
+        case K_STEP:
+            for (uint8_t l = 0; l < BATCH_LANES; l++) val[l] = reg[l] + arg2[op];
+            commit_nz(b, reg, val, mask);
+            break;
+
+        case K_MOVE:
+            commit_nz(b, reg_of(b, arg2[op]), reg, mask);
+            break;
+
+        case K_MODIFY:
+            for (uint8_t i = 0; i < n; i++) {
+                uint8_t l = ids[i];
+                val[l] += arg2[op];
+                batch_mem(b, l)[addr[l]] = val[l];
+            }
+            commit_nz(b, NULL, val, mask);
+            break;
+
+        case K_FLAG:
+            for (uint8_t l = 0; l < BATCH_LANES; l++) flags[l] = arg2[op] << arg[op];
+            commit_sr(b, ~(1 << arg[op]), flags, mask);
+            break;
+
+        case K_BRANCH: {
+            uint16_t target = next + (int8_t)code[(uint16_t)(pc + 1)];
+            uint8_t extra = 1 + ((target & 0xFF00) != (next & 0xFF00));
+
+            // lanes split here, each one goes its own way
+            for (uint8_t i = 0; i < n; i++) {
+                uint8_t l = ids[i];
+
+                if (((b->sr[l] >> arg[op]) & 1) == arg2[op]) {
+                    b->pc[l] = target;
+                    b->clock[l] += cycles + extra;
+                } else {
+                    b->pc[l] = next;
+                    b->clock[l] += cycles;
+                }
+            }
+            b->grouped += n;
+            return;
+        }
+
+        case K_JMP:
+            next = addr[ids[0]];
+            break;
+
+        case K_JSR:
+            for (uint8_t i = 0; i < n; i++) {
+                uint8_t l = ids[i];
+                uint8_t* m = batch_mem(b, l);
+                uint16_t ret = next - 1;
+
+                m[0x100 + b->sp[l]--] = ret >> 8;
+                m[0x100 + b->sp[l]--] = ret & 0xFF;
+            }
+            next = addr[ids[0]];
+            break;
+
+        case K_RTS:
+            for (uint8_t i = 0; i < n; i++) {
+                uint8_t l = ids[i];
+                const uint8_t* m = batch_mem(b, l);
+                uint16_t ret = m[0x100 + ++b->sp[l]];
+
+                ret |= m[0x100 + ++b->sp[l]] << 8;
+                b->pc[l] = ret + 1;
+                b->clock[l] += cycles;
+            }
+            b->grouped += n;
+            return;
+    }
+
+    // loads and ALU operations pay for indexes crossing a page, stores don't
+    uint8_t pays = k == K_LOAD || (k >= K_ADC && k <= K_EOR) || (k == K_CMP && arg[op] == R_A);
+
+    for (uint8_t i = 0; i < n; i++) {
+        uint8_t l = ids[i];
+
+        b->pc[l] = next;
+        b->clock[l] += cycles + (pays && mode != INST_IMP && mode != INST_REL && cross[l]);
+    }
+
+    b->grouped += n;
+}
+
+/**
+ * batch_run: Run every lane for a cycle budget, or until it reaches a BRK
+ *            (left unexecuted, the lane state becomes BATCH_BRK)
+ * @param b The batch
+ * @param budget The cycles each lane runs for
+ * @return the number of lanes that stopped on a BRK
+ * */
+uint8_t batch_run(struct batch* b, uint64_t budget) {
+    uint64_t end[BATCH_LANES];
+    uint8_t ids[BATCH_LANES], stopped = 0;
+
+    // the variant may have changed since the last run (emu6502_set_cpu()...)
+    if (kernels_variant != inst_variant) init_kernels();
+
+    // lanes have no devices or banks, the core must not see any either
+    struct mem_io* io_map[0x100];
+    uint8_t* read_map[0x100];
+    uint8_t* write_map[0x100];
+    memcpy(io_map, mem_io_map, sizeof(io_map));
+    memcpy(read_map, mem_read_map, sizeof(read_map));
+    memcpy(write_map, mem_write_map, sizeof(write_map));
+    memset(mem_io_map, 0, sizeof(io_map));
+    mem_map_image();
+
+    for (uint8_t l = 0; l < b->lanes; l++) {
+        end[l] = b->clock[l] + budget;
+        if (b->state[l] == BATCH_BUDGET) b->state[l] = BATCH_RUNNING;
+    }
+
+    while (1) {
+        int leader = -1;
+
+        for (uint8_t l = 0; l < b->lanes; l++) {
+            if (b->state[l] != BATCH_RUNNING) continue;
+
+            if (b->clock[l] >= end[l]) {
+                b->state[l] = BATCH_BUDGET;
+            } else if (batch_mem(b, l)[b->pc[l]] == 0x00) {
+                b->state[l] = BATCH_BRK;
+                stopped++;
+            } else if (leader < 0 || b->pc[l] < b->pc[leader]) {
+                leader = l;
+            }
+        }
+
+        if (leader < 0) break;
+
+        // the group: same pc and the same instruction bytes
+        uint16_t pc = b->pc[leader];
+        const uint8_t* lead = batch_mem(b, leader) + pc;
+        uint8_t n = 0;
+
+        for (uint8_t l = 0; l < b->lanes; l++) {
+            const uint8_t* m = batch_mem(b, l);
+
+            if (b->state[l] != BATCH_RUNNING || b->pc[l] != pc) continue;
+            if (pc > 0xFFFD || m[pc] != lead[0] || m[pc + 1] != lead[1] || m[pc + 2] != lead[2]) {
+                if (l != leader) continue;
+            }
+            if (b->clock[l] < end[l]) ids[n++] = l;
+        }
+
+        if (pc > 0xFFFD) {
+            run_scalar(b, ids, n);
+        } else {
+            run_group(b, ids, n, pc);
+        }
+    }
+
+    memcpy(mem_io_map, io_map, sizeof(io_map));
+    memcpy(mem_read_map, read_map, sizeof(read_map));
+    memcpy(mem_write_map, write_map, sizeof(write_map));
+    return stopped;
+}
@@ -0,0 +1,48 @@
+#ifndef INC_6502_BATCH_H
+#define INC_6502_BATCH_H
+
+#include <stdint.h>
+
+#include "../lib/emu6502.h"
+
+/*
+ * Batch engine: up to BATCH_LANES independent machines (lanes), usually the
+ * same program on different data, kept in structure-of-arrays form. Lanes
+ * sitting on the same instruction execute it together, lanes taking different
+ * branches split and join again when their pc meet.
+ *
+ * Lanes have plain RAM only, no devices, events nor interrupts.
+ * */
+#define BATCH_LANES 32
+
+// lane states
+#define BATCH_RUNNING 0
+#define BATCH_BRK 1
+#define BATCH_BUDGET 2
+
+struct batch {
+    uint8_t lanes;
+
+    uint16_t pc[BATCH_LANES];
+    uint8_t a[BATCH_LANES];
+    uint8_t x[BATCH_LANES];
+    uint8_t y[BATCH_LANES];
+    uint8_t sp[BATCH_LANES];
+    uint8_t sr[BATCH_LANES];
+    uint64_t clock[BATCH_LANES];
+    uint8_t state[BATCH_LANES];
+
+    struct mem* mem[BATCH_LANES];
+
+    // instructions executed by the lane kernels and by the scalar core
+    uint64_t grouped;
+    uint64_t scalar;
+};
+
+EMU6502_API int batch_init(struct batch* b, uint8_t lanes);
+EMU6502_API void batch_free(struct batch* b);
+EMU6502_API uint8_t* batch_mem(struct batch* b, uint8_t lane);
+EMU6502_API void batch_reset(struct batch* b);
+EMU6502_API uint8_t batch_run(struct batch* b, uint64_t budget);
+
+#endif
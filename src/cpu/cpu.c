@@ -5,8 +5,10 @@
 #include <stdlib.h>
 
 #include "../mem/mem.h"
+#include "../mem/shm.h"
 #include "../utils/misc.h"
 #include "instructions.h"
+#include "sched.h"
 
 /**
  * Little-endian 8-bit microprocessor that expects addresses
@@ -14,18 +16,116 @@
  * */
 struct central_processing_unit cpu;
 
+// debug traces on stderr, see misc.h
+uint8_t DEBUG = 0;
+
 // clock cycles, every fetch implies a clock cycle
 uint32_t cycles = 0;
 
+// total amount of cycles elapsed since power on, the scheduler's time base
+uint64_t cpu_clock = 0;
+
+// instructions executed since power on, superinstructions count for each one
+uint64_t cpu_instructions = 0;
+
+// one bit per device currently pulling the IRQ line
+static uint8_t irq_lines = 0;
+
+// NMI is edge triggered, it stays pending until serviced
+static uint8_t nmi_pending = 0;
+
+// parked main cpu of the bus when another one runs, see struct cpu_context
+static struct cpu_context* main_cpu = NULL;
+
+// set while inst_exec() runs, see cpu_now()
+static uint8_t executing = 0;
+
+#ifdef CPU_CYCLE_STEPPED
+// bus cycles done so far by the running instruction, see bus_tick()
+static uint32_t bus_cycle = 0;
+#endif
+
+// opcode of the last instruction cpu_run() fetched, see cpu_last_opcode()
+static uint8_t last_opcode = 0xEA;
+
+// one bit per address, see cpu_set_breakpoint()
+static uint8_t breakpoints[0x10000 / 8];
+static uint32_t breakpoint_count = 0;
+
+/*
+ * Idle loop detection, see idle_check(): last loop head seen, the registers,
+ * clock and instruction count when it was reached and whether the bus got
+ * written (or a device read) since then. A device tells a read that changed
+ * nothing apart with cpu_quiet_read(), and when the value it returned can
+ * change on its own with cpu_quiet_read_until().
+ * */
+static int32_t idle_head = -1;
+static struct central_processing_unit idle_regs;
+static uint64_t idle_clock = 0;
+static uint64_t idle_instructions = 0;
+static uint8_t bus_touched = 0;
+static uint8_t quiet_read = 0;
+static uint64_t quiet_until = SCHED_NEVER;
+
 // reference to the memory module
 struct mem* mem_ptr = NULL;
 
 /**
- * cpu_init: Initialize CPU by linking it to the memory
+ * cpu_init: Initialize CPU by linking it to the memory, on the variant it was
+ *           built for (see inst_select())
  * @param void
  * @return void
  */
-void cpu_init(void) { mem_ptr = mem_get_ptr(); }
+void cpu_init(void) {
+    mem_ptr = mem_get_ptr();
+    mem_map_image();
+    sched_init();
+    inst_select(CPU_VARIANT);
+}
+
+/**
+ * cpu_save_context: Park the state of the running machine
+ * @param ctx Where to save it
+ * @return void
+ */
+void cpu_save_context(struct cpu_context* ctx) {
+    ctx->regs = cpu;
+    ctx->clock = cpu_clock;
+    ctx->instructions = cpu_instructions;
+    ctx->cycles = cycles;
+    ctx->irq_lines = irq_lines;
+    ctx->nmi_pending = nmi_pending;
+    ctx->mem = mem_ptr;
+    ctx->main_cpu = main_cpu;
+}
+
+/**
+ * cpu_load_context: Swap in a parked machine, memory included. The decoded
+ *                   superinstructions stay when the memory is the same (cpus
+ *                   sharing a bus)
+ * @param ctx The saved state
+ * @return void
+ */
+void cpu_load_context(const struct cpu_context* ctx) {
+    struct mem* before = mem_ptr;
+
+    cpu = ctx->regs;
+    cpu_clock = ctx->clock;
+    cpu_instructions = ctx->instructions;
+    cycles = ctx->cycles;
+    irq_lines = ctx->irq_lines;
+    nmi_pending = ctx->nmi_pending;
+    main_cpu = ctx->main_cpu;
+
+    mem_attach(ctx->mem);
+    mem_ptr = mem_get_ptr();
+
+    idle_head = -1;
+    if (mem_ptr != before) inst_decode_flush();
+
+    // the new machine might have interrupts pending
+    sched_kick();
+}
 
 /**
  * cpu_extract_sr: Extract one of the 7 flags from the status reg.
@@ -62,9 +162,199 @@ uint8_t cpu_mod_sr(uint8_t flag, uint8_t val) {
  * @return void
  * */
 void cpu_reset(void) {
+    shm_begin();
     reset();
 
+    // the devices share the reset line
+    irq_lines = 0;
+    mem_io_reset();
+    nmi_pending = 0;
     cycles = 8;
+    cpu_clock += cycles;
+
+    cpu_forget();
+    shm_end();
+}
+
+/**
+ * cpu_forget: Drop what the cpu cached about the program (idle loop being
+ *             tracked, decoded superinstructions), must be called when the
+ *             machine state is changed from outside the cpu (memory poked by
+ *             the host, snapshot restored...)
+ * @param void
+ * @return void
+ * */
+void cpu_forget(void) {
+    idle_head = -1;
+    inst_decode_flush();
+}
+
+/**
+ * cpu_quiet_read: Called by a device from its read handler when the read
+ *                 changed nothing (a status polled while waiting on the host),
+ *                 a loop polling it can then be found idle
+ * @param void
+ * @return void
+ * */
+void cpu_quiet_read(void) { quiet_read = 1; }
+
+/**
+ * cpu_quiet_read_until: Same as cpu_quiet_read() for a value that changes with
+ *                       time (a timer counter): the read changed nothing, but
+ *                       reading again may return something else from the
+ *                       given cycle on, an idle loop is never skipped past it
+ * @param cycle The first cycle the value may differ at
+ * @return void
+ * */
+void cpu_quiet_read_until(uint64_t cycle) {
+    quiet_read = 1;
+    if (cycle < quiet_until) quiet_until = cycle;
+}
+
+/**
+ * cpu_last_opcode: Opcode of the last instruction cpu_run() fetched from the
+ *                  bus, superinstructions aside (a single step never runs one)
+ * @param void
+ * @return the opcode
+ * */
+uint8_t cpu_last_opcode(void) { return last_opcode; }
+
+/**
+ * cpu_irq_assert: Pull the IRQ line down on behalf of a device
+ * @param src The IRQ_SRC_* bit of the device
+ * @return void
+ * */
+void cpu_irq_assert(uint8_t src) {
+    if (main_cpu) {
+        main_cpu->irq_lines |= src;
+        return;
+    }
+
+    irq_lines |= src;
+    sched_kick();
+}
+
+/**
+ * cpu_irq_release: Release the IRQ line on behalf of a device, the line stays
+ *                  asserted as long as another device is pulling it
+ * @param src The IRQ_SRC_* bit of the device
+ * @return void
+ * */
+void cpu_irq_release(uint8_t src) {
+    if (main_cpu) {
+        main_cpu->irq_lines &= ~src;
+        return;
+    }
+
+    irq_lines &= ~src;
+}
+
+/**
+ * cpu_nmi: Signal a falling edge on the NMI line
+ * @param void
+ * @return void
+ * */
+void cpu_nmi(void) {
+    if (main_cpu) {
+        main_cpu->nmi_pending = 1;
+        return;
+    }
+
+    nmi_pending = 1;
+    sched_kick();
+}
+
+/**
+ * cpu_now: Cycle at which the current bus access happens. The clock only
+ *          advances once an instruction is over, so accesses done by a running
+ *          instruction are placed on its last cycle (where loads and stores
+ *          actually touch the bus). The cycle-stepped core knows the exact
+ *          cycle of each access.
+ * @param void
+ * @return the current cycle
+ * */
+uint64_t cpu_now(void) {
+#ifdef CPU_CYCLE_STEPPED
+    return executing ? cpu_clock + bus_cycle - 1 : cpu_clock;
+#else
+    return executing ? cpu_clock + cycles - 1 : cpu_clock;
+#endif
+}
+
+#ifdef CPU_CYCLE_STEPPED
+/**
+ * bus_tick: Start a new bus cycle of the running instruction. Events due by
+ *           then fire before the access, so devices are up to date when they
+ *           see it. Interrupts are still only sampled between instructions.
+ * @param void
+ * @return void
+ * */
+static void bus_tick(void) {
+    bus_cycle++;
+    if (!executing || main_cpu) return;
+
+    uint64_t now = cpu_clock + bus_cycle - 1;
+
+    if (now >= sched_deadline && sched_next() <= now) {
+        sched_run(now);
+        // the events might have changed the interrupt lines
+        sched_kick();
+    }
+}
+
+/**
+ * cpu_bus_settle: Spend the cycles of the running instruction that didn't
+ *                 access the bus, see inst_exec()
+ * @param total The cycles the instruction takes
+ * @return void
+ * */
+void cpu_bus_settle(uint32_t total) {
+    while (bus_cycle < total) bus_tick();
+}
+#endif
+
+/**
+ * service_events: Slow path of cpu_run(), runs the due events and then
+ *                 samples the interrupt lines like the real chip does at the
+ *                 end of every instruction. NMI wins over IRQ.
+ * @param void
+ * @return 1 if an event fired or an interrupt was taken, 0 if not
+ * */
+static uint8_t service_events(void) {
+    uint8_t happened = 0;
+    uint16_t vector = 0;
+
+    // events belong to the main cpu, it'll run them once it gets there
+    if (main_cpu) {
+        sched_deadline = SCHED_NEVER;
+    } else {
+        happened = sched_run(cpu_clock) != 0;
+    }
+
+    if (nmi_pending) {
+        nmi_pending = 0;
+        vector = 0xFFFA;
+    } else if (irq_lines && !cpu_extract_sr(I)) {
+        vector = 0xFFFE;
+    }
+
+    if (vector) {
+#ifdef CPU_CYCLE_STEPPED
+        executing = 1;
+        bus_cycle = 0;
+#endif
+        interrupt(vector, &cycles);
+#ifdef CPU_CYCLE_STEPPED
+        executing = 0;
+#endif
+        cpu_clock += 7;
+        happened = 1;
+    }
+
+    // a masked IRQ must be sampled again once the program clears I
+    if (irq_lines && cpu_extract_sr(I)) sched_kick();
+
+    return happened;
 }
 
 /**
@@ -77,17 +367,17 @@ static int8_t get_mem(uint16_t addr) {
     // data type" if (!(addr >= 0x0000 && addr <= 0xFFFF)) return -1;
     debug_print("(get_mem) reading at: 0x%X\n", addr);
 
-    // no need to check >= 0x0000, it's unsigned
-    if (addr <= 0x00FF) {
-        return mem_ptr->zero_page[addr];
-    } else if (addr >= 0x0100 && addr <= 0x01FF) {
-        return mem_ptr->stack[addr - 0x0100];
-    } else if (addr >= 0xFFFA) {
-        return mem_ptr->last_six[addr - 0xFDFA];
-    } else {
-        debug_print("(get_mem) parsed: 0x%X\n", addr - 0x0200);
-        return mem_ptr->data[addr - 0x0200];
+    if (mem_io_map[addr >> 8]) {
+        struct mem_io* io = mem_io_map[addr >> 8];
+
+        quiet_read = 0;
+        uint8_t data = io->read(addr, io->ctx);
+        if (!quiet_read) bus_touched = 1;
+        return data;
     }
+
+    // the image or the bank the page shows
+    return mem_read_map[addr >> 8][addr & 0xFF];
 }
 
 /**
@@ -100,16 +390,21 @@ static uint8_t write_mem(uint16_t addr, uint8_t data) {
     // this yields "warning: comparison is always true due to limited range of
     // data type" if (!(addr >= 0x0000 && addr <= 0xFFFF)) return 1;
 
-    if (addr <= 0x00FF) {
-        mem_ptr->zero_page[addr] = data;
-    } else if (addr >= 0x0100 && addr <= 0x01FF) {
-        mem_ptr->stack[addr - 0x0100] = data;
-    } else if (addr >= 0xFFFA) {
-        mem_ptr->last_six[addr - 0xFDFA] = data;
-    } else {
-        mem_ptr->data[addr - 0x0200] = data;
+    bus_touched = 1;
+
+    // superinstructions decoded over this byte, see inst_exec_fused()
+    inst_decoded[addr >> 8] = 0;
+    inst_decoded[(uint16_t)(addr - 6) >> 8] = 0;
+
+    if (mem_io_map[addr >> 8]) {
+        struct mem_io* io = mem_io_map[addr >> 8];
+        io->write(addr, data, io->ctx);
+        return 0;
     }
 
+    mem_dirty[addr >> 8] = 1;
+    mem_write_map[addr >> 8][addr & 0xFF] = data;
+
     return 0;
 }
 
@@ -119,6 +414,9 @@ static uint8_t write_mem(uint16_t addr, uint8_t data) {
  * @return The retrieved data
  */
 uint8_t cpu_fetch(uint16_t addr) {
+#ifdef CPU_CYCLE_STEPPED
+    bus_tick();
+#endif
     debug_print("(cpu_fetch) reading at: 0x%X\n", addr);
     uint8_t data = get_mem(addr);
     debug_print("(cpu_fetch) GOT: 0x%X\n", data);
@@ -127,6 +425,38 @@ uint8_t cpu_fetch(uint16_t addr) {
     return data;
 }
 
+#ifdef CPU_CYCLE_STEPPED
+/**
+ * cpu_dummy_read: Read the bus and throw the data away, unlike cpu_fetch()
+ *                 it never moves the pc. Devices still see the access.
+ * @param addr The address on the bus
+ * @return void
+ */
+void cpu_dummy_read(uint16_t addr) {
+    bus_tick();
+    get_mem(addr);
+}
+#endif
+
+/**
+ * cpu_written: Bookkeeping of a block written straight in memory by the core
+ *              (see the loops in instructions.c), same as write_mem() does
+ * @param addr The first address written, must be plain RAM
+ * @param len The number of bytes, the range must not wrap around 0xFFFF
+ * @return void
+ */
+void cpu_written(uint16_t addr, uint32_t len) {
+    if (len == 0) return;
+
+    bus_touched = 1;
+    inst_decoded[(uint16_t)(addr - 6) >> 8] = 0;
+
+    for (uint32_t page = addr >> 8; page <= (addr + len - 1) >> 8; page++) {
+        mem_dirty[page] = 1;
+        inst_decoded[page] = 0;
+    }
+}
+
 /**
  * cpu_write: Wrapper for write_mem()
  * @param addr The address to be written to
@@ -134,31 +464,230 @@ uint8_t cpu_fetch(uint16_t addr) {
  * @return 0 if success, 1 if failure
  */
 uint8_t cpu_write(uint16_t addr, uint8_t data) {
+#ifdef CPU_CYCLE_STEPPED
+    bus_tick();
+#endif
     return write_mem(addr, data) == 1 ? 1 : 0;
 }
 
 /**
- * cpu_exec: Execute fetched data (single stepping)
- * @param void
- * @return void
+ * cpu_set_breakpoint: Add or remove a breakpoint, see cpu_run()
+ * @param addr The address of the instruction
+ * @param on 1 to set it, 0 to clear it
+ * @return 1 if there was one before, to put a temporary one back as it was
  */
-void cpu_exec() {
-    debug_print("(cpu_exec) cycles: %d, mem: %p\n", cycles, (void*)mem_ptr);
-
-    int8_t fetched;
-    do {
-        debug_print("(loop) cycles: %d\n", cycles);
-        // executing in a take
-        if (cycles == 0) {
-            fetched = cpu_fetch(cpu.pc);
-            if (fetched == -1) {
-                printf("(FAILED) Couldn't fetch valid data!\n");
-                exit(1);
-            };
-
-            debug_print("(cpu_exec) fetched: 0x%X\n", fetched);
-            inst_exec(fetched, &cycles);
+uint8_t cpu_set_breakpoint(uint16_t addr, uint8_t on) {
+    uint8_t bit = 1 << (addr & 7);
+    uint8_t was = (breakpoints[addr >> 3] & bit) != 0;
+
+    if (on && !(breakpoints[addr >> 3] & bit)) {
+        breakpoints[addr >> 3] |= bit;
+        breakpoint_count++;
+    } else if (!on && (breakpoints[addr >> 3] & bit)) {
+        breakpoints[addr >> 3] &= ~bit;
+        breakpoint_count--;
+    }
+
+    return was;
+}
+
+/**
+ * idle_check: Called after a jump or branch going backwards. A loop that comes
+ *             back to the same instruction with the same registers, without
+ *             writing anything or reading a device, is polling memory that
+ *             only an event (or the host) can change: all of its iterations
+ *             until the next event are the same, so the clock skips them in
+ *             bulk. The skip stops short of the event and of the end of the
+ *             run, the remaining iterations execute normally so timings stay
+ *             exact. The skipped iterations count as executed instructions.
+ * @param end Cycle at which cpu_run() has to return
+ * @return 1 if nothing is scheduled and nothing polled changes with time (only
+ *         the host can wake the loop up), 0 otherwise
+ */
+static uint8_t idle_check(uint64_t end) {
+    // reads of the last iteration that return something else from then on
+    uint64_t until = quiet_until;
+    quiet_until = SCHED_NEVER;
+
+    if (cpu.pc != idle_head || bus_touched || cpu.ac != idle_regs.ac ||
+        cpu.x != idle_regs.x || cpu.y != idle_regs.y ||
+        cpu.sp != idle_regs.sp || cpu.sr != idle_regs.sr) {
+        // new candidate
+        idle_head = cpu.pc;
+        idle_regs = cpu;
+        idle_clock = cpu_clock;
+        idle_instructions = cpu_instructions;
+        bus_touched = 0;
+        return 0;
+    }
+
+    uint64_t period = cpu_clock - idle_clock;
+    uint64_t target = sched_deadline < end ? sched_deadline : end;
+    if (until < target) target = until;
+
+    if (target > cpu_clock) {
+        uint64_t skipped = (target - cpu_clock - 1) / period;
+
+        cpu_clock += skipped * period;
+        cpu_instructions += skipped * (cpu_instructions - idle_instructions);
+    }
+    idle_clock = cpu_clock;
+    idle_instructions = cpu_instructions;
+
+    return sched_deadline == SCHED_NEVER && until == SCHED_NEVER;
+}
+
+/**
+ * room: Cycles before the next check cpu_run() has to do (event or budget)
+ * @param end Cycle at which cpu_run() has to return
+ * @return the cycles
+ */
+static uint64_t room(uint64_t end) {
+    uint64_t limit = sched_deadline < end ? sched_deadline : end;
+    return limit > cpu_clock ? limit - cpu_clock : 0;
+}
+
+/**
+ * cpu_run: Execute instructions until the cycle budget is used up or one of
+ *          the requested stop conditions happens. Whole instructions are
+ *          always executed, so the last one may go past the budget.
+ *
+ *          Conditions are only checked where they are cheap: breakpoints
+ *          before an instruction (and only if any is set), BRK, illegal
+ *          opcodes and the I flag after it, events on the scheduler slow
+ *          path. A breakpoint on the
+ *          first instruction is ignored, so a stopped program can be resumed.
+ *
+ *          Idle loops are fast-forwarded up to the next event, see
+ *          idle_check(). If nothing is scheduled the loop can only be woken
+ *          up by the host, CPU_STOP_IDLE lets it block instead of spinning.
+ *
+ *          Common pairs of instructions run as superinstructions (see
+ *          inst_exec_fused()) unless a check would land between the two, so
+ *          single stepping always executes one instruction.
+ *
+ * @param budget The cycles to run
+ * @param stop_mask CPU_STOP_* conditions to stop on
+ * @param ran If not NULL, set to the cycles actually run
+ * @return the CPU_STOP_* condition that stopped it, CPU_STOP_BUDGET if none
+ */
+uint8_t cpu_run(uint64_t budget, uint8_t stop_mask, uint64_t* ran) {
+    uint64_t start = cpu_clock, end = start + budget;
+    uint8_t reason = CPU_STOP_BUDGET;
+
+    uint8_t check_bp = (stop_mask & CPU_STOP_BREAKPOINT) && breakpoint_count;
+    uint8_t check_after = stop_mask & (CPU_STOP_BRK | CPU_STOP_IFLAG | CPU_STOP_ILLEGAL);
+    uint8_t first = 1;
+
+    // a breakpoint could sit on the second instruction of a pair, and pairs
+    // don't do their accesses cycle by cycle
+#ifdef CPU_CYCLE_STEPPED
+    uint8_t fuse = 0;
+#else
+    uint8_t fuse = !check_bp;
+#endif
+
+    if (end < start) end = UINT64_MAX;
+
+    // the exported memory goes live, see shm.c
+    shm_running(1);
+
+    while (cpu_clock < end) {
+        if (check_bp && !first && (breakpoints[cpu.pc >> 3] & (1 << (cpu.pc & 7)))) {
+            reason = CPU_STOP_BREAKPOINT;
+            break;
+        }
+        first = 0;
+
+        uint16_t pc = cpu.pc;
+        // NOP as far as the checks below care, pairs never contain a BRK
+        uint8_t opcode = 0xEA;
+
+        executing = 1;
+#ifdef CPU_CYCLE_STEPPED
+        bus_cycle = 0;
+#endif
+        uint32_t done = fuse ? inst_exec_fused(room(end), &cycles) : 0;
+
+        if (!done) {
+            opcode = cpu_fetch(pc);
+            last_opcode = opcode;
+            debug_print("(cpu_run) fetched: 0x%X\n", opcode);
+            inst_exec(opcode, &cycles);
+            done = 1;
+        }
+        executing = 0;
+
+        cpu_instructions += done;
+
+        cpu_clock += cycles;
+
+        if (cpu.pc <= pc && idle_check(end) && (stop_mask & CPU_STOP_IDLE)) {
+            reason = CPU_STOP_IDLE;
+            break;
+        }
+
+        if (cpu_clock >= sched_deadline && service_events() &&
+            (stop_mask & CPU_STOP_EVENT)) {
+            reason = CPU_STOP_EVENT;
+            break;
+        }
+
+        if (check_after) {
+            if ((check_after & CPU_STOP_BRK) && opcode == 0x00) {
+                reason = CPU_STOP_BRK;
+                break;
+            }
+            if ((check_after & CPU_STOP_ILLEGAL) && inst_is_illegal(opcode)) {
+                reason = CPU_STOP_ILLEGAL;
+                break;
+            }
+            if ((check_after & CPU_STOP_IFLAG) && (cpu.sr & (1 << I))) {
+                reason = CPU_STOP_IFLAG;
+                break;
+            }
         }
-        cycles--;
-    } while (cycles != 0);
+    }
+
+    shm_running(0);
+
+    if (ran) *ran = cpu_clock - start;
+    return reason;
 }
+
+/**
+ * cpu_step_on: Execute one instruction of a machine that isn't the running
+ *              one, without events, interrupts or superinstructions. Used by
+ *              engines keeping machines outside of the core (see batch.c)
+ * @param regs The registers of the machine, updated
+ * @param m Its memory
+ * @return the cycles the instruction took
+ */
+uint32_t cpu_step_on(struct central_processing_unit* regs, struct mem* m) {
+    struct central_processing_unit saved = cpu;
+    struct mem* saved_mem = mem_ptr;
+    uint32_t took = 0;
+
+    cpu = *regs;
+    mem_attach(m);
+    mem_ptr = m;
+#ifdef CPU_CYCLE_STEPPED
+    bus_cycle = 0;
+#endif
+
+    inst_exec(cpu_fetch(cpu.pc), &took);
+
+    *regs = cpu;
+    cpu = saved;
+    mem_attach(saved_mem);
+    mem_ptr = saved_mem;
+
+    return took;
+}
+
+/**
+ * cpu_exec: Execute a single instruction (single stepping)
+ * @param void
+ * @return void
+ */
+void cpu_exec() { cpu_run(1, 0, NULL); }
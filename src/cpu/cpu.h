@@ -33,14 +33,79 @@ struct central_processing_unit {
 #define V 6
 #define N 7
 
+/*
+ * Interrupt sources, each device pulling the (wired-OR) IRQ line down gets
+ * its own bit so that releasing it doesn't drop the others.
+ * */
+#define IRQ_SRC_EXTERNAL    (1 << 0)
+#define IRQ_SRC_VIA         (1 << 1)
+#define IRQ_SRC_KEYBOARD    (1 << 2)
+
+/*
+ * Reasons for cpu_run() to return, also used as its stop mask. Running out of
+ * budget always stops it.
+ * */
+#define CPU_STOP_BUDGET     0
+#define CPU_STOP_BREAKPOINT (1 << 0)
+#define CPU_STOP_BRK        (1 << 1)
+#define CPU_STOP_IFLAG      (1 << 2)
+#define CPU_STOP_EVENT      (1 << 3)
+#define CPU_STOP_IDLE       (1 << 4)
+#define CPU_STOP_ILLEGAL    (1 << 5)
+
+struct mem;
+
+/*
+ * Everything the core keeps about the machine it's running. The core only
+ * drives one machine at a time, others are parked in a context and swapped
+ * in with cpu_load_context().
+ *
+ * A machine can have several cpus sharing its bus (see multi.c), main_cpu is
+ * NULL for its main one. The others leave the scheduled events to it, and
+ * the devices' interrupt lines go to it whichever cpu touches them.
+ * */
+struct cpu_context {
+    struct central_processing_unit regs;
+    uint64_t clock;
+    uint64_t instructions;
+    uint32_t cycles;
+    uint8_t irq_lines;
+    uint8_t nmi_pending;
+    struct mem* mem;
+    struct cpu_context* main_cpu;
+};
+
 extern struct central_processing_unit cpu;
+extern uint64_t cpu_clock;
+extern uint64_t cpu_instructions;
+
+// cycles of the last instruction executed, see cpu_run()
+extern uint32_t cycles;
 
 void cpu_reset(void);
 uint8_t cpu_extract_sr(uint8_t flag);
 uint8_t cpu_mod_sr(uint8_t flag, uint8_t val);
 uint8_t cpu_fetch(uint16_t addr);
 uint8_t cpu_write(uint16_t addr, uint8_t data);
+void cpu_written(uint16_t addr, uint32_t len);
+#ifdef CPU_CYCLE_STEPPED
+void cpu_dummy_read(uint16_t addr);
+void cpu_bus_settle(uint32_t total);
+#endif
 void cpu_exec();
+uint32_t cpu_step_on(struct central_processing_unit* regs, struct mem* m);
+uint8_t cpu_run(uint64_t budget, uint8_t stop_mask, uint64_t* ran);
+uint8_t cpu_set_breakpoint(uint16_t addr, uint8_t on);
+void cpu_forget(void);
+void cpu_quiet_read(void);
+void cpu_quiet_read_until(uint64_t cycle);
+uint8_t cpu_last_opcode(void);
 void cpu_init(void);
+void cpu_irq_assert(uint8_t src);
+void cpu_irq_release(uint8_t src);
+void cpu_nmi(void);
+uint64_t cpu_now(void);
+void cpu_save_context(struct cpu_context* ctx);
+void cpu_load_context(const struct cpu_context* ctx);
 
 #endif
@@ -11,9 +11,11 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "../utils/misc.h"
 #include "../mem/mem.h"
+#include "alu.h"
 #include "cpu.h"
 
 /*
@@ -34,6 +36,9 @@ static uint8_t IND(void);
 static uint8_t IZX(void);
 static uint8_t IZY(void);
 static uint8_t REL(void);
+static uint8_t IZP(void);
+static uint8_t IAX(void);
+static uint8_t INDF(void);
 
 /*
  * =============================================
@@ -98,10 +103,46 @@ static uint8_t TAX(void);
 static uint8_t TAY(void);
 static uint8_t TSX(void);
 static uint8_t JMP(void);
+static uint8_t IGN(void);
+
+// 65C02
+static uint8_t BRA(void);
+static uint8_t STZ(void);
+static uint8_t PHX(void);
+static uint8_t PHY(void);
+static uint8_t PLX(void);
+static uint8_t PLY(void);
+static uint8_t TSB(void);
+static uint8_t TRB(void);
+static uint8_t INA(void);
+static uint8_t DEA(void);
+static uint8_t BIT_IMM(void);
+static uint8_t ADC_C(void);
+static uint8_t SBC_C(void);
+
+// NMOS unofficial opcodes
+static uint8_t SLO(void);
+static uint8_t RLA(void);
+static uint8_t SRE(void);
+static uint8_t RRA(void);
+static uint8_t SAX(void);
+static uint8_t LAX(void);
+static uint8_t LAS(void);
+static uint8_t DCP(void);
+static uint8_t ISC(void);
+static uint8_t ANC(void);
+static uint8_t ALR(void);
+static uint8_t ARR(void);
+static uint8_t SBX(void);
+
+// the populated matrices of opcodes, one per cpu variant (see inst_select()),
+// not a clean solution but they're easily understandable
 
-// the populated matrix of opcodes, not a clean solution but it's easily
-// understandable
-struct instruction lookup[256] = {
+/*
+ * NMOS 6502, the original table: unofficial opcodes are "???", the ones
+ * known to be harmless run as NOPs
+ * */
+static const struct instruction nmos[256] = {
     {"BRK", &BRK, &IMM, 7}, {"ORA", &ORA, &IZX, 6}, {"???", &XXX, &IMP, 2},
     {"???", &XXX, &IMP, 8}, {"???", &NOP, &IMP, 3}, {"ORA", &ORA, &ZP0, 3},
     {"ASL", &ASL, &ZP0, 5}, {"???", &XXX, &IMP, 5}, {"PHP", &PHP, &IMP, 3},
@@ -190,6 +231,200 @@ struct instruction lookup[256] = {
     {"???", &XXX, &IMP, 7},
 };
 
+/*
+ * NMOS 6502 with the stable unofficial opcodes (the combined read-modify-write
+ * ones, LAX, SAX...) and the NOPs with their real operands. The jams and the
+ * unstable opcodes (ANE, LXA, SHA, SHX, SHY, TAS) stay "???"
+ * */
+static const struct instruction nmos_illegal[256] = {
+    {"BRK", &BRK, &IMM, 7}, {"ORA", &ORA, &IZX, 6}, {"???", &XXX, &IMP, 2},
+    {"SLO", &SLO, &IZX, 8}, {"NOP", &IGN, &ZP0, 3}, {"ORA", &ORA, &ZP0, 3},
+    {"ASL", &ASL, &ZP0, 5}, {"SLO", &SLO, &ZP0, 5}, {"PHP", &PHP, &IMP, 3},
+    {"ORA", &ORA, &IMM, 2}, {"ASL", &ASL, &IMP, 2}, {"ANC", &ANC, &IMM, 2},
+    {"NOP", &IGN, &ABS, 4}, {"ORA", &ORA, &ABS, 4}, {"ASL", &ASL, &ABS, 6},
+    {"SLO", &SLO, &ABS, 6}, {"BPL", &BPL, &REL, 2}, {"ORA", &ORA, &IZY, 5},
+    {"???", &XXX, &IMP, 2}, {"SLO", &SLO, &IZY, 8}, {"NOP", &IGN, &ZPX, 4},
+    {"ORA", &ORA, &ZPX, 4}, {"ASL", &ASL, &ZPX, 6}, {"SLO", &SLO, &ZPX, 6},
+    {"CLC", &CLC, &IMP, 2}, {"ORA", &ORA, &ABY, 4}, {"NOP", &IGN, &IMP, 2},
+    {"SLO", &SLO, &ABY, 7}, {"NOP", &IGN, &ABX, 4}, {"ORA", &ORA, &ABX, 4},
+    {"ASL", &ASL, &ABX, 7}, {"SLO", &SLO, &ABX, 7}, {"JSR", &JSR, &ABS, 6},
+    {"AND", &AND, &IZX, 6}, {"???", &XXX, &IMP, 2}, {"RLA", &RLA, &IZX, 8},
+    {"BIT", &BIT, &ZP0, 3}, {"AND", &AND, &ZP0, 3}, {"ROL", &ROL, &ZP0, 5},
+    {"RLA", &RLA, &ZP0, 5}, {"PLP", &PLP, &IMP, 4}, {"AND", &AND, &IMM, 2},
+    {"ROL", &ROL, &IMP, 2}, {"ANC", &ANC, &IMM, 2}, {"BIT", &BIT, &ABS, 4},
+    {"AND", &AND, &ABS, 4}, {"ROL", &ROL, &ABS, 6}, {"RLA", &RLA, &ABS, 6},
+    {"BMI", &BMI, &REL, 2}, {"AND", &AND, &IZY, 5}, {"???", &XXX, &IMP, 2},
+    {"RLA", &RLA, &IZY, 8}, {"NOP", &IGN, &ZPX, 4}, {"AND", &AND, &ZPX, 4},
+    {"ROL", &ROL, &ZPX, 6}, {"RLA", &RLA, &ZPX, 6}, {"SEC", &SEC, &IMP, 2},
+    {"AND", &AND, &ABY, 4}, {"NOP", &IGN, &IMP, 2}, {"RLA", &RLA, &ABY, 7},
+    {"NOP", &IGN, &ABX, 4}, {"AND", &AND, &ABX, 4}, {"ROL", &ROL, &ABX, 7},
+    {"RLA", &RLA, &ABX, 7}, {"RTI", &RTI, &IMP, 6}, {"EOR", &EOR, &IZX, 6},
+    {"???", &XXX, &IMP, 2}, {"SRE", &SRE, &IZX, 8}, {"NOP", &IGN, &ZP0, 3},
+    {"EOR", &EOR, &ZP0, 3}, {"LSR", &LSR, &ZP0, 5}, {"SRE", &SRE, &ZP0, 5},
+    {"PHA", &PHA, &IMP, 3}, {"EOR", &EOR, &IMM, 2}, {"LSR", &LSR, &IMP, 2},
+    {"ALR", &ALR, &IMM, 2}, {"JMP", &JMP, &ABS, 3}, {"EOR", &EOR, &ABS, 4},
+    {"LSR", &LSR, &ABS, 6}, {"SRE", &SRE, &ABS, 6}, {"BVC", &BVC, &REL, 2},
+    {"EOR", &EOR, &IZY, 5}, {"???", &XXX, &IMP, 2}, {"SRE", &SRE, &IZY, 8},
+    {"NOP", &IGN, &ZPX, 4}, {"EOR", &EOR, &ZPX, 4}, {"LSR", &LSR, &ZPX, 6},
+    {"SRE", &SRE, &ZPX, 6}, {"CLI", &CLI, &IMP, 2}, {"EOR", &EOR, &ABY, 4},
+    {"NOP", &IGN, &IMP, 2}, {"SRE", &SRE, &ABY, 7}, {"NOP", &IGN, &ABX, 4},
+    {"EOR", &EOR, &ABX, 4}, {"LSR", &LSR, &ABX, 7}, {"SRE", &SRE, &ABX, 7},
+    {"RTS", &RTS, &IMP, 6}, {"ADC", &ADC, &IZX, 6}, {"???", &XXX, &IMP, 2},
+    {"RRA", &RRA, &IZX, 8}, {"NOP", &IGN, &ZP0, 3}, {"ADC", &ADC, &ZP0, 3},
+    {"ROR", &ROR, &ZP0, 5}, {"RRA", &RRA, &ZP0, 5}, {"PLA", &PLA, &IMP, 4},
+    {"ADC", &ADC, &IMM, 2}, {"ROR", &ROR, &IMP, 2}, {"ARR", &ARR, &IMM, 2},
+    {"JMP", &JMP, &IND, 5}, {"ADC", &ADC, &ABS, 4}, {"ROR", &ROR, &ABS, 6},
+    {"RRA", &RRA, &ABS, 6}, {"BVS", &BVS, &REL, 2}, {"ADC", &ADC, &IZY, 5},
+    {"???", &XXX, &IMP, 2}, {"RRA", &RRA, &IZY, 8}, {"NOP", &IGN, &ZPX, 4},
+    {"ADC", &ADC, &ZPX, 4}, {"ROR", &ROR, &ZPX, 6}, {"RRA", &RRA, &ZPX, 6},
+    {"SEI", &SEI, &IMP, 2}, {"ADC", &ADC, &ABY, 4}, {"NOP", &IGN, &IMP, 2},
+    {"RRA", &RRA, &ABY, 7}, {"NOP", &IGN, &ABX, 4}, {"ADC", &ADC, &ABX, 4},
+    {"ROR", &ROR, &ABX, 7}, {"RRA", &RRA, &ABX, 7}, {"NOP", &IGN, &IMM, 2},
+    {"STA", &STA, &IZX, 6}, {"NOP", &IGN, &IMM, 2}, {"SAX", &SAX, &IZX, 6},
+    {"STY", &STY, &ZP0, 3}, {"STA", &STA, &ZP0, 3}, {"STX", &STX, &ZP0, 3},
+    {"SAX", &SAX, &ZP0, 3}, {"DEY", &DEY, &IMP, 2}, {"NOP", &IGN, &IMM, 2},
+    {"TXA", &TXA, &IMP, 2}, {"???", &XXX, &IMP, 2}, {"STY", &STY, &ABS, 4},
+    {"STA", &STA, &ABS, 4}, {"STX", &STX, &ABS, 4}, {"SAX", &SAX, &ABS, 4},
+    {"BCC", &BCC, &REL, 2}, {"STA", &STA, &IZY, 6}, {"???", &XXX, &IMP, 2},
+    {"???", &XXX, &IMP, 6}, {"STY", &STY, &ZPX, 4}, {"STA", &STA, &ZPX, 4},
+    {"STX", &STX, &ZPY, 4}, {"SAX", &SAX, &ZPY, 4}, {"TYA", &TYA, &IMP, 2},
+    {"STA", &STA, &ABY, 5}, {"TXS", &TXS, &IMP, 2}, {"???", &XXX, &IMP, 5},
+    {"???", &XXX, &IMP, 5}, {"STA", &STA, &ABX, 5}, {"???", &XXX, &IMP, 5},
+    {"???", &XXX, &IMP, 5}, {"LDY", &LDY, &IMM, 2}, {"LDA", &LDA, &IZX, 6},
+    {"LDX", &LDX, &IMM, 2}, {"LAX", &LAX, &IZX, 6}, {"LDY", &LDY, &ZP0, 3},
+    {"LDA", &LDA, &ZP0, 3}, {"LDX", &LDX, &ZP0, 3}, {"LAX", &LAX, &ZP0, 3},
+    {"TAY", &TAY, &IMP, 2}, {"LDA", &LDA, &IMM, 2}, {"TAX", &TAX, &IMP, 2},
+    {"???", &XXX, &IMP, 2}, {"LDY", &LDY, &ABS, 4}, {"LDA", &LDA, &ABS, 4},
+    {"LDX", &LDX, &ABS, 4}, {"LAX", &LAX, &ABS, 4}, {"BCS", &BCS, &REL, 2},
+    {"LDA", &LDA, &IZY, 5}, {"???", &XXX, &IMP, 2}, {"LAX", &LAX, &IZY, 5},
+    {"LDY", &LDY, &ZPX, 4}, {"LDA", &LDA, &ZPX, 4}, {"LDX", &LDX, &ZPY, 4},
+    {"LAX", &LAX, &ZPY, 4}, {"CLV", &CLV, &IMP, 2}, {"LDA", &LDA, &ABY, 4},
+    {"TSX", &TSX, &IMP, 2}, {"LAS", &LAS, &ABY, 4}, {"LDY", &LDY, &ABX, 4},
+    {"LDA", &LDA, &ABX, 4}, {"LDX", &LDX, &ABY, 4}, {"LAX", &LAX, &ABY, 4},
+    {"CPY", &CPY, &IMM, 2}, {"CMP", &CMP, &IZX, 6}, {"NOP", &IGN, &IMM, 2},
+    {"DCP", &DCP, &IZX, 8}, {"CPY", &CPY, &ZP0, 3}, {"CMP", &CMP, &ZP0, 3},
+    {"DEC", &DEC, &ZP0, 5}, {"DCP", &DCP, &ZP0, 5}, {"INY", &INY, &IMP, 2},
+    {"CMP", &CMP, &IMM, 2}, {"DEX", &DEX, &IMP, 2}, {"SBX", &SBX, &IMM, 2},
+    {"CPY", &CPY, &ABS, 4}, {"CMP", &CMP, &ABS, 4}, {"DEC", &DEC, &ABS, 6},
+    {"DCP", &DCP, &ABS, 6}, {"BNE", &BNE, &REL, 2}, {"CMP", &CMP, &IZY, 5},
+    {"???", &XXX, &IMP, 2}, {"DCP", &DCP, &IZY, 8}, {"NOP", &IGN, &ZPX, 4},
+    {"CMP", &CMP, &ZPX, 4}, {"DEC", &DEC, &ZPX, 6}, {"DCP", &DCP, &ZPX, 6},
+    {"CLD", &CLD, &IMP, 2}, {"CMP", &CMP, &ABY, 4}, {"NOP", &IGN, &IMP, 2},
+    {"DCP", &DCP, &ABY, 7}, {"NOP", &IGN, &ABX, 4}, {"CMP", &CMP, &ABX, 4},
+    {"DEC", &DEC, &ABX, 7}, {"DCP", &DCP, &ABX, 7}, {"CPX", &CPX, &IMM, 2},
+    {"SBC", &SBC, &IZX, 6}, {"NOP", &IGN, &IMM, 2}, {"ISC", &ISC, &IZX, 8},
+    {"CPX", &CPX, &ZP0, 3}, {"SBC", &SBC, &ZP0, 3}, {"INC", &INC, &ZP0, 5},
+    {"ISC", &ISC, &ZP0, 5}, {"INX", &INX, &IMP, 2}, {"SBC", &SBC, &IMM, 2},
+    {"NOP", &IGN, &IMP, 2}, {"SBC", &SBC, &IMM, 2}, {"CPX", &CPX, &ABS, 4},
+    {"SBC", &SBC, &ABS, 4}, {"INC", &INC, &ABS, 6}, {"ISC", &ISC, &ABS, 6},
+    {"BEQ", &BEQ, &REL, 2}, {"SBC", &SBC, &IZY, 5}, {"???", &XXX, &IMP, 2},
+    {"ISC", &ISC, &IZY, 8}, {"NOP", &IGN, &ZPX, 4}, {"SBC", &SBC, &ZPX, 4},
+    {"INC", &INC, &ZPX, 6}, {"ISC", &ISC, &ZPX, 6}, {"SED", &SED, &IMP, 2},
+    {"SBC", &SBC, &ABY, 4}, {"NOP", &IGN, &IMP, 2}, {"ISC", &ISC, &ABY, 7},
+    {"NOP", &IGN, &ABX, 4}, {"SBC", &SBC, &ABX, 4}, {"INC", &INC, &ABX, 7},
+    {"ISC", &ISC, &ABX, 7},
+};
+
+/*
+ * 65C02: the new instructions and the (zp) mode, JMP (abs) without the page
+ * wrap bug, decimal mode setting N and Z, every unused opcode is a NOP. The
+ * Rockwell bit instructions (RMB, SMB, BBR, BBS) aren't there
+ * */
+static const struct instruction cmos[256] = {
+    {"BRK", &BRK, &IMM, 7}, {"ORA", &ORA, &IZX, 6}, {"NOP", &IGN, &IMM, 2},
+    {"NOP", &IGN, &IMP, 1}, {"TSB", &TSB, &ZP0, 5}, {"ORA", &ORA, &ZP0, 3},
+    {"ASL", &ASL, &ZP0, 5}, {"NOP", &IGN, &IMP, 1}, {"PHP", &PHP, &IMP, 3},
+    {"ORA", &ORA, &IMM, 2}, {"ASL", &ASL, &IMP, 2}, {"NOP", &IGN, &IMP, 1},
+    {"TSB", &TSB, &ABS, 6}, {"ORA", &ORA, &ABS, 4}, {"ASL", &ASL, &ABS, 6},
+    {"NOP", &IGN, &IMP, 1}, {"BPL", &BPL, &REL, 2}, {"ORA", &ORA, &IZY, 5},
+    {"ORA", &ORA, &IZP, 5}, {"NOP", &IGN, &IMP, 1}, {"TRB", &TRB, &ZP0, 5},
+    {"ORA", &ORA, &ZPX, 4}, {"ASL", &ASL, &ZPX, 6}, {"NOP", &IGN, &IMP, 1},
+    {"CLC", &CLC, &IMP, 2}, {"ORA", &ORA, &ABY, 4}, {"INA", &INA, &IMP, 2},
+    {"NOP", &IGN, &IMP, 1}, {"TRB", &TRB, &ABS, 6}, {"ORA", &ORA, &ABX, 4},
+    {"ASL", &ASL, &ABX, 7}, {"NOP", &IGN, &IMP, 1}, {"JSR", &JSR, &ABS, 6},
+    {"AND", &AND, &IZX, 6}, {"NOP", &IGN, &IMM, 2}, {"NOP", &IGN, &IMP, 1},
+    {"BIT", &BIT, &ZP0, 3}, {"AND", &AND, &ZP0, 3}, {"ROL", &ROL, &ZP0, 5},
+    {"NOP", &IGN, &IMP, 1}, {"PLP", &PLP, &IMP, 4}, {"AND", &AND, &IMM, 2},
+    {"ROL", &ROL, &IMP, 2}, {"NOP", &IGN, &IMP, 1}, {"BIT", &BIT, &ABS, 4},
+    {"AND", &AND, &ABS, 4}, {"ROL", &ROL, &ABS, 6}, {"NOP", &IGN, &IMP, 1},
+    {"BMI", &BMI, &REL, 2}, {"AND", &AND, &IZY, 5}, {"AND", &AND, &IZP, 5},
+    {"NOP", &IGN, &IMP, 1}, {"BIT", &BIT, &ZPX, 4}, {"AND", &AND, &ZPX, 4},
+    {"ROL", &ROL, &ZPX, 6}, {"NOP", &IGN, &IMP, 1}, {"SEC", &SEC, &IMP, 2},
+    {"AND", &AND, &ABY, 4}, {"DEA", &DEA, &IMP, 2}, {"NOP", &IGN, &IMP, 1},
+    {"BIT", &BIT, &ABX, 4}, {"AND", &AND, &ABX, 4}, {"ROL", &ROL, &ABX, 7},
+    {"NOP", &IGN, &IMP, 1}, {"RTI", &RTI, &IMP, 6}, {"EOR", &EOR, &IZX, 6},
+    {"NOP", &IGN, &IMM, 2}, {"NOP", &IGN, &IMP, 1}, {"NOP", &IGN, &ZP0, 3},
+    {"EOR", &EOR, &ZP0, 3}, {"LSR", &LSR, &ZP0, 5}, {"NOP", &IGN, &IMP, 1},
+    {"PHA", &PHA, &IMP, 3}, {"EOR", &EOR, &IMM, 2}, {"LSR", &LSR, &IMP, 2},
+    {"NOP", &IGN, &IMP, 1}, {"JMP", &JMP, &ABS, 3}, {"EOR", &EOR, &ABS, 4},
+    {"LSR", &LSR, &ABS, 6}, {"NOP", &IGN, &IMP, 1}, {"BVC", &BVC, &REL, 2},
+    {"EOR", &EOR, &IZY, 5}, {"EOR", &EOR, &IZP, 5}, {"NOP", &IGN, &IMP, 1},
+    {"NOP", &IGN, &ZPX, 4}, {"EOR", &EOR, &ZPX, 4}, {"LSR", &LSR, &ZPX, 6},
+    {"NOP", &IGN, &IMP, 1}, {"CLI", &CLI, &IMP, 2}, {"EOR", &EOR, &ABY, 4},
+    {"PHY", &PHY, &IMP, 3}, {"NOP", &IGN, &IMP, 1}, {"NOP", &IGN, &ABS, 8},
+    {"EOR", &EOR, &ABX, 4}, {"LSR", &LSR, &ABX, 7}, {"NOP", &IGN, &IMP, 1},
+    {"RTS", &RTS, &IMP, 6}, {"ADC", &ADC_C, &IZX, 6}, {"NOP", &IGN, &IMM, 2},
+    {"NOP", &IGN, &IMP, 1}, {"STZ", &STZ, &ZP0, 3}, {"ADC", &ADC_C, &ZP0, 3},
+    {"ROR", &ROR, &ZP0, 5}, {"NOP", &IGN, &IMP, 1}, {"PLA", &PLA, &IMP, 4},
+    {"ADC", &ADC_C, &IMM, 2}, {"ROR", &ROR, &IMP, 2}, {"NOP", &IGN, &IMP, 1},
+    {"JMP", &JMP, &INDF, 6}, {"ADC", &ADC_C, &ABS, 4}, {"ROR", &ROR, &ABS, 6},
+    {"NOP", &IGN, &IMP, 1}, {"BVS", &BVS, &REL, 2}, {"ADC", &ADC_C, &IZY, 5},
+    {"ADC", &ADC_C, &IZP, 5}, {"NOP", &IGN, &IMP, 1}, {"STZ", &STZ, &ZPX, 4},
+    {"ADC", &ADC_C, &ZPX, 4}, {"ROR", &ROR, &ZPX, 6}, {"NOP", &IGN, &IMP, 1},
+    {"SEI", &SEI, &IMP, 2}, {"ADC", &ADC_C, &ABY, 4}, {"PLY", &PLY, &IMP, 4},
+    {"NOP", &IGN, &IMP, 1}, {"JMP", &JMP, &IAX, 6}, {"ADC", &ADC_C, &ABX, 4},
+    {"ROR", &ROR, &ABX, 7}, {"NOP", &IGN, &IMP, 1}, {"BRA", &BRA, &REL, 2},
+    {"STA", &STA, &IZX, 6}, {"NOP", &IGN, &IMM, 2}, {"NOP", &IGN, &IMP, 1},
+    {"STY", &STY, &ZP0, 3}, {"STA", &STA, &ZP0, 3}, {"STX", &STX, &ZP0, 3},
+    {"NOP", &IGN, &IMP, 1}, {"DEY", &DEY, &IMP, 2}, {"BIT", &BIT_IMM, &IMM, 2},
+    {"TXA", &TXA, &IMP, 2}, {"NOP", &IGN, &IMP, 1}, {"STY", &STY, &ABS, 4},
+    {"STA", &STA, &ABS, 4}, {"STX", &STX, &ABS, 4}, {"NOP", &IGN, &IMP, 1},
+    {"BCC", &BCC, &REL, 2}, {"STA", &STA, &IZY, 6}, {"STA", &STA, &IZP, 5},
+    {"NOP", &IGN, &IMP, 1}, {"STY", &STY, &ZPX, 4}, {"STA", &STA, &ZPX, 4},
+    {"STX", &STX, &ZPY, 4}, {"NOP", &IGN, &IMP, 1}, {"TYA", &TYA, &IMP, 2},
+    {"STA", &STA, &ABY, 5}, {"TXS", &TXS, &IMP, 2}, {"NOP", &IGN, &IMP, 1},
+    {"STZ", &STZ, &ABS, 4}, {"STA", &STA, &ABX, 5}, {"STZ", &STZ, &ABX, 5},
+    {"NOP", &IGN, &IMP, 1}, {"LDY", &LDY, &IMM, 2}, {"LDA", &LDA, &IZX, 6},
+    {"LDX", &LDX, &IMM, 2}, {"NOP", &IGN, &IMP, 1}, {"LDY", &LDY, &ZP0, 3},
+    {"LDA", &LDA, &ZP0, 3}, {"LDX", &LDX, &ZP0, 3}, {"NOP", &IGN, &IMP, 1},
+    {"TAY", &TAY, &IMP, 2}, {"LDA", &LDA, &IMM, 2}, {"TAX", &TAX, &IMP, 2},
+    {"NOP", &IGN, &IMP, 1}, {"LDY", &LDY, &ABS, 4}, {"LDA", &LDA, &ABS, 4},
+    {"LDX", &LDX, &ABS, 4}, {"NOP", &IGN, &IMP, 1}, {"BCS", &BCS, &REL, 2},
+    {"LDA", &LDA, &IZY, 5}, {"LDA", &LDA, &IZP, 5}, {"NOP", &IGN, &IMP, 1},
+    {"LDY", &LDY, &ZPX, 4}, {"LDA", &LDA, &ZPX, 4}, {"LDX", &LDX, &ZPY, 4},
+    {"NOP", &IGN, &IMP, 1}, {"CLV", &CLV, &IMP, 2}, {"LDA", &LDA, &ABY, 4},
+    {"TSX", &TSX, &IMP, 2}, {"NOP", &IGN, &IMP, 1}, {"LDY", &LDY, &ABX, 4},
+    {"LDA", &LDA, &ABX, 4}, {"LDX", &LDX, &ABY, 4}, {"NOP", &IGN, &IMP, 1},
+    {"CPY", &CPY, &IMM, 2}, {"CMP", &CMP, &IZX, 6}, {"NOP", &IGN, &IMM, 2},
+    {"NOP", &IGN, &IMP, 1}, {"CPY", &CPY, &ZP0, 3}, {"CMP", &CMP, &ZP0, 3},
+    {"DEC", &DEC, &ZP0, 5}, {"NOP", &IGN, &IMP, 1}, {"INY", &INY, &IMP, 2},
+    {"CMP", &CMP, &IMM, 2}, {"DEX", &DEX, &IMP, 2}, {"NOP", &IGN, &IMP, 1},
+    {"CPY", &CPY, &ABS, 4}, {"CMP", &CMP, &ABS, 4}, {"DEC", &DEC, &ABS, 6},
+    {"NOP", &IGN, &IMP, 1}, {"BNE", &BNE, &REL, 2}, {"CMP", &CMP, &IZY, 5},
+    {"CMP", &CMP, &IZP, 5}, {"NOP", &IGN, &IMP, 1}, {"NOP", &IGN, &ZPX, 4},
+    {"CMP", &CMP, &ZPX, 4}, {"DEC", &DEC, &ZPX, 6}, {"NOP", &IGN, &IMP, 1},
+    {"CLD", &CLD, &IMP, 2}, {"CMP", &CMP, &ABY, 4}, {"PHX", &PHX, &IMP, 3},
+    {"NOP", &IGN, &IMP, 1}, {"NOP", &IGN, &ABS, 4}, {"CMP", &CMP, &ABX, 4},
+    {"DEC", &DEC, &ABX, 7}, {"NOP", &IGN, &IMP, 1}, {"CPX", &CPX, &IMM, 2},
+    {"SBC", &SBC_C, &IZX, 6}, {"NOP", &IGN, &IMM, 2}, {"NOP", &IGN, &IMP, 1},
+    {"CPX", &CPX, &ZP0, 3}, {"SBC", &SBC_C, &ZP0, 3}, {"INC", &INC, &ZP0, 5},
+    {"NOP", &IGN, &IMP, 1}, {"INX", &INX, &IMP, 2}, {"SBC", &SBC_C, &IMM, 2},
+    {"NOP", &IGN, &IMP, 2}, {"NOP", &IGN, &IMP, 1}, {"CPX", &CPX, &ABS, 4},
+    {"SBC", &SBC_C, &ABS, 4}, {"INC", &INC, &ABS, 6}, {"NOP", &IGN, &IMP, 1},
+    {"BEQ", &BEQ, &REL, 2}, {"SBC", &SBC_C, &IZY, 5}, {"SBC", &SBC_C, &IZP, 5},
+    {"NOP", &IGN, &IMP, 1}, {"NOP", &IGN, &ZPX, 4}, {"SBC", &SBC_C, &ZPX, 4},
+    {"INC", &INC, &ZPX, 6}, {"NOP", &IGN, &IMP, 1}, {"SED", &SED, &IMP, 2},
+    {"SBC", &SBC_C, &ABY, 4}, {"PLX", &PLX, &IMP, 4}, {"NOP", &IGN, &IMP, 1},
+    {"NOP", &IGN, &ABS, 4}, {"SBC", &SBC_C, &ABX, 4}, {"INC", &INC, &ABX, 7},
+    {"NOP", &IGN, &IMP, 1},
+};
+
+// the table of the selected variant, every instruction is dispatched from it
+struct instruction lookup[256];
+
+// selected variant, see inst_select()
+uint8_t inst_variant = CPU_NMOS;
+
 // absolute address in memory
 uint16_t addr_abs = 0x8000;
 
@@ -202,6 +437,34 @@ uint32_t* cys = 0x000000;
 // a pointer to the fetched opcode in the cpu module
 uint8_t fetched = 0x00;
 
+// edge coverage map, only updated when the fuzzer installs one
+uint8_t* inst_coverage = NULL;
+
+// last control flow target, shifted (see cover())
+static uint16_t cov_prev = 0;
+
+// status flags BRK and interrupts clear besides setting I, see inst_select()
+static uint8_t interrupt_clears = 0;
+
+// merges the N and Z flags of a value into the status register
+#define SET_NZ(val) (cpu.sr = (cpu.sr & ~ALU_NZ) | alu_nz[(uint8_t)(val)])
+
+/*
+ * Bus accesses the real chip does but whose result it throws away: reads of
+ * the next opcode by one byte instructions, of the unfixed address when
+ * indexing, of the stack before a pull, the write of the old value by
+ * read-modify-write instructions... They only exist in the cycle-stepped core
+ * (see cpu.c), where each one takes its own cycle and devices see them. The
+ * instruction-stepped core compiles them away.
+ */
+#ifdef CPU_CYCLE_STEPPED
+#define DUMMY_READ(addr) cpu_dummy_read(addr)
+#define DUMMY_WRITE(addr, data) cpu_write(addr, data)
+#else
+#define DUMMY_READ(addr) ((void)0)
+#define DUMMY_WRITE(addr, data) ((void)0)
+#endif
+
 /*
  * =============================================
  * HELPERS
@@ -227,15 +490,31 @@ static void fetch(void) {
 static void branch(void) {
     (*cys)++;
     addr_abs = cpu.pc + addr_rel;
+    DUMMY_READ(cpu.pc);
 
     if ((addr_abs & 0xFF00) != (cpu.pc & 0xFF00)) {
         (*cys)++;
+        DUMMY_READ((cpu.pc & 0xFF00) | (addr_abs & 0x00FF));
     }
 
     cpu.pc = addr_abs;
     debug_print("(branch) now we are at 0x%X\n", cpu.pc);
 }
 
+/**
+ * cover: records the edge between the previous control flow target and the
+ * current pc in the coverage map (AFL style, the previous location is
+ * shifted so that A->B and B->A are different edges)
+ * @param void
+ * @return void
+ * */
+static void cover(void) {
+    if (inst_coverage) {
+        inst_coverage[(cpu.pc ^ cov_prev) & (COV_MAP_SIZE - 1)]++;
+        cov_prev = cpu.pc >> 1;
+    }
+}
+
 /**
  * set_flag: sets or unsets corresponding bit in SR depending on the passed
  * expression
@@ -251,6 +530,24 @@ static void set_flag(uint8_t flag, bool exp) {
     }
 }
 
+#ifdef CPU_CYCLE_STEPPED
+/**
+ * writes: tells if the current instruction writes to its operand, indexed
+ * modes then always read the unfixed address before fixing it
+ * @param void
+ * @return true if it's a store or a read-modify-write
+ * */
+static bool writes(void) {
+    uint8_t (*f)(void) = lookup[op].op;
+
+    return lookup[op].mode != &IMP &&
+           (f == &STA || f == &STX || f == &STY || f == &ASL || f == &ROL ||
+            f == &LSR || f == &ROR || f == &INC || f == &DEC || f == &STZ ||
+            f == &TSB || f == &TRB || f == &SLO || f == &RLA || f == &SRE ||
+            f == &RRA || f == &SAX || f == &DCP || f == &ISC);
+}
+#endif
+
 /**
  * reset: actual reset process, must use the cpu_reset wrapper
  * @param void
@@ -273,6 +570,35 @@ void reset(void) {
     fetched = 0x00;
 }
 
+/**
+ * interrupt: hardware interrupt sequence (IRQ and NMI), same as BRK but the
+ *            pushed status has B cleared and the return address isn't
+ *            incremented. Must use the cpu_run() slow path.
+ * @param vector The address of the handler vector (0xFFFE or 0xFFFA)
+ * @param cycles The cycles of the current step, the sequence takes 7 more
+ * @return void
+ * */
+void interrupt(uint16_t vector, uint32_t* cycles) {
+    DUMMY_READ(cpu.pc);
+    DUMMY_READ(cpu.pc);
+
+    cpu_write(0x0100 + cpu.sp, (cpu.pc >> 8) & 0x00FF);
+    cpu.sp--;
+    cpu_write(0x0100 + cpu.sp, cpu.pc & 0x00FF);
+    cpu.sp--;
+
+    cpu_write(0x0100 + cpu.sp, (cpu.sr & ~(1 << B)) | (1 << 5));
+    cpu.sp--;
+    set_flag(I, true);
+    cpu.sr &= ~interrupt_clears;
+
+    cpu.pc = (uint16_t)cpu_fetch(vector) | ((uint16_t)cpu_fetch(vector + 1) << 8);
+    *cycles += 7;
+    cover();
+
+    debug_print("(interrupt) vector 0x%X, now we are at 0x%X\n", vector, cpu.pc);
+}
+
 /*
  * =============================================
  * MODES
@@ -288,6 +614,7 @@ void reset(void) {
  * @return 0
  */
 static uint8_t IMP(void) {
+    DUMMY_READ(cpu.pc);
     fetched = cpu.ac;
     return 0;
 }
@@ -323,7 +650,10 @@ static uint8_t ZP0(void) {
  * @return 0
  */
 static uint8_t ZPX(void) {
-    addr_abs = ((cpu_fetch(cpu.pc) + cpu.x) & 0x00FF);
+    uint8_t zp = cpu_fetch(cpu.pc);
+
+    DUMMY_READ(zp);
+    addr_abs = ((zp + cpu.x) & 0x00FF);
     return 0;
 }
 
@@ -333,7 +663,10 @@ static uint8_t ZPX(void) {
  * @return 0
  */
 static uint8_t ZPY(void) {
-    addr_abs = ((cpu_fetch(cpu.pc) + cpu.y) & 0x00FF);
+    uint8_t zp = cpu_fetch(cpu.pc);
+
+    DUMMY_READ(zp);
+    addr_abs = ((zp + cpu.y) & 0x00FF);
     return 0;
 }
 
@@ -345,6 +678,14 @@ static uint8_t ZPY(void) {
  */
 static uint8_t ABS(void) {
     uint16_t low = cpu_fetch(cpu.pc);
+
+#ifdef CPU_CYCLE_STEPPED
+    // JSR pushes the return address before fetching the high byte
+    if (lookup[op].op == &JSR) {
+        addr_abs = low;
+        return 0;
+    }
+#endif
     uint16_t high = cpu_fetch(cpu.pc);
 
     // combine them to form a 16 bit address word
@@ -365,6 +706,10 @@ static uint8_t ABX(void) {
     addr_abs = (high << 8) | low;
     addr_abs += cpu.x;
 
+#ifdef CPU_CYCLE_STEPPED
+    if ((addr_abs & 0xFF00) != (high << 8) || writes()) DUMMY_READ((high << 8) | (addr_abs & 0x00FF));
+#endif
+
     // if the high bytes are different, we have changed page (due to overflow
     // from low to high)
     return ((addr_abs & 0xFF00) != (high << 8)) ? 1 : 0;
@@ -383,6 +728,10 @@ static uint8_t ABY(void) {
     addr_abs = (high << 8) | low;
     addr_abs += cpu.y;
 
+#ifdef CPU_CYCLE_STEPPED
+    if ((addr_abs & 0xFF00) != (high << 8) || writes()) DUMMY_READ((high << 8) | (addr_abs & 0x00FF));
+#endif
+
     // if the high bytes are different, we have changed page (due to overflow
     // from low to high)
     return ((addr_abs & 0xFF00) != (high << 8)) ? 1 : 0;
@@ -409,12 +758,14 @@ static uint8_t IND(void) {
      *
      * see: https://www.nesdev.com/6502bugs.txt
      * */
+    addr_abs = cpu_fetch(ptr + 0);
+
     if (low == 0x00FF) {
         // simulate actual hardware bug!
-        addr_abs = (cpu_fetch(ptr & 0xFF00) << 8) | cpu_fetch(ptr + 0);
+        addr_abs |= cpu_fetch(ptr & 0xFF00) << 8;
 
     } else {
-        addr_abs = (cpu_fetch(ptr + 1) << 8) | cpu_fetch(ptr + 0);
+        addr_abs |= cpu_fetch(ptr + 1) << 8;
     }
 
     return 0;
@@ -431,6 +782,7 @@ static uint8_t IND(void) {
 static uint8_t IZX(void) {
     // reading an address in the zero page
     uint16_t addr_0p = cpu_fetch(cpu.pc);
+    DUMMY_READ(addr_0p);
 
     uint16_t low = cpu_fetch((uint16_t)(addr_0p + (uint16_t)cpu.x) & 0x00FF);
     uint16_t high =
@@ -456,6 +808,10 @@ static uint8_t IZY(void) {
     addr_abs = (high << 8) | low;
     addr_abs += cpu.y;
 
+#ifdef CPU_CYCLE_STEPPED
+    if ((addr_abs & 0xFF00) != (high << 8) || writes()) DUMMY_READ((high << 8) | (addr_abs & 0x00FF));
+#endif
+
     return ((addr_abs & 0xFF00) != (high << 8)) ? 1 : 0;
 }
 
@@ -477,6 +833,54 @@ static uint8_t REL(void) {
     return 0;
 }
 
+/**
+ * IZP: Indirect addressing of the zero page (65C02), same as IZY without the
+ *      offset
+ * @param void
+ * @return 0
+ */
+static uint8_t IZP(void) {
+    uint16_t addr_0p = cpu_fetch(cpu.pc);
+
+    uint16_t low = cpu_fetch(addr_0p & 0x00FF);
+    uint16_t high = cpu_fetch((addr_0p + 1) & 0x00FF);
+
+    addr_abs = (high << 8) | low;
+    return 0;
+}
+
+/**
+ * IAX: Indexed indirect absolute (65C02), the pointer is at the absolute
+ *      address plus X. Only used by JMP
+ * @param void
+ * @return 0
+ */
+static uint8_t IAX(void) {
+    uint16_t low = cpu_fetch(cpu.pc);
+    uint16_t high = cpu_fetch(cpu.pc);
+
+    uint16_t ptr = ((high << 8) | low) + cpu.x;
+
+    addr_abs = cpu_fetch(ptr) | (cpu_fetch(ptr + 1) << 8);
+    return 0;
+}
+
+/**
+ * INDF: Same as IND without the page wrap bug, the 65C02 fixed it (and takes
+ *       a cycle more)
+ * @param void
+ * @return 0
+ */
+static uint8_t INDF(void) {
+    uint16_t low = cpu_fetch(cpu.pc);
+    uint16_t high = cpu_fetch(cpu.pc);
+
+    uint16_t ptr = (high << 8) | low;
+
+    addr_abs = cpu_fetch(ptr) | (cpu_fetch(ptr + 1) << 8);
+    return 0;
+}
+
 /*
  * =============================================
  * OPERATIONS
@@ -499,8 +903,7 @@ static uint8_t LDA(void) {
     fetch();
     cpu.ac = fetched;
 
-    set_flag(Z, cpu.ac == 0);
-    set_flag(N, cpu.ac & (1 << 7));
+    SET_NZ(cpu.ac);
 
     return 1;
 }
@@ -514,8 +917,7 @@ static uint8_t LDX(void) {
     fetch();
     cpu.x = fetched;
 
-    set_flag(Z, cpu.x == 0);
-    set_flag(N, cpu.x & (1 << 7));
+    SET_NZ(cpu.x);
 
     return 1;
 }
@@ -529,63 +931,84 @@ static uint8_t LDY(void) {
     fetch();
     cpu.y = fetched;
 
-    set_flag(Z, cpu.y == 0);
-    set_flag(N, cpu.y & (1 << 7));
+    SET_NZ(cpu.y);
 
     return 1;
 }
 
 static uint8_t BRK(void) {
+    DUMMY_READ(addr_abs);
     cpu.pc++;
-    set_flag(I, true);
 
     cpu_write(0x0100 + cpu.sp, (cpu.pc >> 8) & 0x00FF);
     cpu.sp--;
     cpu_write(0x0100 + cpu.sp, cpu.pc & 0x00FF);
     cpu.sp--;
 
+    // the pushed copy carries B, I is only set once the state is saved
     set_flag(B, true);
     cpu_write(0x0100 + cpu.sp, cpu.sr);
     cpu.sp--;
     set_flag(B, false);
+    set_flag(I, true);
+    cpu.sr &= ~interrupt_clears;
 
     cpu.pc = (uint16_t)cpu_fetch(0xFFFE) | ((uint16_t)cpu_fetch(0xFFFF) << 8);
+    cover();
     return 0;
 }
 
 static uint8_t JSR(void) {
+#ifdef CPU_CYCLE_STEPPED
+    // ABS() only fetched the low byte, pc points to the high one
+    DUMMY_READ(0x0100 + cpu.sp);
+
+    cpu_write(0x0100 + cpu.sp, (cpu.pc >> 8) & 0x00FF);
+    cpu.sp--;
+    cpu_write(0x0100 + cpu.sp, cpu.pc & 0x00FF);
+    cpu.sp--;
+
+    addr_abs |= cpu_fetch(cpu.pc) << 8;
+#else
     cpu.pc--;
 
     cpu_write(0x0100 + cpu.sp, (cpu.pc >> 8) & 0x00FF);
     cpu.sp--;
     cpu_write(0x0100 + cpu.sp, cpu.pc & 0x00FF);
     cpu.sp--;
+#endif
 
     cpu.pc = addr_abs;
+    cover();
 
     return 0;
 }
 
 static uint8_t RTI(void) {
+    DUMMY_READ(0x0100 + cpu.sp);
     cpu.sp++;
 
     cpu.sr = cpu_fetch(0x0100 + cpu.sp);
-    cpu.sr &= ~B;
+    cpu.sr &= ~(1 << B);
 
     cpu.sp++;
     cpu.pc = (uint16_t)cpu_fetch(0x0100 + cpu.sp);
     cpu.sp++;
     cpu.pc |= (uint16_t)cpu_fetch(0x0100 + cpu.sp) << 8;
+    cover();
 
     return 0;
 }
 
 static uint8_t RTS(void) {
+    DUMMY_READ(0x0100 + cpu.sp);
     cpu.sp++;
     cpu.pc = (uint16_t)cpu_fetch(0x0100 + cpu.sp);
     cpu.sp++;
     cpu.pc |= (uint16_t)cpu_fetch(0x0100 + cpu.sp) << 8;
+    DUMMY_READ(cpu.pc);
     cpu.pc++;
+    cover();
 
     return 0;
 }
@@ -599,6 +1022,7 @@ static uint8_t BCC(void) {
     if (cpu_extract_sr(C) == 0) {
         branch();
     }
+    cover();
     return 0;
 }
 
@@ -606,6 +1030,7 @@ static uint8_t BCS(void) {
     if (cpu_extract_sr(C) == 1) {
         branch();
     }
+    cover();
     return 0;
 }
 
@@ -613,6 +1038,7 @@ static uint8_t BEQ(void) {
     if (cpu_extract_sr(Z) == 1) {
         branch();
     }
+    cover();
     return 0;
 }
 
@@ -620,6 +1046,7 @@ static uint8_t BMI(void) {
     if (cpu_extract_sr(N) == 1) {
         branch();
     }
+    cover();
     return 0;
 }
 
@@ -627,6 +1054,7 @@ static uint8_t BNE(void) {
     if (cpu_extract_sr(Z) == 0) {
         branch();
     }
+    cover();
     return 0;
 }
 
@@ -634,6 +1062,7 @@ static uint8_t BPL(void) {
     if (cpu_extract_sr(N) == 0) {
         branch();
     }
+    cover();
     return 0;
 }
 
@@ -641,13 +1070,15 @@ static uint8_t BVC(void) {
     if (cpu_extract_sr(V) == 0) {
         branch();
     }
+    cover();
     return 0;
 }
 
 static uint8_t BVS(void) {
-    if (cpu_extract_sr(V) == 0) {
+    if (cpu_extract_sr(V) == 1) {
         branch();
     }
+    cover();
     return 0;
 }
 
@@ -659,12 +1090,7 @@ static uint8_t BVS(void) {
 static uint8_t CPX(void) {
     fetch();
 
-    // comparing (I think this is just beautiful)
-    uint16_t tmp = (uint16_t)cpu.x - (uint16_t)fetched;
-
-    set_flag(C, cpu.x >= fetched);
-    set_flag(Z, (tmp & 0x00FF) == 0x0000);
-    set_flag(N, tmp & (1 << 7));
+    cpu.sr = (cpu.sr & ~ALU_NZC) | alu_cmp[(cpu.x << 8) | fetched];
 
     return 0;
 }
@@ -677,11 +1103,7 @@ static uint8_t CPX(void) {
 static uint8_t CPY(void) {
     fetch();
 
-    uint16_t tmp = (uint16_t)cpu.y - (uint16_t)fetched;
-
-    set_flag(C, cpu.y >= fetched);
-    set_flag(Z, (tmp & 0x00FF) == 0x0000);
-    set_flag(N, tmp & (1 << 7));
+    cpu.sr = (cpu.sr & ~ALU_NZC) | alu_cmp[(cpu.y << 8) | fetched];
 
     return 0;
 }
@@ -695,8 +1117,7 @@ static uint8_t ORA(void) {
     fetch();
     cpu.ac = cpu.ac | fetched;
 
-    set_flag(C, cpu.ac == 0);
-    set_flag(N, cpu.ac & (1 << 7));
+    SET_NZ(cpu.ac);
 
     return 1;
 }
@@ -710,8 +1131,7 @@ static uint8_t AND(void) {
     fetch();
     cpu.ac = cpu.ac & fetched;
 
-    set_flag(C, cpu.ac == 0);
-    set_flag(N, cpu.ac & (1 << 7));
+    SET_NZ(cpu.ac);
 
     return 1;
 }
@@ -725,38 +1145,34 @@ static uint8_t EOR(void) {
     fetch();
     cpu.ac = cpu.ac ^ fetched;
 
-    set_flag(C, cpu.ac == 0);
-    set_flag(N, cpu.ac & (1 << 7));
+    SET_NZ(cpu.ac);
 
     return 1;
 }
 
 static uint8_t BIT(void) {
     fetch();
-    uint16_t tmp = cpu.ac & fetched;
 
-    set_flag(Z, (tmp & 0x00F) == 0x00);
-    set_flag(N, (fetched & (1 << 7)));
-    set_flag(V, (fetched & (1 << 6)));
+    // N and V are copied from the operand, Z comes from the AND
+    cpu.sr = (cpu.sr & ~(ALU_NZ | (1 << V))) | (fetched & 0xC0) |
+             (alu_nz[cpu.ac & fetched] & (1 << Z));
 
     return 0;
 }
 
+/**
+ * ADC: Add with carry, looked up in the binary or decimal table depending on
+ *      the D flag
+ * @param void
+ * @return 1
+ */
 static uint8_t ADC(void) {
     fetch();
 
-    uint16_t tmp =
-        (uint16_t)cpu.ac + (uint16_t)fetched + (uint16_t)cpu_extract_sr(C);
-
-    set_flag(C, tmp > 255);
-    set_flag(Z, (tmp & 0x00FF) == 0);
-    set_flag(V, ((~((uint16_t)cpu.ac ^ (uint16_t)fetched) &
-                  ((uint16_t)cpu.ac ^ (uint16_t)tmp)) &
-                 0x0080));
-
-    set_flag(N, tmp & 0x0080);
+    uint16_t res = alu_adc[(cpu.sr >> D) & 1][ALU_INDEX(cpu.sr & 1, cpu.ac, fetched)];
 
-    cpu.ac = tmp & 0x00FF;
+    cpu.sr = (cpu.sr & ~ALU_NVZC) | (res >> 8);
+    cpu.ac = res & 0x00FF;
     return 1;
 }
 
@@ -778,45 +1194,37 @@ static uint8_t STY(void) {
 static uint8_t CMP(void) {
     fetch();
 
-    // comparing (I think this is just beautiful)
-    uint16_t tmp = (uint16_t)cpu.ac - (uint16_t)fetched;
-
-    set_flag(C, cpu.ac >= fetched);
-    set_flag(Z, (tmp & 0x00FF) == 0x0000);
-    set_flag(N, tmp & (1 << 7));
+    cpu.sr = (cpu.sr & ~ALU_NZC) | alu_cmp[(cpu.ac << 8) | fetched];
 
     return 1;
 }
 
+/**
+ * SBC: Subtract with borrow (inverted carry), same as ADC
+ * @param void
+ * @return 1
+ */
 static uint8_t SBC(void) {
     fetch();
 
-    // inverting the bottom 8 bits
-    uint16_t val = ((uint16_t)fetched) ^ 0x00FF;
-
-    uint16_t tmp = (uint16_t)cpu.ac + val + (uint16_t)cpu_extract_sr(C);
+    uint16_t res = alu_sbc[(cpu.sr >> D) & 1][ALU_INDEX(cpu.sr & 1, cpu.ac, fetched)];
 
-    set_flag(C, tmp & 0xFF00);
-    set_flag(Z, (tmp & 0x00FF) == 0);
-    set_flag(V, ((tmp ^ (uint16_t)cpu.ac) & (tmp ^ val) & 0x0080));
-    set_flag(N, tmp & 0x0080);
-
-    cpu.ac = tmp & 0x00FF;
+    cpu.sr = (cpu.sr & ~ALU_NVZC) | (res >> 8);
+    cpu.ac = res & 0x00FF;
     return 1;
 }
 
 static uint8_t ASL(void) {
     fetch();
-    uint16_t tmp = (uint16_t)fetched << 1;
+    uint16_t res = alu_asl[fetched];
 
-    set_flag(C, (tmp & 0xFF00) > 0);
-    set_flag(Z, (tmp & 0x00FF) == 0x00);
-    set_flag(N, tmp & (1 << 7));
+    cpu.sr = (cpu.sr & ~ALU_NZC) | (res >> 8);
 
     if (lookup[op].mode == &IMP) {
-        cpu.ac = tmp & 0x00FF;
+        cpu.ac = res & 0x00FF;
     } else {
-        cpu_write(addr_abs, tmp & 0x00FF);
+        DUMMY_WRITE(addr_abs, fetched);
+        cpu_write(addr_abs, res & 0x00FF);
     }
 
     return 0;
@@ -824,16 +1232,15 @@ static uint8_t ASL(void) {
 
 static uint8_t ROL(void) {
     fetch();
-    uint16_t tmp = (uint16_t)(fetched << 1) | cpu_extract_sr(C);
+    uint16_t res = alu_rol[((cpu.sr & 1) << 8) | fetched];
 
-    set_flag(C, tmp & 0xFF00);
-    set_flag(Z, (tmp & 0x00FF) == 0x00);
-    set_flag(N, tmp & (1 << 7));
+    cpu.sr = (cpu.sr & ~ALU_NZC) | (res >> 8);
 
     if (lookup[op].mode == &IMP) {
-        cpu.ac = tmp & 0x00FF;
+        cpu.ac = res & 0x00FF;
     } else {
-        cpu_write(addr_abs, tmp & 0x00FF);
+        DUMMY_WRITE(addr_abs, fetched);
+        cpu_write(addr_abs, res & 0x00FF);
     }
 
     return 0;
@@ -841,16 +1248,15 @@ static uint8_t ROL(void) {
 
 static uint8_t ROR(void) {
     fetch();
-    uint16_t tmp = (uint16_t)(cpu_extract_sr(C) << 7) | (fetched >> 1);
+    uint16_t res = alu_ror[((cpu.sr & 1) << 8) | fetched];
 
-    set_flag(C, fetched & 0x0001);
-    set_flag(Z, (tmp & 0x00FF) == 0x00);
-    set_flag(N, tmp & (1 << 7));
+    cpu.sr = (cpu.sr & ~ALU_NZC) | (res >> 8);
 
     if (lookup[op].mode == &IMP) {
-        cpu.ac = tmp & 0x00FF;
+        cpu.ac = res & 0x00FF;
     } else {
-        cpu_write(addr_abs, tmp & 0x00FF);
+        DUMMY_WRITE(addr_abs, fetched);
+        cpu_write(addr_abs, res & 0x00FF);
     }
 
     return 0;
@@ -858,16 +1264,15 @@ static uint8_t ROR(void) {
 
 static uint8_t LSR(void) {
     fetch();
-    uint16_t tmp = (uint16_t)fetched >> 1;
+    uint16_t res = alu_lsr[fetched];
 
-    set_flag(C, fetched & 0x0001);
-    set_flag(Z, (tmp & 0x00FF) == 0x00);
-    set_flag(N, tmp & (1 << 7));
+    cpu.sr = (cpu.sr & ~ALU_NZC) | (res >> 8);
 
     if (lookup[op].mode == &IMP) {
-        cpu.ac = tmp & 0x00FF;
+        cpu.ac = res & 0x00FF;
     } else {
-        cpu_write(addr_abs, tmp & 0x00FF);
+        DUMMY_WRITE(addr_abs, fetched);
+        cpu_write(addr_abs, res & 0x00FF);
     }
 
     return 0;
@@ -875,21 +1280,19 @@ static uint8_t LSR(void) {
 
 static uint8_t DEC(void) {
     fetch();
-    uint16_t tmp = fetched - 1;
-
-    cpu_write(addr_abs, tmp & 0x00FF);
+    uint8_t tmp = fetched - 1;
 
-    set_flag(Z, ((tmp & 0x00FF) == 0x0000));
-    set_flag(N, (tmp & (1 << 7)));
+    DUMMY_WRITE(addr_abs, fetched);
+    cpu_write(addr_abs, tmp);
+    SET_NZ(tmp);
 
     return 0;
 }
 
 static uint8_t DEX(void) {
-    cpu.x++;
+    cpu.x--;
 
-    set_flag(Z, cpu.x == 0x00);
-    set_flag(N, cpu.x & (1 << 7));
+    SET_NZ(cpu.x);
 
     return 0;
 }
@@ -897,20 +1300,18 @@ static uint8_t DEX(void) {
 static uint8_t DEY(void) {
     cpu.y--;
 
-    set_flag(Z, cpu.y == 0x00);
-    set_flag(N, cpu.y & (1 << 7));
+    SET_NZ(cpu.y);
 
     return 0;
 }
 
 static uint8_t INC(void) {
     fetch();
-    uint16_t tmp = (uint16_t)fetched + 1;
-
-    cpu_write(addr_abs, tmp & 0x00FF);
+    uint8_t tmp = fetched + 1;
 
-    set_flag(Z, ((tmp & 0x00FF) == 0x0000));
-    set_flag(N, tmp & (1 << 7));
+    DUMMY_WRITE(addr_abs, fetched);
+    cpu_write(addr_abs, tmp);
+    SET_NZ(tmp);
 
     return 0;
 }
@@ -918,8 +1319,7 @@ static uint8_t INC(void) {
 static uint8_t INX(void) {
     cpu.x++;
 
-    set_flag(Z, cpu.x == 0x00);
-    set_flag(N, cpu.x & (1 << 7));
+    SET_NZ(cpu.x);
 
     return 0;
 }
@@ -927,8 +1327,7 @@ static uint8_t INX(void) {
 static uint8_t INY(void) {
     cpu.y++;
 
-    set_flag(Z, cpu.y == 0x00);
-    set_flag(N, cpu.y & (1 << 7));
+    SET_NZ(cpu.y);
 
     return 0;
 }
@@ -941,16 +1340,17 @@ static uint8_t PHP(void) {
 }
 
 static uint8_t SEC(void) {
-    set_flag(C, true);
+    cpu.sr |= (1 << C);
     return 0;
 }
 
 static uint8_t CLC(void) {
-    set_flag(C, false);
+    cpu.sr &= ~(1 << C);
     return 0;
 }
 
 static uint8_t PLP(void) {
+    DUMMY_READ(0x0100 + cpu.sp);
     cpu.sp++;
     cpu.sr = cpu_fetch(0x0100 + cpu.sp);
 
@@ -958,11 +1358,11 @@ static uint8_t PLP(void) {
 }
 
 static uint8_t PLA(void) {
+    DUMMY_READ(0x0100 + cpu.sp);
     cpu.sp++;
     cpu.ac = cpu_fetch(0x0100 + cpu.sp);
 
-    set_flag(Z, cpu.ac == 0);
-    set_flag(N, cpu.ac & (1 << 7));
+    SET_NZ(cpu.ac);
 
     return 0;
 }
@@ -976,44 +1376,42 @@ static uint8_t PHA(void) {
 }
 
 static uint8_t CLI(void) {
-    set_flag(I, 0);
+    cpu.sr &= ~(1 << I);
     return 0;
 }
 
 static uint8_t SEI(void) {
-    set_flag(I, true);
+    cpu.sr |= (1 << I);
     return 0;
 }
 
 static uint8_t TYA(void) {
     cpu.ac = cpu.y;
 
-    set_flag(Z, cpu.ac == 0);
-    set_flag(N, cpu.ac & (1 << 7));
+    SET_NZ(cpu.ac);
 
     return 0;
 }
 
 static uint8_t CLV(void) {
-    set_flag(V, false);
+    cpu.sr &= ~(1 << V);
     return 0;
 }
 
 static uint8_t CLD(void) {
-    set_flag(D, false);
+    cpu.sr &= ~(1 << D);
     return 0;
 }
 
 static uint8_t SED(void) {
-    set_flag(D, true);
+    cpu.sr |= (1 << D);
     return 0;
 }
 
 static uint8_t TXA(void) {
     cpu.ac = cpu.x;
 
-    set_flag(Z, cpu.ac == 0);
-    set_flag(N, (cpu.ac & (1 << 7)));
+    SET_NZ(cpu.ac);
 
     return 0;
 }
@@ -1026,8 +1424,7 @@ static uint8_t TXS(void) {
 static uint8_t TAX(void) {
     cpu.x = cpu.ac;
 
-    set_flag(Z, cpu.x == 0);
-    set_flag(N, (cpu.x & (1 << 7)));
+    SET_NZ(cpu.x);
 
     return 0;
 }
@@ -1035,8 +1432,7 @@ static uint8_t TAX(void) {
 static uint8_t TAY(void) {
     cpu.y = cpu.ac;
 
-    set_flag(Z, cpu.y == 0);
-    set_flag(N, (cpu.y & (1 << 7)));
+    SET_NZ(cpu.y);
 
     return 0;
 }
@@ -1044,34 +1440,858 @@ static uint8_t TAY(void) {
 static uint8_t TSX(void) {
     cpu.x = cpu.sp;
 
-    set_flag(Z, cpu.x == 0);
-    set_flag(N, (cpu.x & (1 << 7)));
+    SET_NZ(cpu.x);
 
     return 0;
 }
 
 static uint8_t JMP(void) {
-	cpu.pc = addr_abs;
+    cpu.pc = addr_abs;
+    cover();
     return 0;
 }
 
 /**
- * inst_exec: Parse and execute a fetched instruction
- * @param opcode The retrieved opcode from cpu_exec()
- * @param cycles The amount of clock cycles happening
- * @return void
+ * IGN: The real NOPs, of any length: the operand is read (devices see it)
+ *      and ignored, indexing across a page takes its extra cycle
+ * @param void
+ * @return 1
  */
-void inst_exec(uint8_t opcode, uint32_t* cycles) {
-    // saving variables to the corresponding global ones
-    op = opcode;
-    cys = cycles;
+static uint8_t IGN(void) {
+    fetch();
+    return 1;
+}
 
-    *cycles = lookup[opcode].cycles;
+/*
+ * =============================================
+ * 65C02 OPERATIONS
+ * =============================================
+ */
 
-    uint8_t additional_cycle_0 = (*(lookup[opcode].mode))();
-    uint8_t additional_cycle_1 = (*(lookup[opcode].op))();
+static uint8_t BRA(void) {
+    branch();
+    cover();
+    return 0;
+}
 
-    *cycles += (additional_cycle_0 & additional_cycle_1);
+static uint8_t STZ(void) {
+    cpu_write(addr_abs, 0);
+    return 0;
+}
+
+static uint8_t PHX(void) {
+    cpu_write(0x0100 + cpu.sp, cpu.x);
+    cpu.sp--;
+
+    return 0;
+}
+
+static uint8_t PHY(void) {
+    cpu_write(0x0100 + cpu.sp, cpu.y);
+    cpu.sp--;
+
+    return 0;
+}
+
+static uint8_t PLX(void) {
+    DUMMY_READ(0x0100 + cpu.sp);
+    cpu.sp++;
+    cpu.x = cpu_fetch(0x0100 + cpu.sp);
+
+    SET_NZ(cpu.x);
+
+    return 0;
+}
+
+static uint8_t PLY(void) {
+    DUMMY_READ(0x0100 + cpu.sp);
+    cpu.sp++;
+    cpu.y = cpu_fetch(0x0100 + cpu.sp);
+
+    SET_NZ(cpu.y);
+
+    return 0;
+}
+
+/**
+ * TSB: Test and set bits, Z as BIT would set it then the bits of AC are set
+ *      in memory
+ * @param void
+ * @return 0
+ */
+static uint8_t TSB(void) {
+    fetch();
+
+    cpu.sr = (cpu.sr & ~(1 << Z)) | (alu_nz[cpu.ac & fetched] & (1 << Z));
+    DUMMY_READ(addr_abs);
+    cpu_write(addr_abs, fetched | cpu.ac);
+
+    return 0;
+}
+
+/**
+ * TRB: Test and reset bits, same as TSB but the bits of AC are cleared
+ * @param void
+ * @return 0
+ */
+static uint8_t TRB(void) {
+    fetch();
+
+    cpu.sr = (cpu.sr & ~(1 << Z)) | (alu_nz[cpu.ac & fetched] & (1 << Z));
+    DUMMY_READ(addr_abs);
+    cpu_write(addr_abs, fetched & ~cpu.ac);
+
+    return 0;
+}
+
+// INC A
+static uint8_t INA(void) {
+    cpu.ac++;
+
+    SET_NZ(cpu.ac);
+
+    return 0;
+}
+
+// DEC A
+static uint8_t DEA(void) {
+    cpu.ac--;
+
+    SET_NZ(cpu.ac);
+
+    return 0;
+}
+
+/**
+ * BIT_IMM: BIT #imm, there's no memory to copy N and V from so only Z is set
+ * @param void
+ * @return 0
+ */
+static uint8_t BIT_IMM(void) {
+    fetch();
+
+    cpu.sr = (cpu.sr & ~(1 << Z)) | (alu_nz[cpu.ac & fetched] & (1 << Z));
+
+    return 0;
+}
+
+/**
+ * ADC_C: ADC, in decimal mode the 65C02 sets N and Z from the result and
+ *        takes a cycle more to do so
+ * @param void
+ * @return 1
+ */
+static uint8_t ADC_C(void) {
+    ADC();
+
+    if (cpu.sr & (1 << D)) {
+        SET_NZ(cpu.ac);
+        (*cys)++;
+    }
+
+    return 1;
+}
+
+// SBC_C: SBC, same as ADC_C
+static uint8_t SBC_C(void) {
+    SBC();
+
+    if (cpu.sr & (1 << D)) {
+        SET_NZ(cpu.ac);
+        (*cys)++;
+    }
+
+    return 1;
+}
+
+/*
+ * =============================================
+ * NMOS UNOFFICIAL OPERATIONS
+ * =============================================
+ *
+ * Most of them are two official instructions sharing one opcode (a
+ * read-modify-write then an ALU operation on its result), see:
+ * https://www.masswerk.at/6502/6502_instruction_set.html#illegals
+ */
+
+// SLO: ASL then ORA with the result
+static uint8_t SLO(void) {
+    fetch();
+    uint16_t res = alu_asl[fetched];
+
+    DUMMY_WRITE(addr_abs, fetched);
+    cpu_write(addr_abs, res & 0x00FF);
+
+    cpu.ac |= res & 0x00FF;
+    cpu.sr = (cpu.sr & ~ALU_NZC) | ((res >> 8) & (1 << C)) | alu_nz[cpu.ac];
+
+    return 0;
+}
+
+// RLA: ROL then AND with the result
+static uint8_t RLA(void) {
+    fetch();
+    uint16_t res = alu_rol[((cpu.sr & 1) << 8) | fetched];
+
+    DUMMY_WRITE(addr_abs, fetched);
+    cpu_write(addr_abs, res & 0x00FF);
+
+    cpu.ac &= res & 0x00FF;
+    cpu.sr = (cpu.sr & ~ALU_NZC) | ((res >> 8) & (1 << C)) | alu_nz[cpu.ac];
+
+    return 0;
+}
+
+// SRE: LSR then EOR with the result
+static uint8_t SRE(void) {
+    fetch();
+    uint16_t res = alu_lsr[fetched];
+
+    DUMMY_WRITE(addr_abs, fetched);
+    cpu_write(addr_abs, res & 0x00FF);
+
+    cpu.ac ^= res & 0x00FF;
+    cpu.sr = (cpu.sr & ~ALU_NZC) | ((res >> 8) & (1 << C)) | alu_nz[cpu.ac];
+
+    return 0;
+}
+
+// RRA: ROR then ADC of the result, with the carry the rotation left
+static uint8_t RRA(void) {
+    fetch();
+    uint16_t res = alu_ror[((cpu.sr & 1) << 8) | fetched];
+
+    DUMMY_WRITE(addr_abs, fetched);
+    cpu_write(addr_abs, res & 0x00FF);
+
+    uint16_t sum = alu_adc[(cpu.sr >> D) & 1][ALU_INDEX((res >> 8) & 1, cpu.ac, res & 0x00FF)];
+
+    cpu.sr = (cpu.sr & ~ALU_NVZC) | (sum >> 8);
+    cpu.ac = sum & 0x00FF;
+
+    return 0;
+}
+
+// SAX: stores AC & X, no flags
+static uint8_t SAX(void) {
+    cpu_write(addr_abs, cpu.ac & cpu.x);
+    return 0;
+}
+
+// LAX: LDA and LDX at once
+static uint8_t LAX(void) {
+    fetch();
+    cpu.ac = cpu.x = fetched;
+
+    SET_NZ(cpu.ac);
+
+    return 1;
+}
+
+// LAS: AC, X and SP all get the operand ANDed with SP
+static uint8_t LAS(void) {
+    fetch();
+    cpu.ac = cpu.x = cpu.sp = fetched & cpu.sp;
+
+    SET_NZ(cpu.ac);
+
+    return 1;
+}
+
+// DCP: DEC then CMP with the result
+static uint8_t DCP(void) {
+    fetch();
+    uint8_t tmp = fetched - 1;
+
+    DUMMY_WRITE(addr_abs, fetched);
+    cpu_write(addr_abs, tmp);
+
+    cpu.sr = (cpu.sr & ~ALU_NZC) | alu_cmp[(cpu.ac << 8) | tmp];
+
+    return 0;
+}
+
+// ISC: INC then SBC of the result
+static uint8_t ISC(void) {
+    fetch();
+    uint8_t tmp = fetched + 1;
+
+    DUMMY_WRITE(addr_abs, fetched);
+    cpu_write(addr_abs, tmp);
+
+    uint16_t res = alu_sbc[(cpu.sr >> D) & 1][ALU_INDEX(cpu.sr & 1, cpu.ac, tmp)];
+
+    cpu.sr = (cpu.sr & ~ALU_NVZC) | (res >> 8);
+    cpu.ac = res & 0x00FF;
+
+    return 0;
+}
+
+// ANC: AND #imm, C gets a copy of N
+static uint8_t ANC(void) {
+    fetch();
+    cpu.ac &= fetched;
+
+    cpu.sr = (cpu.sr & ~ALU_NZC) | alu_nz[cpu.ac] | (cpu.ac >> 7);
+
+    return 0;
+}
+
+// ALR: AND #imm then LSR A
+static uint8_t ALR(void) {
+    fetch();
+    uint16_t res = alu_lsr[cpu.ac & fetched];
+
+    cpu.sr = (cpu.sr & ~ALU_NZC) | (res >> 8);
+    cpu.ac = res & 0x00FF;
+
+    return 0;
+}
+
+/**
+ * ARR: AND #imm then ROR A, C and V come from bits 6 and 5 of the result.
+ *      The decimal mode quirks of the chip aren't reproduced
+ * @param void
+ * @return 0
+ */
+static uint8_t ARR(void) {
+    fetch();
+    cpu.ac = ((cpu.ac & fetched) >> 1) | ((cpu.sr & 1) << 7);
+
+    cpu.sr = (cpu.sr & ~ALU_NVZC) | alu_nz[cpu.ac] | ((cpu.ac >> 6) & 1) |
+             ((((cpu.ac >> 6) ^ (cpu.ac >> 5)) & 1) << V);
+
+    return 0;
+}
+
+// SBX: X = (AC & X) - #imm, flags as CMP (the carry isn't used)
+static uint8_t SBX(void) {
+    fetch();
+    uint8_t tmp = cpu.ac & cpu.x;
+
+    cpu.sr = (cpu.sr & ~ALU_NZC) | alu_cmp[(tmp << 8) | fetched];
+    cpu.x = tmp - fetched;
+
+    return 0;
+}
+
+/*
+ * =============================================
+ * SUPERINSTRUCTIONS
+ * =============================================
+ *
+ * Pairs of instructions found all over 6502 loops are executed by a single
+ * handler, saving a dispatch and the decoding of the second one. Each handler
+ * leaves the cpu, memory and cycle count exactly as the two instructions
+ * would, and returns 0 without touching anything if an operand turns out to
+ * be a device (the pair then runs the normal way). Same when an operand is
+ * the byte right after the instruction: cpu_fetch() then also moves the pc
+ * past it, and the handlers don't reproduce that.
+ *
+ * Pairs are recognised lazily, per address, and kept in inst_fused[]. A write
+ * drops the decoding of its page and of the page 6 bytes before (the longest
+ * sequence, the copy loop, is 7 bytes), see cpu_write().
+ *
+ * Two whole loops are recognised the same way and run natively when the
+ * memory they touch is plain RAM:
+ *
+ *      copy:   LDA (src),Y / STA (dst),Y / INY / BNE copy
+ *      fill:   STA abs,X / DEX / BNE fill
+ *
+ * As many iterations as fit before the next event or budget check are done
+ * at once with memmove()/memset(), the registers, flags and cycles are then
+ * set to what the last of them would have left.
+ */
+
+#define FUSE_NONE 0
+#define FUSE_DEX_BNE 1
+#define FUSE_DEY_BNE 2
+#define FUSE_CMP_BEQ 3
+#define FUSE_CMP_BNE 4
+#define FUSE_LDA_STA 5
+#define FUSE_CLC_ADC 6
+#define FUSE_INC_BNE 7
+#define FUSE_COPY 8
+#define FUSE_FILL 9
+#define FUSE_CLC_ADC_C 10
+#define FUSE_UNKNOWN 0xFF
+
+// pages whose inst_fused[] entries are up to date
+uint8_t inst_decoded[0x100];
+
+// superinstruction starting at each address, FUSE_UNKNOWN if not decoded yet
+static uint8_t inst_fused[0x10000];
+
+/**
+ * plain_page: Tells if a page is in the image with no device mapped, the
+ *             only memory read and written straight by the code below
+ * @param page The page
+ * @return 1 if it is, 0 if not
+ * */
+static uint8_t plain_page(uint8_t page) {
+    return !mem_io_map[page] && mem_read_map[page] == mem_raw() + (page << 8);
+}
+
+/**
+ * operand_addr: Address read by a zero page, absolute or immediate operand
+ * @param code The memory
+ * @param pc The address of the opcode
+ * @return the address
+ * */
+static uint16_t operand_addr(const uint8_t* code, uint16_t pc) {
+    uint8_t (*mode)(void) = lookup[code[pc]].mode;
+    uint16_t low = code[(uint16_t)(pc + 1)];
+
+    if (mode == &ZP0) return low;
+    if (mode == &ABS) return low | (code[(uint16_t)(pc + 2)] << 8);
+
+    // immediate
+    return pc + 1;
+}
+
+/**
+ * take_branch: second half of the pairs ending with a branch
+ * @param pc The address of the branch opcode
+ * @param taken The branch condition
+ * @return void
+ * */
+static void take_branch(uint16_t pc, bool taken) {
+    addr_rel = mem_raw()[(uint16_t)(pc + 1)];
+    if (addr_rel & 0x80) addr_rel |= 0xFF00;
+
+    cpu.pc = pc + 2;
+    *cys += 2;
+
+    if (taken) branch();
+    cover();
+}
+
+/**
+ * decode: Looks for a superinstruction at an address
+ * @param pc The address
+ * @return the FUSE_* id
+ * */
+static uint8_t decode(uint16_t pc) {
+    const uint8_t* code = mem_raw();
+    uint8_t first = code[pc], second;
+    uint16_t next;
+
+    // whole loops, the branch must go back to the first instruction
+    if (first == 0xB1 || first == 0x9D) {
+        static const uint8_t copy[] = {0xB1, 0, 0x91, 0, 0xC8, 0xD0, 0xF9};
+        static const uint8_t fill[] = {0x9D, 0, 0, 0xCA, 0xD0, 0xFA};
+        const uint8_t* pattern = first == 0xB1 ? copy : fill;
+        uint8_t len = first == 0xB1 ? sizeof(copy) : sizeof(fill);
+
+        if (!plain_page(pc >> 8) || !plain_page((uint16_t)(pc + len - 1) >> 8)) return FUSE_NONE;
+
+        for (uint8_t i = 0; i < len; i++) {
+            if (pattern[i] && code[(uint16_t)(pc + i)] != pattern[i]) return FUSE_NONE;
+        }
+
+        return first == 0xB1 ? FUSE_COPY : FUSE_FILL;
+    }
+
+    switch (first) {
+        case 0xCA: case 0x88: case 0x18: next = pc + 1; break;
+        case 0xC9: case 0xE6: next = pc + 2; break;
+        case 0xA9: case 0xA5: next = pc + 2; break;
+        case 0xAD: next = pc + 3; break;
+        default: return FUSE_NONE;
+    }
+
+    // code must be plain memory to be decoded ahead
+    if (!plain_page(pc >> 8) || !plain_page((uint16_t)(next + 2) >> 8)) return FUSE_NONE;
+
+    second = code[next];
+
+    switch (first) {
+        case 0xCA: return second == 0xD0 ? FUSE_DEX_BNE : FUSE_NONE;
+        case 0x88: return second == 0xD0 ? FUSE_DEY_BNE : FUSE_NONE;
+        case 0xC9: return second == 0xF0 ? FUSE_CMP_BEQ : second == 0xD0 ? FUSE_CMP_BNE : FUSE_NONE;
+        case 0xE6: return second == 0xD0 ? FUSE_INC_BNE : FUSE_NONE;
+        case 0x18:
+            if (second != 0x69 && second != 0x65 && second != 0x6D) return FUSE_NONE;
+            return lookup[second].op == &ADC_C ? FUSE_CLC_ADC_C : FUSE_CLC_ADC;
+    }
+
+    // LDA #imm, zp or abs followed by STA zp or abs
+    return (second == 0x85 || second == 0x8D) ? FUSE_LDA_STA : FUSE_NONE;
+}
+
+static uint8_t DEX_BNE(uint16_t pc) {
+    cpu.x--;
+    SET_NZ(cpu.x);
+
+    *cys = 2;
+    take_branch(pc + 1, !(cpu.sr & (1 << Z)));
+    return 1;
+}
+
+static uint8_t DEY_BNE(uint16_t pc) {
+    cpu.y--;
+    SET_NZ(cpu.y);
+
+    *cys = 2;
+    take_branch(pc + 1, !(cpu.sr & (1 << Z)));
+    return 1;
+}
+
+static uint8_t CMP_BXX(uint16_t pc, bool on_equal) {
+    uint8_t imm = mem_raw()[(uint16_t)(pc + 1)];
+    cpu.sr = (cpu.sr & ~ALU_NZC) | alu_cmp[(cpu.ac << 8) | imm];
+
+    *cys = 2;
+    take_branch(pc + 2, ((cpu.sr >> Z) & 1) == on_equal);
+    return 1;
+}
+
+static uint8_t INC_BNE(uint16_t pc) {
+    uint8_t* raw = mem_raw();
+    uint8_t zp = raw[(uint16_t)(pc + 1)];
+
+    if (!plain_page(0) || zp == (uint16_t)(pc + 2)) return 0;
+
+    uint8_t tmp = raw[zp] + 1;
+    cpu_write(zp, tmp);
+    SET_NZ(tmp);
+
+    // the write may have changed the branch, it's read afterwards
+    *cys = 5;
+    take_branch(pc + 2, !(cpu.sr & (1 << Z)));
+    return 1;
+}
+
+static uint8_t LDA_STA(uint16_t pc) {
+    uint8_t* raw = mem_raw();
+    uint8_t load = raw[pc];
+    uint16_t store_pc = pc + (load == 0xAD ? 3 : 2);
+    uint8_t store = raw[store_pc];
+    uint16_t src = operand_addr(raw, pc), dst = operand_addr(raw, store_pc);
+
+    if (!plain_page(src >> 8) || !plain_page(dst >> 8) || src == store_pc) return 0;
+
+    cpu.ac = raw[src];
+    SET_NZ(cpu.ac);
+    cpu_write(dst, cpu.ac);
+
+    cpu.pc = store_pc + (store == 0x8D ? 3 : 2);
+    *cys = lookup[load].cycles + lookup[store].cycles;
+    return 1;
+}
+
+static uint8_t CLC_ADC(uint16_t pc) {
+    uint8_t* raw = mem_raw();
+    uint8_t adc = raw[(uint16_t)(pc + 1)];
+    uint16_t src = operand_addr(raw, pc + 1);
+    uint16_t next = pc + 1 + (adc == 0x6D ? 3 : 2);
+
+    if (!plain_page(src >> 8) || src == next) return 0;
+
+    cpu.sr &= ~(1 << C);
+    uint16_t res = alu_adc[(cpu.sr >> D) & 1][ALU_INDEX(0, cpu.ac, raw[src])];
+
+    cpu.sr = (cpu.sr & ~ALU_NVZC) | (res >> 8);
+    cpu.ac = res & 0x00FF;
+
+    cpu.pc = next;
+    *cys = 2 + lookup[adc].cycles;
+    return 1;
+}
+
+// CLC_ADC_C: CLC_ADC with the 65C02 decimal mode, see ADC_C()
+static uint8_t CLC_ADC_C(uint16_t pc) {
+    if (!CLC_ADC(pc)) return 0;
+
+    if (cpu.sr & (1 << D)) {
+        SET_NZ(cpu.ac);
+        (*cys)++;
+    }
+
+    return 1;
+}
+
+/**
+ * plain_ram: Tells if a range of memory is plain RAM, see plain_page()
+ * @param first The first address
+ * @param len The length, the range must not wrap around 0xFFFF
+ * @return 1 if it's plain RAM, 0 if not
+ * */
+static uint8_t plain_ram(uint16_t first, uint16_t len) {
+    for (uint16_t page = first >> 8; page <= (first + len - 1) >> 8; page++) {
+        if (!plain_page(page)) return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * overlaps: Tells if two ranges of memory overlap
+ * @param a The first address of the first range
+ * @param a_len Its length
+ * @param b The first address of the second range
+ * @param b_len Its length
+ * @return 1 if they do, 0 if not
+ * */
+static uint8_t overlaps(uint32_t a, uint32_t a_len, uint32_t b, uint32_t b_len) {
+    return a < b + b_len && b < a + a_len;
+}
+
+// tells if a range overlaps a zero page pointer (which wraps within the page)
+static uint8_t hits_pointer(uint32_t a, uint32_t a_len, uint8_t zp) {
+    return overlaps(a, a_len, zp, 1) || overlaps(a, a_len, (uint8_t)(zp + 1), 1);
+}
+
+/**
+ * branch_back: Cycles of the BNE closing a loop, when taken
+ * @param head The address of the loop head
+ * @param end The address right after the BNE
+ * @return the cycles
+ * */
+static uint32_t branch_back(uint16_t head, uint16_t end) {
+    return 3 + ((head & 0xFF00) != (end & 0xFF00));
+}
+
+/**
+ * end_loop: Leaves the registers as after k iterations of a loop counting
+ *           with a register that ends in BNE
+ * @param reg The counting register
+ * @param head The address of the loop head
+ * @param end The address right after the BNE
+ * @return void
+ * */
+static void end_loop(uint8_t reg, uint16_t head, uint16_t end) {
+    SET_NZ(reg);
+    cpu.pc = reg ? head : end;
+}
+
+static uint32_t COPY_LOOP(uint16_t pc, uint64_t room) {
+    uint8_t* raw = mem_raw();
+    uint8_t zs = raw[(uint16_t)(pc + 1)], zd = raw[(uint16_t)(pc + 3)];
+    uint16_t src = raw[zs] | (raw[(uint8_t)(zs + 1)] << 8);
+    uint16_t dst = raw[zd] | (raw[(uint8_t)(zd + 1)] << 8);
+    uint16_t end = pc + 7;
+
+    // not even one iteration fits (room is 0 when a check is due right away)
+    if (room <= 18) return 0;
+
+    // iterations left, then as many as fit (18 cycles at most each)
+    uint32_t n = 0x100 - cpu.y;
+    if (n > (room - 1) / 18) n = (room - 1) / 18;
+    if (n == 0 || inst_coverage) return 0;
+
+    uint32_t from = src + cpu.y, to = dst + cpu.y;
+
+    if (from + n > 0x10000 || to + n > 0x10000) return 0;
+    if (!plain_ram(from, n) || !plain_ram(to, n)) return 0;
+
+    // a forward byte copy only behaves as memmove() if the destination isn't
+    // ahead of the source, and it mustn't overwrite the loop or its pointers.
+    // Loops reading their own code are left to cpu_fetch() as well
+    if (to > from && to < from + n) return 0;
+    if (overlaps(from, n, pc, 7) || overlaps(to, n, pc, 7) || hits_pointer(to, n, zs) || hits_pointer(to, n, zd)) return 0;
+
+    cpu.ac = raw[from + n - 1];
+    memmove(raw + to, raw + from, n);
+    cpu_written(to, n);
+
+    // LDA pays a cycle each time src + y crosses a page
+    uint32_t crossings = 0, first_cross = 0x100 - (src & 0xFF);
+    if ((src & 0xFF) && cpu.y + n > first_cross) {
+        crossings = cpu.y + n - (cpu.y > first_cross ? cpu.y : first_cross);
+    }
+
+    cpu.y += n;
+    end_loop(cpu.y, pc, end);
+
+    *cys = n * (5 + 6 + 2) + crossings + (n - 1) * branch_back(pc, end) +
+           (cpu.y ? branch_back(pc, end) : 2);
+    return n * 4;
+}
+
+static uint32_t FILL_LOOP(uint16_t pc, uint64_t room) {
+    uint8_t* raw = mem_raw();
+    uint16_t base = raw[(uint16_t)(pc + 1)] | (raw[(uint16_t)(pc + 2)] << 8);
+    uint16_t end = pc + 6;
+
+    // not even one iteration fits (room is 0 when a check is due right away)
+    if (room <= 11) return 0;
+
+    // iterations left, then as many as fit (11 cycles at most each)
+    uint32_t n = cpu.x ? cpu.x : 0x100;
+    if (n > (room - 1) / 11) n = (room - 1) / 11;
+    if (n == 0 || inst_coverage) return 0;
+
+    // X counts down: the bytes written are base + X - n + 1 ... base + X,
+    // with X = 0 the first one is base + 0 and the rest base + 255 down
+    uint32_t from = (uint32_t)base + (uint8_t)(cpu.x - n + 1), len = n;
+    if (cpu.x == 0) {
+        from = base + (0x100 - n + 1);
+        len = n - 1;
+        if (n == 0x100) from = base, len = 0x100;
+    }
+
+    if (len && (from + len > 0x10000 || !plain_ram(from, len) || overlaps(from, len, pc, 6))) return 0;
+    if (cpu.x == 0 && n < 0x100 && (!plain_ram(base, 1) || overlaps(base, 1, pc, 6))) return 0;
+
+    if (cpu.x == 0 && n < 0x100) {
+        raw[base] = cpu.ac;
+        cpu_written(base, 1);
+    }
+    memset(raw + from, cpu.ac, len);
+    cpu_written(from, len);
+
+    cpu.x -= n;
+    end_loop(cpu.x, pc, end);
+
+    *cys = n * (5 + 2) + (n - 1) * branch_back(pc, end) +
+           (cpu.x ? branch_back(pc, end) : 2);
+    return n * 3;
+}
+
+/**
+ * inst_exec_fused: Execute the superinstruction at cpu.pc, if any
+ * @param room Cycles every instruction of the pair (or loop) but the last
+ *             must end below: the cpu checks events and the budget after
+ *             every instruction, none of these checks can be skipped
+ * @param cycles The amount of clock cycles happening
+ * @return the number of instructions executed, 0 if the instruction must run
+ *         normally
+ */
+uint32_t inst_exec_fused(uint64_t room, uint32_t* cycles) {
+    uint16_t pc = cpu.pc;
+
+    if (!inst_decoded[pc >> 8]) {
+        memset(inst_fused + (pc & 0xFF00), FUSE_UNKNOWN, 0x100);
+        inst_decoded[pc >> 8] = 1;
+    }
+    if (inst_fused[pc] == FUSE_UNKNOWN) inst_fused[pc] = decode(pc);
+
+    uint8_t id = inst_fused[pc];
+    if (id == FUSE_NONE) return 0;
+
+    cys = cycles;
+
+    if (id == FUSE_COPY) return COPY_LOOP(pc, room);
+    if (id == FUSE_FILL) return FILL_LOOP(pc, room);
+
+    // the first instruction of every pair takes at most 5 cycles
+    if (room <= 5) return 0;
+
+    switch (id) {
+        case FUSE_DEX_BNE: return 2 * DEX_BNE(pc);
+        case FUSE_DEY_BNE: return 2 * DEY_BNE(pc);
+        case FUSE_CMP_BEQ: return 2 * CMP_BXX(pc, true);
+        case FUSE_CMP_BNE: return 2 * CMP_BXX(pc, false);
+        case FUSE_INC_BNE: return 2 * INC_BNE(pc);
+        case FUSE_LDA_STA: return 2 * LDA_STA(pc);
+        case FUSE_CLC_ADC: return 2 * CLC_ADC(pc);
+        case FUSE_CLC_ADC_C: return 2 * CLC_ADC_C(pc);
+    }
+
+    return 0;
+}
+
+/**
+ * inst_decode_flush: Forget every decoded superinstruction
+ * @param void
+ * @return void
+ */
+void inst_decode_flush(void) { memset(inst_decoded, 0, sizeof(inst_decoded)); }
+
+/**
+ * inst_is_illegal: Tells if an opcode isn't implemented (the "???" entries
+ *                  that don't behave as a NOP)
+ * @param opcode The opcode
+ * @return 1 if illegal, 0 if not
+ */
+uint8_t inst_is_illegal(uint8_t opcode) { return lookup[opcode].op == &XXX; }
+
+/**
+ * inst_mode: Addressing mode of an opcode
+ * @param opcode The opcode
+ * @return one of the INST_* modes
+ */
+uint8_t inst_mode(uint8_t opcode) {
+    static uint8_t (*const modes[])(void) = {&IMP, &IMM, &ZP0, &ZPX, &ZPY, &ABS, &ABX,
+                                             &ABY, &IND, &IZX, &IZY, &REL, &IZP, &IAX};
+    uint8_t mode = 0;
+
+    if (lookup[opcode].mode == &INDF) return INST_IND;
+    while (lookup[opcode].mode != modes[mode]) mode++;
+    return mode;
+}
+
+/**
+ * inst_select: Switch the cpu variant. Each variant has its own table and
+ *              handlers, the table is copied over lookup[] so dispatching
+ *              costs the same whatever the variant
+ * @param variant One of the CPU_* variants
+ * @return 0 if success, 1 if unknown
+ */
+int inst_select(uint8_t variant) {
+    static const struct instruction* const tables[] = {nmos, nmos_illegal, cmos};
+
+    if (variant >= sizeof(tables) / sizeof(tables[0])) return 1;
+
+    memcpy(lookup, tables[variant], sizeof(lookup));
+    inst_variant = variant;
+
+    // the 65C02 enters its handlers in binary mode
+    interrupt_clears = variant == CPU_65C02 ? 1 << D : 0;
+
+    // superinstructions are recognised from the table
+    inst_decode_flush();
+
+    debug_print("(inst_select) variant %d\n", variant);
+    return 0;
+}
+
+/**
+ * inst_variant_id: Looks up a cpu variant by name
+ * @param name "nmos", "nmos-illegal" or "65c02"
+ * @return the CPU_* variant, -1 if unknown
+ */
+int inst_variant_id(const char* name) {
+    static const char* const names[] = {"nmos", "nmos-illegal", "65c02"};
+
+    for (int i = 0; i < (int)(sizeof(names) / sizeof(names[0])); i++) {
+        if (strcmp(name, names[i]) == 0) return i;
+    }
+
+    return -1;
+}
+
+/**
+ * inst_cover_reset: Forget the previous control flow target, must be called
+ *                   before every fuzzing run so edges don't leak across runs
+ * @param void
+ * @return void
+ */
+void inst_cover_reset(void) { cov_prev = 0; }
+
+/**
+ * inst_exec: Parse and execute a fetched instruction
+ * @param opcode The retrieved opcode from cpu_run()
+ * @param cycles The amount of clock cycles happening
+ * @return void
+ */
+void inst_exec(uint8_t opcode, uint32_t* cycles) {
+    // saving variables to the corresponding global ones
+    op = opcode;
+    cys = cycles;
+
+    *cycles = lookup[opcode].cycles;
+
+    uint8_t additional_cycle_0 = (*(lookup[opcode].mode))();
+    uint8_t additional_cycle_1 = (*(lookup[opcode].op))();
+
+    *cycles += (additional_cycle_0 & additional_cycle_1);
+
+#ifdef CPU_CYCLE_STEPPED
+    // illegal opcodes don't do all of their accesses, spend the rest idle
+    cpu_bus_settle(*cycles);
+#endif
 
     debug_print("(inst_exec) cycles: %d, %p\n", *(cycles), (void*)cycles);
 }
@@ -12,7 +12,54 @@ struct instruction {
     uint8_t cycles;
 };
 
+// addressing modes, see inst_mode()
+#define INST_IMP 0
+#define INST_IMM 1
+#define INST_ZP0 2
+#define INST_ZPX 3
+#define INST_ZPY 4
+#define INST_ABS 5
+#define INST_ABX 6
+#define INST_ABY 7
+#define INST_IND 8
+#define INST_IZX 9
+#define INST_IZY 10
+#define INST_REL 11
+#define INST_IZP 12 // (zp), 65C02
+#define INST_IAX 13 // (abs,X), 65C02
+
+/*
+ * Cpu variants, see inst_select(). The core starts on CPU_VARIANT, build
+ * with -DCPU_VARIANT=CPU_65C02 (for instance) to change it.
+ * */
+#define CPU_NMOS 0          // unofficial opcodes are "???" or NOPs
+#define CPU_NMOS_ILLEGAL 1  // with the stable unofficial opcodes
+#define CPU_65C02 2
+
+#ifndef CPU_VARIANT
+#define CPU_VARIANT CPU_NMOS
+#endif
+
+extern struct instruction lookup[256];
+extern uint8_t inst_variant;
+
+// size of the edge coverage map, must be a power of two
+#define COV_MAP_SIZE 0x4000
+
+extern uint8_t* inst_coverage;
+
+// pages whose superinstructions are decoded, cleared by writes
+extern uint8_t inst_decoded[0x100];
+
 void inst_exec(uint8_t opcode, uint32_t* cycles);
+uint32_t inst_exec_fused(uint64_t room, uint32_t* cycles);
+void inst_decode_flush(void);
+uint8_t inst_is_illegal(uint8_t opcode);
+uint8_t inst_mode(uint8_t opcode);
+int inst_select(uint8_t variant);
+int inst_variant_id(const char* name);
+void inst_cover_reset(void);
 void reset(void);
+void interrupt(uint16_t vector, uint32_t* cycles);
 
 #endif
@@ -0,0 +1,143 @@
+#include "multi.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cpu.h"
+
+/**
+ * Multiple cpus:
+ *
+ * The core runs one cpu at a time, the others are parked in a cpu_context
+ * and swapped in for their turn, all of them on the same memory. Swapping
+ * between cpus sharing a bus keeps the decoded superinstructions, so it's a
+ * handful of stores: a quantum of 1 (lockstep, instruction by instruction)
+ * is slow but exact enough for cpus talking through a mailbox byte, large
+ * quanta run loosely coupled ones at full speed.
+ *
+ * In each round the main cpu runs a quantum, then the others catch up with
+ * the cycle it reached. Superinstructions and native loops stay within a
+ * turn like any instruction, a swap leaves no room for them until the first
+ * instruction of the turn is done. Only the main cpu runs the scheduled events and
+ * takes the devices' interrupts (see struct cpu_context).
+ * */
+static struct cpu_context cpus[MULTI_MAX_CPUS];
+
+// where each co-processor starts, on reset too
+static uint16_t entries[MULTI_MAX_CPUS];
+
+static uint8_t count = 1;
+static uint8_t current = 0;
+static uint64_t quantum = MULTI_QUANTUM;
+
+/**
+ * multi_init: Set the synchronisation quantum
+ * @param q Cycles a cpu runs before the others catch up, 0 for the default
+ * @return void
+ * */
+void multi_init(uint64_t q) { quantum = q ? q : MULTI_QUANTUM; }
+
+/**
+ * multi_add: Add a co-processor on the bus of the main cpu (which must be
+ *            the one selected), it starts at its entry point
+ * @param entry Its reset address
+ * @return 0 if success, 1 if there are too many cpus
+ * */
+int multi_add(uint16_t entry) {
+    if (count == MULTI_MAX_CPUS) return 1;
+
+    struct cpu_context* c = &cpus[count];
+
+    // same clock and memory as the main cpu
+    cpu_save_context(c);
+    c->regs = (struct central_processing_unit){.pc = entry, .sp = 0xFD};
+    c->instructions = 0;
+    c->cycles = 0;
+    c->irq_lines = 0;
+    c->nmi_pending = 0;
+    c->main_cpu = &cpus[0];
+
+    entries[count++] = entry;
+    return 0;
+}
+
+// multi_count: number of cpus, the main one included
+uint8_t multi_count(void) { return count; }
+
+/**
+ * multi_select: Load a cpu in the core, to look at it or change it
+ * @param i Its index, 0 for the main cpu
+ * @return void
+ * */
+void multi_select(uint8_t i) {
+    if (i == current || i >= count) return;
+
+    cpu_save_context(&cpus[current]);
+    cpu_load_context(&cpus[i]);
+    current = i;
+}
+
+/**
+ * multi_run: cpu_run() for all the cpus, by quanta. The budget and stop
+ *            conditions are the main cpu's, the others only catch up with
+ *            it. Idle only stops the run when every cpu is idle, any of them
+ *            could wake up the others.
+ * @param budget The cycles the main cpu may run
+ * @param stop_mask See cpu_run()
+ * @param ran Where to store the cycles the main cpu ran, can be NULL
+ * @return the reason the run stopped, see cpu_run()
+ * */
+uint8_t multi_run(uint64_t budget, uint8_t stop_mask, uint64_t* ran) {
+    multi_select(0);
+
+    if (count == 1) return cpu_run(budget, stop_mask, ran);
+
+    uint64_t start = cpu_clock, end = start + budget;
+    uint8_t reason = CPU_STOP_BUDGET;
+
+    if (end < start) end = UINT64_MAX;
+
+    while (reason == CPU_STOP_BUDGET && cpu_clock < end) {
+        uint64_t slice = end - cpu_clock < quantum ? end - cpu_clock : quantum;
+
+        reason = cpu_run(slice, stop_mask, NULL);
+
+        uint64_t now = cpu_clock;
+        uint8_t idle = reason == CPU_STOP_IDLE;
+
+        for (uint8_t i = 1; i < count; i++) {
+            multi_select(i);
+
+            // already past it, so not found idle
+            if (cpu_clock >= now) {
+                idle = 0;
+                continue;
+            }
+
+            if (cpu_run(now - cpu_clock, idle ? CPU_STOP_IDLE : 0, NULL) != CPU_STOP_IDLE) {
+                idle = 0;
+            }
+            if (cpu_clock < now) cpu_run(now - cpu_clock, 0, NULL);
+        }
+
+        multi_select(0);
+
+        if (reason == CPU_STOP_IDLE && !idle) reason = CPU_STOP_BUDGET;
+    }
+
+    if (ran) *ran = cpu_clock - start;
+    return reason;
+}
+
+/**
+ * multi_reset: Reset every cpu, the co-processors go back to their entry
+ * @param void
+ * @return void
+ * */
+void multi_reset(void) {
+    for (uint8_t i = count; i-- > 0;) {
+        multi_select(i);
+        cpu_reset();
+        if (i) cpu.pc = entries[i];
+    }
+}
@@ -0,0 +1,24 @@
+#ifndef INC_6502_MULTI_H
+#define INC_6502_MULTI_H
+
+#include <stdint.h>
+
+/*
+ * Several cpus on the bus of the running machine: cpu 0 is the one already
+ * in the core (the main cpu), the others (co-processors) share its memory
+ * and devices. They run in turns of a quantum of cycles, the smaller the
+ * quantum the closer they stay in time.
+ * */
+#define MULTI_MAX_CPUS  4
+
+// default quantum, see multi_init()
+#define MULTI_QUANTUM   64
+
+void multi_init(uint64_t quantum);
+int multi_add(uint16_t entry);
+uint8_t multi_count(void);
+void multi_select(uint8_t i);
+uint8_t multi_run(uint64_t budget, uint8_t stop_mask, uint64_t* ran);
+void multi_reset(void);
+
+#endif
@@ -0,0 +1,219 @@
+#include "sched.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../utils/misc.h"
+
+/**
+ * The scheduler:
+ *
+ * Peripherals don't get polled on every instruction, instead they register
+ * a callback that has to run once the emulated clock reaches a given cycle.
+ * Pending events are kept in a binary min-heap ordered by deadline (ties are
+ * broken by insertion order so runs are deterministic), and the deadline of
+ * the heap top is mirrored in sched_deadline for the cpu to compare against.
+ *
+ * Events live in a fixed pool. The id returned by sched_add() carries the
+ * slot in its low byte and the generation of the slot above it, bumped on
+ * every reuse: an id kept after its event fired or got cancelled names a
+ * generation that's gone, and can't cancel the next event of the slot.
+ * */
+struct sched_event {
+    uint64_t at;
+    uint64_t seq;
+    sched_callback fn;
+    void* ctx;
+    int16_t pos;   // position in the heap, -1 if the slot is free
+    uint16_t gen;  // uses of the slot so far, see sched_add()
+};
+
+static struct sched_event events[SCHED_MAX_EVENTS];
+static uint8_t heap[SCHED_MAX_EVENTS];
+static uint8_t heap_len = 0;
+static uint64_t seq_counter = 0;
+
+uint64_t sched_deadline = SCHED_NEVER;
+
+/**
+ * earlier: heap ordering, by deadline and then by insertion order
+ * @param a slot of the first event
+ * @param b slot of the second event
+ * @return 1 if a must fire before b, 0 if not
+ * */
+static uint8_t earlier(uint8_t a, uint8_t b) {
+    if (events[a].at != events[b].at) return events[a].at < events[b].at;
+    return events[a].seq < events[b].seq;
+}
+
+/**
+ * heap_set: places a slot at a given heap position keeping the back reference
+ * @param pos The position in the heap
+ * @param slot The event slot
+ * @return void
+ * */
+static void heap_set(uint8_t pos, uint8_t slot) {
+    heap[pos] = slot;
+    events[slot].pos = pos;
+}
+
+static void sift_up(uint8_t pos) {
+    uint8_t slot = heap[pos];
+
+    while (pos > 0) {
+        uint8_t parent = (pos - 1) / 2;
+        if (!earlier(slot, heap[parent])) break;
+
+        heap_set(pos, heap[parent]);
+        pos = parent;
+    }
+
+    heap_set(pos, slot);
+}
+
+static void sift_down(uint8_t pos) {
+    uint8_t slot = heap[pos];
+
+    while (1) {
+        uint8_t child = pos * 2 + 1;
+        if (child >= heap_len) break;
+
+        if (child + 1 < heap_len && earlier(heap[child + 1], heap[child])) {
+            child++;
+        }
+        if (!earlier(heap[child], slot)) break;
+
+        heap_set(pos, heap[child]);
+        pos = child;
+    }
+
+    heap_set(pos, slot);
+}
+
+/**
+ * update_deadline: mirrors the heap top in sched_deadline
+ * @param void
+ * @return void
+ * */
+static void update_deadline(void) {
+    sched_deadline = heap_len ? events[heap[0]].at : SCHED_NEVER;
+}
+
+/**
+ * heap_remove: takes an event out of the heap and frees its slot
+ * @param pos The position in the heap
+ * @return void
+ * */
+static void heap_remove(uint8_t pos) {
+    events[heap[pos]].pos = -1;
+    heap_len--;
+
+    if (pos == heap_len) return;
+
+    heap_set(pos, heap[heap_len]);
+    sift_down(pos);
+    sift_up(events[heap[pos]].pos);
+}
+
+/**
+ * sched_init: Drops every pending event
+ * @param void
+ * @return void
+ * */
+void sched_init(void) {
+    for (uint8_t i = 0; i < SCHED_MAX_EVENTS; i++) events[i].pos = -1;
+
+    heap_len = 0;
+    update_deadline();
+}
+
+/**
+ * sched_add: Schedules a callback at a given cycle of the cpu clock
+ * @param at The cycle the event is due at
+ * @param fn The callback to run
+ * @param ctx Opaque pointer given back to the callback
+ * @return the event id, -1 if the pool is exhausted
+ * */
+int sched_add(uint64_t at, sched_callback fn, void* ctx) {
+    uint8_t slot;
+
+    for (slot = 0; slot < SCHED_MAX_EVENTS; slot++) {
+        if (events[slot].pos == -1) break;
+    }
+
+    if (slot == SCHED_MAX_EVENTS) {
+        debug_print("(sched_add) no free slot for event at %llu\n",
+                    (unsigned long long)at);
+        return -1;
+    }
+
+    events[slot].at = at;
+    events[slot].seq = seq_counter++;
+    events[slot].fn = fn;
+    events[slot].ctx = ctx;
+    events[slot].gen++;
+
+    heap_set(heap_len, slot);
+    heap_len++;
+    sift_up(heap_len - 1);
+
+    // the kick might still be pending, never push the deadline forward here
+    if (at < sched_deadline) sched_deadline = at;
+
+    return (int)events[slot].gen << 8 | slot;
+}
+
+/**
+ * sched_cancel: Removes a pending event, ignores ids that already fired
+ *               or were cancelled
+ * @param id The id returned by sched_add()
+ * @return void
+ * */
+void sched_cancel(int id) {
+    uint8_t slot = id & 0xFF;
+
+    if (id < 0 || slot >= SCHED_MAX_EVENTS || events[slot].pos == -1) return;
+    if (events[slot].gen != (uint16_t)(id >> 8)) return;
+
+    heap_remove(events[slot].pos);
+}
+
+/**
+ * sched_run: Fires every event that is due at the given cycle.
+ *            Callbacks are allowed to add or cancel events.
+ * @param now The current cycle of the cpu clock
+ * @return the number of events fired
+ * */
+uint32_t sched_run(uint64_t now) {
+    uint32_t fired = 0;
+
+    while (heap_len && events[heap[0]].at <= now) {
+        uint8_t slot = heap[0];
+        sched_callback fn = events[slot].fn;
+        void* ctx = events[slot].ctx;
+
+        heap_remove(0);
+        fn(ctx);
+        fired++;
+    }
+
+    update_deadline();
+    return fired;
+}
+
+/**
+ * sched_kick: Forces the cpu into the slow path at the next instruction
+ *             boundary, used when an interrupt line changes
+ * @param void
+ * @return void
+ * */
+void sched_kick(void) { sched_deadline = 0; }
+
+/**
+ * sched_next: Cycle of the earliest pending event
+ * @param void
+ * @return the cycle, SCHED_NEVER if nothing is scheduled
+ * */
+uint64_t sched_next(void) {
+    return heap_len ? events[heap[0]].at : SCHED_NEVER;
+}
@@ -0,0 +1,28 @@
+#ifndef INC_6502_SCHED_H
+#define INC_6502_SCHED_H
+
+#include <stdint.h>
+
+// maximum amount of events that can be pending at the same time
+#define SCHED_MAX_EVENTS 64
+
+// deadline used when nothing is scheduled, the cpu will never reach it
+#define SCHED_NEVER UINT64_MAX
+
+typedef void (*sched_callback)(void* ctx);
+
+/*
+ * Cycle of the earliest pending event. cpu_run() compares the clock against
+ * this value after every instruction and only enters the scheduler when it's
+ * been reached, so the no-event path costs a single compare.
+ */
+extern uint64_t sched_deadline;
+
+void sched_init(void);
+int sched_add(uint64_t at, sched_callback fn, void* ctx);
+void sched_cancel(int id);
+uint32_t sched_run(uint64_t now);
+void sched_kick(void);
+uint64_t sched_next(void);
+
+#endif
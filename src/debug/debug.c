@@ -0,0 +1,523 @@
+#define _GNU_SOURCE
+
+#include "debug.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "../cpu/cpu.h"
+#include "../cpu/multi.h"
+#include "../mem/mem.h"
+#include "../mem/shm.h"
+#include "../peripherals/uart.h"
+
+/**
+ * Debug server:
+ *
+ * Runs headless, the emulator is driven by the clients. Everything happens
+ * on one thread (the core isn't thread safe): the server waits in poll()
+ * while the cpu is stopped, and while it runs the cpu executes slices of
+ * DBG_SLICE cycles with a poll() without timeout in between, so a request
+ * (a stop, a memory read...) waits for a slice at most. A program idle on
+ * its console input wakes up when the input comes.
+ *
+ * Memory accesses go straight to RAM, devices don't see them.
+ * */
+
+// most clients connected at the same time
+#define DBG_MAX_CLIENTS 8
+
+// cycles run between two looks at the sockets
+#define DBG_SLICE 100000
+
+// header of a request
+#define DBG_HEADER 5
+
+struct client {
+    int fd;
+    uint8_t subscribed;
+    uint8_t* buf;       // request being received
+    uint32_t len;
+};
+
+static struct client clients[DBG_MAX_CLIENTS];
+static int listener = -1;
+
+// set while the cpu runs on its own, see DBG_RUN
+static uint8_t running = 0;
+static uint8_t quit = 0;
+
+// breakpoints set by the clients, the core doesn't say which are
+static uint8_t breakpoints[0x10000 / 8];
+
+// reply being built, see reply_*()
+static uint8_t* out = NULL;
+static uint32_t out_len = 0, out_cap = 0;
+
+/*
+ * =============================================
+ * ENCODING
+ * =============================================
+ */
+
+static uint16_t get16(const uint8_t* p) { return p[0] | (p[1] << 8); }
+
+static uint32_t get32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/**
+ * reply_put: appends bytes to the reply being built
+ * @param data The bytes, NULL to append zeroes
+ * @param len Their number
+ * @return a pointer to them in the reply
+ * */
+static uint8_t* reply_put(const void* data, uint32_t len) {
+    if (out_len + len > out_cap) {
+        uint32_t cap = out_cap ? out_cap : 256;
+        while (cap < out_len + len) cap *= 2;
+
+        uint8_t* grown = realloc(out, cap);
+        if (!grown) {
+            fprintf(stderr, "[x] DEBUG -> out of memory\n");
+            exit(1);
+        }
+        out = grown;
+        out_cap = cap;
+    }
+
+    uint8_t* at = out + out_len;
+    if (data) {
+        memcpy(at, data, len);
+    } else {
+        memset(at, 0, len);
+    }
+    out_len += len;
+
+    return at;
+}
+
+static void reply_u8(uint8_t v) { reply_put(&v, 1); }
+
+static void reply_u16(uint16_t v) {
+    uint8_t b[2] = {v & 0xFF, v >> 8};
+    reply_put(b, 2);
+}
+
+static void reply_regs(void) {
+    reply_u16(cpu.pc);
+    reply_u8(cpu.ac);
+    reply_u8(cpu.x);
+    reply_u8(cpu.y);
+    reply_u8(cpu.sp);
+    reply_u8(cpu.sr);
+
+    for (int i = 0; i < 8; i++) reply_u8(cpu_clock >> (8 * i));
+}
+
+/**
+ * reply_start: starts a reply (or event), the length is filled by send_out()
+ * @param type The command answered, or DBG_EVENT_STOP
+ * @param code The status, or the stop reason
+ * @return void
+ * */
+static void reply_start(uint8_t type, uint8_t code) {
+    out_len = 0;
+    reply_u8(type);
+    reply_u8(code);
+    reply_put(NULL, 4);
+}
+
+/**
+ * send_all: writes a whole buffer to a client, dropping it on errors
+ * @param c The client
+ * @param data The bytes
+ * @param len Their number
+ * @return void
+ * */
+static void send_all(struct client* c, const uint8_t* data, uint32_t len) {
+    while (len && c->fd >= 0) {
+        ssize_t n = send(c->fd, data, len, MSG_NOSIGNAL);
+
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            struct pollfd p = {c->fd, POLLOUT, 0};
+            poll(&p, 1, -1);
+            continue;
+        }
+        if (n <= 0) {
+            close(c->fd);
+            c->fd = -1;
+            return;
+        }
+
+        data += n;
+        len -= n;
+    }
+}
+
+static void send_out(struct client* c) {
+    uint32_t len = out_len - 6;
+
+    for (int i = 0; i < 4; i++) out[2 + i] = len >> (8 * i);
+    send_all(c, out, out_len);
+}
+
+/**
+ * broadcast_stop: tells every subscribed client the cpu stopped
+ * @param reason The CPU_STOP_* or DBG_STOP_* reason
+ * @return void
+ * */
+static void broadcast_stop(uint8_t reason) {
+    reply_start(DBG_EVENT_STOP, reason);
+    reply_regs();
+
+    for (int i = 0; i < DBG_MAX_CLIENTS; i++) {
+        if (clients[i].fd >= 0 && clients[i].subscribed) send_out(&clients[i]);
+    }
+}
+
+/*
+ * =============================================
+ * COMMANDS
+ * =============================================
+ */
+
+/**
+ * host_write: writes memory on behalf of a client, like a program load would
+ * @param addr The first address
+ * @param data The bytes
+ * @param len Their number, wraps at 0xFFFF
+ * @return void
+ * */
+static void host_write(uint16_t addr, const uint8_t* data, uint32_t len) {
+    for (uint32_t i = 0; i < len; i++) {
+        uint16_t a = addr + i;
+        mem_write_map[a >> 8][a & 0xFF] = data[i];
+        mem_dirty[a >> 8] = 1;
+    }
+}
+
+/**
+ * step: executes instructions, stopping early on a breakpoint (the one the
+ * pc sits on is ignored, so a stopped program can be stepped)
+ * @param count The number of instructions
+ * @return the stop reason
+ * */
+static uint8_t step(uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        if (i && (breakpoints[cpu.pc >> 3] & (1 << (cpu.pc & 7)))) return CPU_STOP_BREAKPOINT;
+        multi_run(1, 0, NULL);
+    }
+
+    return DBG_STOP_STEP;
+}
+
+/**
+ * handle: executes a request and sends the reply
+ * @param c The client
+ * @param cmd The command
+ * @param p The payload
+ * @param len Its length
+ * @return void
+ * */
+static void handle(struct client* c, uint8_t cmd, const uint8_t* p, uint32_t len) {
+    uint8_t status = DBG_OK;
+    uint8_t stopped = 0xFF;
+
+    reply_start(cmd, DBG_OK);
+
+    // registers and memory may change, hold the readers of the export
+    shm_begin();
+
+    switch (cmd) {
+        case DBG_PING:
+            reply_u8(DBG_VERSION);
+            break;
+
+        case DBG_GET_REGS:
+            reply_regs();
+            break;
+
+        case DBG_SET_REGS:
+            if (len < 7) {
+                status = DBG_EPAYLOAD;
+            } else if (running) {
+                status = DBG_ERUNNING;
+            } else {
+                cpu.pc = get16(p);
+                cpu.ac = p[2];
+                cpu.x = p[3];
+                cpu.y = p[4];
+                cpu.sp = p[5];
+                cpu.sr = p[6];
+                cpu_forget();
+            }
+            break;
+
+        case DBG_READ_MEM: {
+            // the reply can't be larger than a request may be
+            uint32_t total = 0;
+            for (uint32_t i = 0; i + 4 <= len; i += 4) total += get16(p + i + 2);
+
+            if (len % 4 || total > DBG_MAX_PAYLOAD) {
+                status = DBG_EPAYLOAD;
+                break;
+            }
+            for (uint32_t i = 0; i < len; i += 4) {
+                uint16_t addr = get16(p + i), n = get16(p + i + 2);
+                uint8_t* dst = reply_put(NULL, n);
+
+                for (uint16_t j = 0; j < n; j++) {
+                    uint16_t a = addr + j;
+                    dst[j] = mem_page(a >> 8)[a & 0xFF];
+                }
+            }
+            break;
+        }
+
+        case DBG_WRITE_MEM: {
+            // check every range before writing any
+            uint32_t i = 0;
+            while (i + 4 <= len && i + 4 + get16(p + i + 2) <= len) i += 4 + get16(p + i + 2);
+
+            if (i != len) {
+                status = DBG_EPAYLOAD;
+                break;
+            }
+            for (i = 0; i < len; i += 4 + get16(p + i + 2)) {
+                host_write(get16(p + i), p + i + 4, get16(p + i + 2));
+            }
+            cpu_forget();
+            break;
+        }
+
+        case DBG_BREAKPOINT: {
+            if (len < 3) {
+                status = DBG_EPAYLOAD;
+                break;
+            }
+            uint16_t addr = get16(p);
+
+            cpu_set_breakpoint(addr, p[2] != 0);
+            if (p[2]) {
+                breakpoints[addr >> 3] |= 1 << (addr & 7);
+            } else {
+                breakpoints[addr >> 3] &= ~(1 << (addr & 7));
+            }
+            break;
+        }
+
+        case DBG_STEP:
+            if (len < 4) {
+                status = DBG_EPAYLOAD;
+            } else if (running) {
+                status = DBG_ERUNNING;
+            } else {
+                stopped = step(get32(p));
+                reply_regs();
+            }
+            break;
+
+        case DBG_RUN:
+            running = 1;
+            break;
+
+        case DBG_STOP:
+            if (running) {
+                running = 0;
+                stopped = DBG_STOP_REQUESTED;
+            }
+            break;
+
+        case DBG_SUBSCRIBE:
+            if (len < 1) {
+                status = DBG_EPAYLOAD;
+            } else {
+                c->subscribed = p[0] != 0;
+            }
+            break;
+
+        case DBG_RESET:
+            running = 0;
+            multi_reset();
+            reply_regs();
+            break;
+
+        case DBG_DETACH:
+            quit = 1;
+            break;
+
+        default:
+            status = DBG_EUNKNOWN;
+            break;
+    }
+
+    shm_end();
+
+    if (status != DBG_OK) reply_start(cmd, status);
+    send_out(c);
+
+    if (stopped != 0xFF) broadcast_stop(stopped);
+}
+
+/*
+ * =============================================
+ * CONNECTIONS
+ * =============================================
+ */
+
+static void drop(struct client* c) {
+    if (c->fd >= 0) close(c->fd);
+    c->fd = -1;
+    c->len = 0;
+    c->subscribed = 0;
+}
+
+static void accept_client(void) {
+    int fd = accept(listener, NULL, NULL);
+    if (fd < 0) return;
+
+    for (int i = 0; i < DBG_MAX_CLIENTS; i++) {
+        if (clients[i].fd >= 0) continue;
+
+        if (!clients[i].buf) clients[i].buf = malloc(DBG_HEADER + DBG_MAX_PAYLOAD);
+        if (!clients[i].buf) break;
+
+        clients[i].fd = fd;
+        clients[i].len = 0;
+        clients[i].subscribed = 0;
+        return;
+    }
+
+    // full
+    close(fd);
+}
+
+/**
+ * receive: reads what a client sent and handles every complete request
+ * @param c The client
+ * @return void
+ * */
+static void receive(struct client* c) {
+    ssize_t n = recv(c->fd, c->buf + c->len, DBG_HEADER + DBG_MAX_PAYLOAD - c->len, 0);
+
+    if (n < 0 && (errno == EINTR || errno == EAGAIN)) return;
+    if (n <= 0) {
+        drop(c);
+        return;
+    }
+    c->len += n;
+
+    uint32_t used = 0;
+
+    while (c->fd >= 0 && c->len - used >= DBG_HEADER) {
+        uint8_t* req = c->buf + used;
+        uint32_t len = get32(req + 1);
+
+        if (len > DBG_MAX_PAYLOAD) {
+            drop(c);
+            return;
+        }
+        if (c->len - used < DBG_HEADER + len) break;
+
+        handle(c, req[0], req + DBG_HEADER, len);
+        used += DBG_HEADER + len;
+    }
+
+    if (c->fd < 0) return;
+
+    memmove(c->buf, c->buf + used, c->len - used);
+    c->len -= used;
+}
+
+/**
+ * debug_serve: Serve debug clients until one detaches, the cpu must be
+ *              initialized and reset
+ * @param path The path of the socket, replaced if it exists
+ * @return 0 if success, 1 if the socket can't be created
+ * */
+int debug_serve(const char* path) {
+    struct sockaddr_un addr;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "[x] DEBUG -> socket path too long\n");
+        return 1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path);
+
+    if (listener < 0 || bind(listener, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        listen(listener, DBG_MAX_CLIENTS) < 0) {
+        fprintf(stderr, "[x] DEBUG -> can't listen on %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    for (int i = 0; i < DBG_MAX_CLIENTS; i++) clients[i].fd = -1;
+
+    fprintf(stderr, "[debug] listening on %s\n", path);
+
+    // an idle program only waits for the host, don't spin on it
+    uint8_t idle = 0;
+
+    while (!quit) {
+        struct pollfd fds[2 + DBG_MAX_CLIENTS];
+
+        fds[0].fd = listener;
+        fds[0].events = POLLIN;
+        for (int i = 0; i < DBG_MAX_CLIENTS; i++) {
+            fds[1 + i].fd = clients[i].fd;
+            fds[1 + i].events = POLLIN;
+        }
+
+        // the program may be idle waiting on the console
+        fds[1 + DBG_MAX_CLIENTS].fd = running && idle ? uart_input_fd() : -1;
+        fds[1 + DBG_MAX_CLIENTS].events = POLLIN;
+
+        if (poll(fds, 2 + DBG_MAX_CLIENTS, running && !idle ? 0 : -1) > 0) {
+            if (fds[0].revents & POLLIN) accept_client();
+            if (fds[1 + DBG_MAX_CLIENTS].revents) idle = 0;
+
+            for (int i = 0; i < DBG_MAX_CLIENTS && !quit; i++) {
+                if (clients[i].fd < 0 || !fds[1 + i].revents) continue;
+
+                receive(&clients[i]);
+                // a request might have changed what the program waits for
+                idle = 0;
+            }
+        }
+
+        if (!running || idle || quit) continue;
+
+        uart_poll();
+        uint8_t reason = multi_run(DBG_SLICE, CPU_STOP_BREAKPOINT | CPU_STOP_BRK | CPU_STOP_IDLE, NULL);
+
+        if (reason == CPU_STOP_IDLE) {
+            idle = 1;
+        } else if (reason != CPU_STOP_BUDGET) {
+            running = 0;
+            broadcast_stop(reason);
+        }
+    }
+
+    for (int i = 0; i < DBG_MAX_CLIENTS; i++) {
+        drop(&clients[i]);
+        free(clients[i].buf);
+    }
+    close(listener);
+    unlink(path);
+
+    return 0;
+}
@@ -0,0 +1,52 @@
+#ifndef INC_6502_DEBUG_H
+#define INC_6502_DEBUG_H
+
+#include <stdint.h>
+
+/*
+ * Debug server protocol, over a Unix-domain stream socket. Integers are
+ * little-endian.
+ *
+ * request:   u8 command, u32 length, payload
+ * reply:     u8 command, u8 status, u32 length, payload
+ * event:     u8 DBG_EVENT_STOP, u8 reason, u32 length, registers
+ *
+ * Every request gets exactly one reply, in order. Events are only sent to
+ * the clients that subscribed, and never in the middle of a reply.
+ *
+ * Registers are encoded as: u16 pc, u8 a, x, y, sp, sr, u64 clock (the
+ * clock is ignored when writing them).
+ * */
+#define DBG_PING        0x01    // -> u8 protocol version
+#define DBG_GET_REGS    0x02    // -> registers
+#define DBG_SET_REGS    0x03    // registers ->
+#define DBG_READ_MEM    0x04    // n * (u16 addr, u16 len) -> the bytes of each range
+#define DBG_WRITE_MEM   0x05    // n * (u16 addr, u16 len, bytes) ->
+#define DBG_BREAKPOINT  0x06    // u16 addr, u8 on ->
+#define DBG_STEP        0x07    // u32 count -> registers, stops early on breakpoints
+#define DBG_RUN         0x08    // -> (the stop comes later as an event)
+#define DBG_STOP        0x09    // ->
+#define DBG_SUBSCRIBE   0x0A    // u8 on ->
+#define DBG_RESET       0x0B    // -> registers
+#define DBG_DETACH      0x0C    // -> the server quits
+
+#define DBG_EVENT_STOP  0x80
+
+#define DBG_VERSION     1
+
+// reply status
+#define DBG_OK          0
+#define DBG_EUNKNOWN    1       // unknown command
+#define DBG_EPAYLOAD    2       // malformed payload
+#define DBG_ERUNNING    3       // the cpu is running, stop it first
+
+// stop reasons: the CPU_STOP_* ones, plus
+#define DBG_STOP_STEP       0x40
+#define DBG_STOP_REQUESTED  0x80
+
+// largest request payload accepted, enough for the whole memory
+#define DBG_MAX_PAYLOAD (0x10000 * 2)
+
+int debug_serve(const char* path);
+
+#endif
@@ -0,0 +1,419 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "fuzz.h"
+
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "../cpu/cpu.h"
+#include "../cpu/instructions.h"
+#include "../mem/mem.h"
+#include "../mem/snapshot.h"
+
+/**
+ * In-process coverage-guided fuzzer:
+ *
+ * The target is loaded once and run until the entry point, then the machine
+ * is saved. Every run restores the pages the previous one dirtied, writes
+ * the input at the configured address and executes in a single cpu_run()
+ * until BRK, the stop address (a breakpoint), an illegal opcode (crash) or
+ * the cycle budget (hang). Control flow instructions fill the edge coverage
+ * map as they execute; inputs hitting new edges (or new hit count buckets,
+ * like AFL does) are kept in the corpus and mutated.
+ * */
+
+enum run_result { RUN_OK, RUN_CRASH, RUN_HANG };
+
+struct corpus_entry {
+    uint8_t* data;
+    uint16_t len;
+};
+
+static struct corpus_entry corpus[FUZZ_MAX_CORPUS];
+static uint32_t corpus_len = 0;
+
+// coverage of the current run and everything seen so far (bucketed)
+static uint8_t coverage[COV_MAP_SIZE];
+static uint8_t virgin[COV_MAP_SIZE];
+static uint8_t virgin_crash[COV_MAP_SIZE];
+
+static struct snapshot base;
+static uint64_t rng_state;
+
+/*
+ * =============================================
+ * HELPERS
+ * =============================================
+ */
+
+// xorshift64*
+static uint64_t rnd(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static uint32_t rnd_below(uint32_t limit) { return limit ? rnd() % limit : 0; }
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * bucket: folds a hit count in one of the AFL buckets so loops don't flood
+ * the corpus (1, 2, 3, 4-7, 8-15, 16-31, 32-127, 128+)
+ * @param hits The hit count
+ * @return a byte with the bit of the bucket set
+ * */
+static uint8_t bucket(uint8_t hits) {
+    if (hits == 0) return 0;
+    if (hits <= 3) return 1 << (hits - 1);
+    if (hits <= 7) return 1 << 3;
+    if (hits <= 15) return 1 << 4;
+    if (hits <= 31) return 1 << 5;
+    if (hits <= 127) return 1 << 6;
+    return 1 << 7;
+}
+
+/**
+ * merge_coverage: merges the run coverage in a virgin map
+ * @param map The map of what's been seen so far
+ * @return 1 if the run found something new, 0 if not
+ * */
+static uint8_t merge_coverage(uint8_t* map) {
+    uint8_t found = 0;
+
+    // runs only touch a handful of edges, skip the map 8 bytes at a time
+    for (uint32_t w = 0; w < COV_MAP_SIZE; w += 8) {
+        uint64_t word;
+        memcpy(&word, coverage + w, sizeof(word));
+        if (!word) continue;
+
+        for (uint32_t i = w; i < w + 8; i++) {
+            uint8_t b = bucket(coverage[i]);
+            if (b & ~map[i]) {
+                map[i] |= b;
+                found = 1;
+            }
+        }
+    }
+
+    return found;
+}
+
+static uint32_t count_edges(void) {
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < COV_MAP_SIZE; i++) n += virgin[i] != 0;
+    return n;
+}
+
+/**
+ * save_input: writes an input to a directory
+ * @param dir The directory, nothing is written if NULL
+ * @param prefix The file name prefix
+ * @param id The file name number
+ * @param data The input
+ * @param len The input length
+ * @return void
+ * */
+static void save_input(const char* dir, const char* prefix, uint32_t id,
+                       const uint8_t* data, uint16_t len) {
+    char path[512];
+
+    if (!dir) return;
+
+    snprintf(path, sizeof(path), "%s/%s%06u", dir, prefix, id);
+    FILE* fp = fopen(path, "wb");
+    if (!fp) return;
+
+    fwrite(data, 1, len, fp);
+    fclose(fp);
+}
+
+static void corpus_add(const uint8_t* data, uint16_t len) {
+    if (corpus_len == FUZZ_MAX_CORPUS) return;
+
+    corpus[corpus_len].data = malloc(len ? len : 1);
+    if (!corpus[corpus_len].data) return;
+
+    memcpy(corpus[corpus_len].data, data, len);
+    corpus[corpus_len].len = len;
+    corpus_len++;
+}
+
+/**
+ * load_seeds: reads every regular file of the corpus directory
+ * @param cfg The fuzzer configuration
+ * @return void
+ * */
+static void load_seeds(struct fuzz_config* cfg) {
+    uint8_t buf[FUZZ_MAX_LEN];
+    struct dirent* ent;
+    DIR* dir;
+
+    if (!cfg->corpus_dir) return;
+
+    mkdir(cfg->corpus_dir, 0755);
+    if (!(dir = opendir(cfg->corpus_dir))) return;
+
+    while ((ent = readdir(dir)) != NULL) {
+        char path[512];
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", cfg->corpus_dir, ent->d_name);
+
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) continue;
+
+        FILE* fp = fopen(path, "rb");
+        if (!fp) continue;
+
+        corpus_add(buf, fread(buf, 1, cfg->max_len, fp));
+        fclose(fp);
+    }
+
+    closedir(dir);
+}
+
+/*
+ * =============================================
+ * EXECUTION
+ * =============================================
+ */
+
+/**
+ * run_input: restores the machine and runs the target on an input
+ * @param cfg The fuzzer configuration
+ * @param data The input
+ * @param len The input length
+ * @return how the run ended
+ * */
+static enum run_result run_input(struct fuzz_config* cfg, const uint8_t* data,
+                                 uint16_t len) {
+    snapshot_restore_dirty(&base);
+
+    for (uint16_t i = 0; i < len; i++) {
+        uint16_t addr = cfg->input_addr + i;
+        mem_write_map[addr >> 8][addr & 0xFF] = data[i];
+        mem_dirty[addr >> 8] = 1;
+    }
+    // little-endian, inputs can be longer than 255 bytes
+    for (uint8_t i = 0; i < 2 && cfg->len_addr >= 0; i++) {
+        uint16_t addr = cfg->len_addr + i;
+        mem_write_map[addr >> 8][addr & 0xFF] = len >> (i * 8);
+        mem_dirty[addr >> 8] = 1;
+    }
+
+    memset(coverage, 0, sizeof(coverage));
+    inst_cover_reset();
+
+    if (cpu.pc == cfg->stop_addr) return RUN_OK;
+
+    uint8_t stop = CPU_STOP_BRK | CPU_STOP_ILLEGAL | (cfg->stop_addr >= 0 ? CPU_STOP_BREAKPOINT : 0);
+
+    switch (cpu_run(cfg->max_cycles, stop, NULL)) {
+        case CPU_STOP_ILLEGAL:
+            return RUN_CRASH;
+        case CPU_STOP_BUDGET:
+            return RUN_HANG;
+        default:
+            return RUN_OK;
+    }
+}
+
+/**
+ * mutate: havoc stage, stacks a few random mutations on a corpus entry
+ * @param cfg The fuzzer configuration
+ * @param out Where to write the new input (FUZZ_MAX_LEN bytes)
+ * @return the new input length
+ * */
+static uint16_t mutate(struct fuzz_config* cfg, uint8_t* out) {
+    static const uint8_t interesting[] = {0x00, 0x01, 0x0A, 0x0D, 0x10, 0x20,
+                                          0x30, 0x39, 0x40, 0x7F, 0x80, 0xFF};
+
+    struct corpus_entry* parent = &corpus[rnd_below(corpus_len)];
+    uint16_t len = parent->len;
+    memcpy(out, parent->data, len);
+
+    uint32_t stack = 1 << (1 + rnd_below(5));
+
+    for (uint32_t i = 0; i < stack; i++) {
+        uint16_t pos = rnd_below(len);
+
+        switch (rnd_below(len ? 9 : 1)) {
+            case 0: {
+                // grow with random bytes
+                uint16_t n = 1 + rnd_below(8);
+                if (len + n > cfg->max_len) n = cfg->max_len - len;
+
+                pos = rnd_below(len + 1);
+                memmove(out + pos + n, out + pos, len - pos);
+                for (uint16_t j = 0; j < n; j++) out[pos + j] = rnd();
+                len += n;
+                break;
+            }
+            case 1:
+                out[pos] ^= 1 << rnd_below(8);
+                break;
+            case 2:
+                out[pos] = interesting[rnd_below(sizeof(interesting))];
+                break;
+            case 3:
+                out[pos] = rnd();
+                break;
+            case 4:
+                out[pos] += 1 + rnd_below(16);
+                break;
+            case 5:
+                out[pos] -= 1 + rnd_below(16);
+                break;
+            case 6: {
+                // delete a block
+                uint16_t n = 1 + rnd_below(len - pos);
+                memmove(out + pos, out + pos + n, len - pos - n);
+                len -= n;
+                break;
+            }
+            case 7: {
+                // copy a block over another place
+                uint16_t from = rnd_below(len);
+                uint16_t n = 1 + rnd_below(len - (from > pos ? from : pos));
+                memmove(out + pos, out + from, n);
+                break;
+            }
+            case 8: {
+                // splice: keep our head and append the tail of another entry
+                struct corpus_entry* other = &corpus[rnd_below(corpus_len)];
+                uint16_t from = rnd_below(other->len);
+                uint16_t n = other->len - from;
+
+                if (pos + n > cfg->max_len) n = cfg->max_len - pos;
+                memcpy(out + pos, other->data + from, n);
+                len = pos + n;
+                break;
+            }
+        }
+    }
+
+    return len;
+}
+
+/**
+ * fuzz_default_config: Fill a configuration with the defaults
+ * @param cfg The configuration
+ * @return void
+ * */
+void fuzz_default_config(struct fuzz_config* cfg) {
+    cfg->entry = -1;
+    cfg->input_addr = 0x0200;
+    cfg->len_addr = -1;
+    cfg->stop_addr = -1;
+    cfg->max_len = 256;
+    cfg->max_cycles = 1000000;
+    cfg->iterations = 0;
+    cfg->seed = 0;
+    cfg->corpus_dir = NULL;
+    cfg->crash_dir = NULL;
+}
+
+/**
+ * fuzz_run: Fuzz the loaded program, the cpu must be initialized and reset
+ * @param cfg The configuration
+ * @return 0 if no crash was found, 1 otherwise
+ * */
+int fuzz_run(struct fuzz_config* cfg) {
+    uint8_t input[FUZZ_MAX_LEN];
+    uint64_t execs = 0, crashes = 0, hangs = 0;
+
+    if (cfg->max_len == 0 || cfg->max_len > FUZZ_MAX_LEN) cfg->max_len = FUZZ_MAX_LEN;
+    rng_state = cfg->seed ? cfg->seed : (uint64_t)time(NULL) | 1;
+
+    // nothing is kept from a previous campaign
+    while (corpus_len) free(corpus[--corpus_len].data);
+    memset(virgin, 0, sizeof(virgin));
+    memset(virgin_crash, 0, sizeof(virgin_crash));
+
+    if (cfg->crash_dir) mkdir(cfg->crash_dir, 0755);
+
+    // get through the initialization of the target only once
+    if (cfg->entry >= 0) {
+        if (cpu.pc != cfg->entry) {
+            uint8_t had = cpu_set_breakpoint(cfg->entry, 1);
+            cpu_run(cfg->max_cycles, CPU_STOP_BREAKPOINT, NULL);
+            cpu_set_breakpoint(cfg->entry, had);
+        }
+
+        if (cpu.pc != cfg->entry) {
+            fprintf(stderr, "[x] FUZZ -> entry $%04X never reached\n", cfg->entry);
+            return 1;
+        }
+    }
+    snapshot_save(&base);
+    inst_coverage = coverage;
+
+    // runs end on the stop address, put back as it was when done
+    uint8_t had_stop = cfg->stop_addr >= 0 && cpu_set_breakpoint(cfg->stop_addr, 1);
+
+    load_seeds(cfg);
+    if (corpus_len == 0) {
+        memset(input, 0, 4);
+        corpus_add(input, 4);
+    }
+
+    // run the seeds first so their coverage isn't reported as new
+    for (uint32_t i = 0; i < corpus_len; i++) {
+        run_input(cfg, corpus[i].data, corpus[i].len);
+        merge_coverage(virgin);
+    }
+
+    double start = now_seconds(), last_report = start;
+
+    while (cfg->iterations == 0 || execs < cfg->iterations) {
+        uint16_t len = mutate(cfg, input);
+        enum run_result res = run_input(cfg, input, len);
+        execs++;
+
+        if (res == RUN_OK) {
+            if (merge_coverage(virgin)) {
+                save_input(cfg->corpus_dir, "id_", corpus_len, input, len);
+                corpus_add(input, len);
+            }
+        } else if (merge_coverage(virgin_crash)) {
+            if (res == RUN_CRASH) {
+                save_input(cfg->crash_dir, "crash_", crashes++, input, len);
+            } else {
+                save_input(cfg->crash_dir, "hang_", hangs++, input, len);
+            }
+        }
+
+        if ((execs & 0x3FF) == 0) {
+            double t = now_seconds();
+            if (t - last_report >= 1.0) {
+                fprintf(stderr,
+                        "[fuzz] execs: %llu (%.0f/s) corpus: %u edges: %u "
+                        "crashes: %llu hangs: %llu\n",
+                        (unsigned long long)execs, execs / (t - start), corpus_len,
+                        count_edges(), (unsigned long long)crashes,
+                        (unsigned long long)hangs);
+                last_report = t;
+            }
+        }
+    }
+
+    double t = now_seconds();
+    fprintf(stderr,
+            "[fuzz] done -> execs: %llu (%.0f/s) corpus: %u edges: %u "
+            "crashes: %llu hangs: %llu\n",
+            (unsigned long long)execs, execs / (t - start + 1e-9), corpus_len,
+            count_edges(), (unsigned long long)crashes, (unsigned long long)hangs);
+
+    inst_coverage = NULL;
+    if (cfg->stop_addr >= 0) cpu_set_breakpoint(cfg->stop_addr, had_stop);
+    return crashes != 0;
+}
@@ -0,0 +1,31 @@
+#ifndef INC_6502_FUZZ_H
+#define INC_6502_FUZZ_H
+
+#include <stdint.h>
+
+// largest input the fuzzer generates
+#define FUZZ_MAX_LEN 0x1000
+
+// most inputs kept in the in-memory corpus
+#define FUZZ_MAX_CORPUS 4096
+
+/*
+ * Addresses set to -1 are disabled.
+ * */
+struct fuzz_config {
+    int32_t entry;          // run until this pc before taking the snapshot
+    int32_t input_addr;     // where every input is placed
+    int32_t len_addr;       // 2 bytes receiving the input length, little-endian
+    int32_t stop_addr;      // a run ends when the pc gets here (or on BRK)
+    uint16_t max_len;       // largest input, at most FUZZ_MAX_LEN
+    uint64_t max_cycles;    // a run taking longer is a hang
+    uint64_t iterations;    // runs before quitting, 0 means forever
+    uint64_t seed;
+    char* corpus_dir;       // seeds are read from here, new inputs saved here
+    char* crash_dir;        // inputs that crash or hang the target
+};
+
+void fuzz_default_config(struct fuzz_config* cfg);
+int fuzz_run(struct fuzz_config* cfg);
+
+#endif
@@ -0,0 +1,421 @@
+#include "emu6502.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../cpu/cpu.h"
+#include "../cpu/instructions.h"
+#include "../mem/mem.h"
+#include "../mem/snapshot.h"
+
+/**
+ * Library front of the core:
+ *
+ * The core keeps the running machine in globals (cpu, cpu_clock, the active
+ * memory...), a handle parks its machine in a cpu_context and gets swapped in
+ * by activate() before the core touches it. Switching is a handful of stores
+ * plus the table of dirty pages, and only happens when the caller alternates
+ * between handles.
+ * */
+struct emu6502 {
+    struct cpu_context ctx;
+    struct mem mem;
+
+    // pages written since the last snapshot, in mem_dirty while active
+    uint8_t dirty[0x100];
+};
+
+/*
+ * Either a full copy or a packed one, the other pointer is NULL.
+ * */
+struct emu6502_snapshot {
+    struct snapshot_packed* packed;
+    struct snapshot* full;
+};
+
+// handle whose machine is currently loaded in the core
+static emu6502* active = NULL;
+
+static uint8_t core_ready = 0;
+
+/**
+ * activate: loads the machine of a handle in the core
+ * @param emu The handle
+ * @return void
+ * */
+static void activate(emu6502* emu) {
+    if (active == emu) return;
+
+    if (active) {
+        cpu_save_context(&active->ctx);
+        memcpy(active->dirty, mem_dirty, sizeof(mem_dirty));
+    }
+    cpu_load_context(&emu->ctx);
+    memcpy(mem_dirty, emu->dirty, sizeof(mem_dirty));
+    active = emu;
+}
+
+/**
+ * init_core: initialises the core the first time it's needed
+ * @param void
+ * @return void
+ * */
+static void init_core(void) {
+    if (core_ready) return;
+
+    cpu_init();
+    core_ready = 1;
+}
+
+/**
+ * emu6502_create: Allocate a new machine, reset and with zeroed memory
+ * @param void
+ * @return the handle, NULL if out of memory
+ * */
+emu6502* emu6502_create(void) {
+    emu6502* emu = calloc(1, sizeof(*emu));
+    if (!emu) return NULL;
+
+    init_core();
+
+    // reset vector to the default ROM location, like mem_init() does
+    emu->mem.last_six[4] = ROM & 0xFF;
+    emu->mem.last_six[5] = ROM >> 8;
+
+    emu->ctx.mem = &emu->mem;
+    emu6502_reset(emu);
+
+    return emu;
+}
+
+/**
+ * emu6502_destroy: Free a machine
+ * @param emu The handle
+ * @return void
+ * */
+void emu6502_destroy(emu6502* emu) {
+    if (!emu) return;
+
+    if (active == emu) {
+        // leave the core on the default memory, not on freed one
+        struct cpu_context idle = emu->ctx;
+        idle.mem = NULL;
+        cpu_load_context(&idle);
+        active = NULL;
+    }
+
+    free(emu);
+}
+
+/**
+ * emu6502_load_mem: Copy a buffer in memory (wrapping at 0xFFFF)
+ * @param emu The handle
+ * @param data The bytes to copy
+ * @param len The number of bytes, at most 64K
+ * @param addr Where to copy them
+ * @return 0 if success, 1 if the buffer doesn't fit
+ * */
+int emu6502_load_mem(emu6502* emu, const uint8_t* data, size_t len, uint16_t addr) {
+    if (len > TOTAL_MEM) return 1;
+
+    emu6502_write_block(emu, addr, data, len);
+    return 0;
+}
+
+/**
+ * emu6502_load: Copy a binary file in memory
+ * @param emu The handle
+ * @param path The file
+ * @param addr Where to copy it, usually ROM (0x8000)
+ * @return 0 if success, 1 if the file can't be read or doesn't fit
+ * */
+int emu6502_load(emu6502* emu, const char* path, uint16_t addr) {
+    static uint8_t buf[TOTAL_MEM + 1];
+
+    FILE* fp = fopen(path, "rb");
+    if (!fp) return 1;
+
+    size_t len = fread(buf, 1, sizeof(buf), fp);
+    fclose(fp);
+
+    return emu6502_load_mem(emu, buf, len, addr);
+}
+
+/**
+ * emu6502_reset: Reset the cpu, memory is left untouched
+ * @param emu The handle
+ * @return void
+ * */
+void emu6502_reset(emu6502* emu) {
+    activate(emu);
+    cpu_reset();
+}
+
+/**
+ * emu6502_set_cpu: Select the cpu variant, of every handle: the core has a
+ *                  single instruction table
+ * @param name "nmos", "nmos-illegal" or "65c02"
+ * @return 0 if success, 1 if the variant is unknown
+ * */
+int emu6502_set_cpu(const char* name) {
+    int variant = inst_variant_id(name);
+
+    if (variant < 0) return 1;
+
+    init_core();
+    return inst_select(variant);
+}
+
+/**
+ * emu6502_step: Execute a single instruction
+ * @param emu The handle
+ * @return the cycles it took
+ * */
+uint32_t emu6502_step(emu6502* emu) {
+    activate(emu);
+
+    uint64_t ran;
+    cpu_run(1, 0, &ran);
+
+    return ran;
+}
+
+/**
+ * emu6502_run_cycles: Execute instructions until a cycle budget is used up,
+ *                     the last instruction may go past it
+ * @param emu The handle
+ * @param budget The cycles to run
+ * @return the cycles actually run
+ * */
+uint64_t emu6502_run_cycles(emu6502* emu, uint64_t budget) {
+    activate(emu);
+
+    uint64_t ran;
+    cpu_run(budget, 0, &ran);
+
+    return ran;
+}
+
+/**
+ * run_to_pc: emu6502_run_until() without a condition, runs in cpu_run() with
+ *            a temporary breakpoint. Breakpoints set by others don't stop it,
+ *            and one already on the address stays.
+ * @param pc The address to stop at, -1 for none
+ * @param budget Cycles after which to give up, 0 for no limit
+ * @return 1 if it stopped on the address, 0 on the budget
+ * */
+static int run_to_pc(int32_t pc, uint64_t budget) {
+    if (cpu.pc == pc) return 1;
+    if (budget == 0) budget = UINT64_MAX;
+    if (pc < 0) {
+        cpu_run(budget, 0, NULL);
+        return 0;
+    }
+
+    uint64_t start = cpu_clock;
+    uint8_t was = cpu_set_breakpoint(pc, 1);
+
+    while (cpu.pc != pc && cpu_clock - start < budget) {
+        if (cpu_run(budget - (cpu_clock - start), CPU_STOP_BREAKPOINT, NULL) != CPU_STOP_BREAKPOINT) {
+            break;
+        }
+    }
+    cpu_set_breakpoint(pc, was);
+
+    return cpu.pc == pc;
+}
+
+/**
+ * emu6502_run_until: Execute instructions until the pc reaches an address or
+ *                    a condition holds, both checked before every instruction
+ * @param emu The handle
+ * @param pc The address to stop at, -1 to only use the condition
+ * @param cond The condition, NULL to only use the address
+ * @param ctx Opaque pointer given to the condition
+ * @param budget Cycles after which to give up, 0 for no limit
+ * @return 1 if it stopped on the address or the condition, 0 on the budget
+ * */
+int emu6502_run_until(emu6502* emu, int32_t pc, emu6502_cond cond, void* ctx,
+                      uint64_t budget) {
+    activate(emu);
+
+    if (!cond) return run_to_pc(pc, budget);
+
+    uint64_t start = cpu_clock;
+
+    while (budget == 0 || cpu_clock - start < budget) {
+        if (cpu.pc == pc) return 1;
+        if (cond && cond(emu, ctx)) return 1;
+
+        // the condition might have switched to another handle
+        activate(emu);
+        cpu_exec();
+    }
+
+    return 0;
+}
+
+void emu6502_get_regs(emu6502* emu, struct emu6502_regs* regs) {
+    activate(emu);
+
+    regs->pc = cpu.pc;
+    regs->sp = cpu.sp;
+    regs->a = cpu.ac;
+    regs->x = cpu.x;
+    regs->y = cpu.y;
+    regs->sr = cpu.sr;
+}
+
+void emu6502_set_regs(emu6502* emu, const struct emu6502_regs* regs) {
+    activate(emu);
+
+    cpu.pc = regs->pc;
+    cpu.sp = regs->sp;
+    cpu.ac = regs->a;
+    cpu.x = regs->x;
+    cpu.y = regs->y;
+    cpu.sr = regs->sr;
+}
+
+uint64_t emu6502_clock(emu6502* emu) {
+    activate(emu);
+    return cpu_clock;
+}
+
+/*
+ * Memory accessors work on the memory the cpu sees (banks included) but not
+ * through devices: no side effects.
+ * */
+
+uint8_t emu6502_read(emu6502* emu, uint16_t addr) {
+    activate(emu);
+    return mem_page(addr >> 8)[addr & 0xFF];
+}
+
+void emu6502_write(emu6502* emu, uint16_t addr, uint8_t data) {
+    emu6502_write_block(emu, addr, &data, 1);
+}
+
+void emu6502_read_block(emu6502* emu, uint16_t addr, uint8_t* out, size_t len) {
+    activate(emu);
+
+    for (size_t i = 0; i < len; i++) {
+        uint16_t a = addr + i;
+        out[i] = mem_page(a >> 8)[a & 0xFF];
+    }
+}
+
+void emu6502_write_block(emu6502* emu, uint16_t addr, const uint8_t* data, size_t len) {
+    activate(emu);
+
+    for (size_t i = 0; i < len; i++) {
+        uint16_t a = addr + i;
+        mem_write_map[a >> 8][a & 0xFF] = data[i];
+        mem_dirty[a >> 8] = 1;
+    }
+
+    cpu_forget();
+}
+
+/**
+ * emu6502_irq: Drive the external IRQ line
+ * @param emu The handle
+ * @param level non-zero to assert the line, 0 to release it
+ * @return void
+ * */
+void emu6502_irq(emu6502* emu, int level) {
+    activate(emu);
+
+    if (level) {
+        cpu_irq_assert(IRQ_SRC_EXTERNAL);
+    } else {
+        cpu_irq_release(IRQ_SRC_EXTERNAL);
+    }
+}
+
+void emu6502_nmi(emu6502* emu) {
+    activate(emu);
+    cpu_nmi();
+}
+
+/**
+ * emu6502_snapshot_save: Copy registers, clock and memory of a machine
+ * @param emu The handle
+ * @return the snapshot, NULL if out of memory
+ * */
+emu6502_snapshot* emu6502_snapshot_save(emu6502* emu) {
+    emu6502_snapshot* snap = malloc(sizeof(*snap));
+    if (!snap) return NULL;
+
+    snap->packed = NULL;
+    snap->full = malloc(sizeof(*snap->full));
+    if (!snap->full) {
+        free(snap);
+        return NULL;
+    }
+
+    activate(emu);
+    snapshot_save(snap->full);
+
+    return snap;
+}
+
+/**
+ * emu6502_snapshot_pack: Compressed snapshot of a machine, an order of
+ *                        magnitude smaller than a full one for most programs
+ * @param emu The handle
+ * @param base A full snapshot the pages unchanged since are shared with, it
+ *             must be freed after this one. NULL for none
+ * @return the snapshot, NULL if out of memory or base is packed too
+ * */
+emu6502_snapshot* emu6502_snapshot_pack(emu6502* emu, const emu6502_snapshot* base) {
+    if (base && base->packed) return NULL;
+
+    emu6502_snapshot* snap = malloc(sizeof(*snap));
+    if (!snap) return NULL;
+
+    activate(emu);
+    snap->full = NULL;
+    snap->packed = snapshot_pack(base ? base->full : NULL);
+    if (!snap->packed) {
+        free(snap);
+        return NULL;
+    }
+
+    return snap;
+}
+
+/**
+ * emu6502_snapshot_size: Memory taken by a snapshot, in bytes
+ * */
+size_t emu6502_snapshot_size(const emu6502_snapshot* snap) {
+    if (snap->packed) return sizeof(*snap) + snapshot_packed_size(snap->packed);
+    return sizeof(*snap) + sizeof(*snap->full);
+}
+
+/**
+ * emu6502_snapshot_restore: Bring a machine back to a snapshot, it doesn't
+ *                           have to be the machine the snapshot comes from
+ * @param emu The handle
+ * @param snap The snapshot
+ * @return void
+ * */
+void emu6502_snapshot_restore(emu6502* emu, const emu6502_snapshot* snap) {
+    activate(emu);
+
+    if (snap->packed) {
+        snapshot_unpack(snap->packed);
+    } else {
+        snapshot_restore(snap->full);
+    }
+}
+
+void emu6502_snapshot_free(emu6502_snapshot* snap) {
+    if (snap) {
+        free(snap->packed);
+        free(snap->full);
+    }
+    free(snap);
+}
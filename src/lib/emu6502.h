@@ -0,0 +1,80 @@
+#ifndef INC_6502_EMU6502_H
+#define INC_6502_EMU6502_H
+
+/*
+ * libemu6502: embeddable 6502 core (cpu, memory and instructions).
+ *
+ * Every emulator is an opaque handle owning its registers, clock and 64K of
+ * memory. Handles can coexist, the core runs one at a time and swaps them in
+ * when they're used. Unless stated otherwise functions return 0 on success
+ * and 1 on failure.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The core is built with hidden symbols, only what's marked EMU6502_API is
+ * exported by libemu6502.so (its globals have names like cpu or memory).
+ * */
+#if defined(__GNUC__)
+#define EMU6502_API __attribute__((visibility("default")))
+#else
+#define EMU6502_API
+#endif
+
+typedef struct emu6502 emu6502;
+typedef struct emu6502_snapshot emu6502_snapshot;
+
+struct emu6502_regs {
+    uint16_t pc;
+    uint8_t sp;
+    uint8_t a;
+    uint8_t x;
+    uint8_t y;
+    uint8_t sr;
+};
+
+// stop condition for emu6502_run_until(), returns non-zero to stop
+typedef int (*emu6502_cond)(emu6502* emu, void* ctx);
+
+EMU6502_API emu6502* emu6502_create(void);
+EMU6502_API void emu6502_destroy(emu6502* emu);
+
+EMU6502_API int emu6502_load(emu6502* emu, const char* path, uint16_t addr);
+EMU6502_API int emu6502_load_mem(emu6502* emu, const uint8_t* data, size_t len, uint16_t addr);
+EMU6502_API void emu6502_reset(emu6502* emu);
+EMU6502_API int emu6502_set_cpu(const char* name);
+
+EMU6502_API uint32_t emu6502_step(emu6502* emu);
+EMU6502_API uint64_t emu6502_run_cycles(emu6502* emu, uint64_t budget);
+EMU6502_API int emu6502_run_until(emu6502* emu, int32_t pc, emu6502_cond cond, void* ctx,
+                                  uint64_t budget);
+
+EMU6502_API void emu6502_get_regs(emu6502* emu, struct emu6502_regs* regs);
+EMU6502_API void emu6502_set_regs(emu6502* emu, const struct emu6502_regs* regs);
+EMU6502_API uint64_t emu6502_clock(emu6502* emu);
+
+EMU6502_API uint8_t emu6502_read(emu6502* emu, uint16_t addr);
+EMU6502_API void emu6502_write(emu6502* emu, uint16_t addr, uint8_t data);
+EMU6502_API void emu6502_read_block(emu6502* emu, uint16_t addr, uint8_t* out, size_t len);
+EMU6502_API void emu6502_write_block(emu6502* emu, uint16_t addr, const uint8_t* data, size_t len);
+
+EMU6502_API void emu6502_irq(emu6502* emu, int level);
+EMU6502_API void emu6502_nmi(emu6502* emu);
+
+EMU6502_API emu6502_snapshot* emu6502_snapshot_save(emu6502* emu);
+EMU6502_API emu6502_snapshot* emu6502_snapshot_pack(emu6502* emu, const emu6502_snapshot* base);
+EMU6502_API size_t emu6502_snapshot_size(const emu6502_snapshot* snap);
+EMU6502_API void emu6502_snapshot_restore(emu6502* emu, const emu6502_snapshot* snap);
+EMU6502_API void emu6502_snapshot_free(emu6502_snapshot* snap);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
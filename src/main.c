@@ -1,3 +1,4 @@
+#include <locale.h>
 #include <ncurses.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -5,35 +6,293 @@
 #include <stdio.h>
 
 #include "cpu/cpu.h"
+#include "cpu/instructions.h"
+#include "cpu/multi.h"
+#include "debug/debug.h"
+#include "fuzz/fuzz.h"
 #include "mem/mem.h"
+#include "mem/shm.h"
+#include "perf/perf.h"
+#include "peripherals/display.h"
 #include "peripherals/interface.h"
+#include "peripherals/keyboard.h"
 #include "peripherals/kinput.h"
+#include "peripherals/mapper.h"
+#include "peripherals/uart.h"
+#include "peripherals/via.h"
+#include "reload/reload.h"
+#include "replay/replay.h"
 
 #define AUTO_MODE		1
 #define MANUAL_MODE		2
 
-uint8_t DEBUG = 0;
 // 6502 PROGRAMS EXECUTION MODES
 // 1 -> automatic exec (no key listening) 
 // (X or 2) -> default mode (manual) (need press ENTER to go to next instruction) (key listening)
 uint8_t MODE = MANUAL_MODE; 
-// 6502 DISPLAYS (coming soon)
-// 	1 -> display (32x32) pixels
-//uint8_t DISPLAY	= 1; 
+// 6502 DISPLAYS
+// 	1 -> display (32x32) pixels, see display.h
+uint8_t DISPLAY	= 0;
+
+// with the display on, auto mode runs flat out and redraws at this rate
+#define FRAME_TIME		(1.0 / 60)
+#define RUN_SLICE		10000
 
 
 int main(int argc, char **argv) {
 
-	mem_init(argv[1]); // first program argument always will be the binary program
+	uint8_t fuzz = 0;
+	struct fuzz_config fuzz_cfg;
+	fuzz_default_config(&fuzz_cfg);
+
+	// set to the socket path by --debug-socket
+	char *debug_socket = NULL;
+
+	// set to the region name by --shm-export
+	char *shm_name = NULL;
+
+	uint16_t display_base = DISPLAY_BASE;
+
+	// keys go to the program through a keyboard register, see --keyboard
+	uint8_t keyboard = 0;
+	uint16_t keyboard_base = KEYBOARD_BASE;
+
+	// serial console, see --uart
+	uint8_t uart = 0;
+	uint16_t uart_base = UART_BASE;
+	char *uart_out = NULL, *uart_in = NULL;
+
+	// runs the program without the interface, see --headless
+	uint8_t headless = 0;
+
+	// banked ROM and RAM, see --rom-banks and --ram-banks
+	uint8_t mapper = 0;
+	struct mapper_config mapper_cfg;
+	mapper_default_config(&mapper_cfg);
+
+	// co-processors sharing the bus, see --coprocessor
+	uint16_t coprocessors[MULTI_MAX_CPUS];
+	uint8_t coprocessor_count = 0;
+	uint64_t sync_cycles = MULTI_QUANTUM;
+
+	// input log written by --record, read by --replay
+	char *record = NULL, *replay = NULL;
+
+	// program reloaded when it's rebuilt, see --reload
+	uint8_t reload = 0;
+	struct reload_config reload_cfg;
+	reload_default_config(&reload_cfg);
+	reload_cfg.path = argc > 1 ? argv[1] : NULL;
+
+	uint8_t perf = 0;
+	struct perf_config perf_cfg;
+	perf_default_config(&perf_cfg);
+
+	mem_init(argc > 1 ? argv[1] : ""); // first program argument always will be the binary program
     cpu_init();
-    cpu_reset();
 
 	// program arguments settings
 	for (int i = 1; i < argc; i++) {
+	  // options taking a value
+	  char *val = (i + 1 < argc) ? argv[i + 1] : NULL;
+
 	  if (strcmp(argv[i], "--auto-exec") == 0) {
 		MODE = 1; // enable auto program exec
+	  } else if (strcmp(argv[i], "--fuzz") == 0) {
+		fuzz = 1;
+	  } else if (val && strcmp(argv[i], "--fuzz-entry") == 0) {
+		fuzz_cfg.entry = strtoul(argv[++i], NULL, 0);
+	  } else if (val && strcmp(argv[i], "--fuzz-addr") == 0) {
+		fuzz_cfg.input_addr = strtoul(argv[++i], NULL, 0);
+	  } else if (val && strcmp(argv[i], "--fuzz-len-addr") == 0) {
+		fuzz_cfg.len_addr = strtoul(argv[++i], NULL, 0);
+	  } else if (val && strcmp(argv[i], "--fuzz-stop") == 0) {
+		fuzz_cfg.stop_addr = strtoul(argv[++i], NULL, 0);
+	  } else if (val && strcmp(argv[i], "--fuzz-max-len") == 0) {
+		fuzz_cfg.max_len = strtoul(argv[++i], NULL, 0);
+	  } else if (val && strcmp(argv[i], "--fuzz-cycles") == 0) {
+		fuzz_cfg.max_cycles = strtoull(argv[++i], NULL, 0);
+	  } else if (val && strcmp(argv[i], "--fuzz-iters") == 0) {
+		fuzz_cfg.iterations = strtoull(argv[++i], NULL, 0);
+	  } else if (val && strcmp(argv[i], "--fuzz-seed") == 0) {
+		fuzz_cfg.seed = strtoull(argv[++i], NULL, 0);
+	  } else if (val && strcmp(argv[i], "--fuzz-corpus") == 0) {
+		fuzz_cfg.corpus_dir = argv[++i];
+	  } else if (val && strcmp(argv[i], "--fuzz-crashes") == 0) {
+		fuzz_cfg.crash_dir = argv[++i];
+	  } else if (val && strcmp(argv[i], "--debug-socket") == 0) {
+		debug_socket = argv[++i];
+	  } else if (val && strcmp(argv[i], "--shm-export") == 0) {
+		shm_name = argv[++i];
+	  } else if (strcmp(argv[i], "--display") == 0) {
+		DISPLAY = 1;
+	  } else if (val && strcmp(argv[i], "--display-base") == 0) {
+		DISPLAY = 1;
+		display_base = strtoul(argv[++i], NULL, 0);
+	  } else if (strcmp(argv[i], "--keyboard") == 0) {
+		keyboard = 1;
+	  } else if (val && strcmp(argv[i], "--keyboard-base") == 0) {
+		keyboard = 1;
+		keyboard_base = strtoul(argv[++i], NULL, 0);
+	  } else if (strcmp(argv[i], "--uart") == 0) {
+		uart = 1;
+	  } else if (val && strcmp(argv[i], "--uart-base") == 0) {
+		uart = 1;
+		uart_base = strtoul(argv[++i], NULL, 0);
+	  } else if (val && strcmp(argv[i], "--uart-out") == 0) {
+		uart = 1;
+		uart_out = argv[++i];
+	  } else if (val && strcmp(argv[i], "--uart-in") == 0) {
+		uart = 1;
+		uart_in = argv[++i];
+	  } else if (strcmp(argv[i], "--headless") == 0) {
+		headless = 1;
+	  } else if (val && strcmp(argv[i], "--rom-banks") == 0) {
+		mapper = 1;
+		mapper_cfg.rom = argv[++i];
+	  } else if (val && strcmp(argv[i], "--rom-bank-size") == 0) {
+		mapper_cfg.rom_bank_size = strtoul(argv[++i], NULL, 0);
+	  } else if (val && strcmp(argv[i], "--ram-banks") == 0) {
+		mapper = 1;
+		mapper_cfg.ram_banks = strtoul(argv[++i], NULL, 0);
+	  } else if (val && strcmp(argv[i], "--ram-bank-size") == 0) {
+		mapper_cfg.ram_bank_size = strtoul(argv[++i], NULL, 0);
+	  } else if (val && strcmp(argv[i], "--ram-window") == 0) {
+		mapper_cfg.ram_window = strtoul(argv[++i], NULL, 0);
+	  } else if (val && strcmp(argv[i], "--mapper-base") == 0) {
+		mapper_cfg.base = strtoul(argv[++i], NULL, 0);
+	  } else if (val && strcmp(argv[i], "--coprocessor") == 0) {
+		if (coprocessor_count == MULTI_MAX_CPUS - 1) {
+		  fprintf(stderr, "At most %d co-processors...\n", MULTI_MAX_CPUS - 1);
+		  exit(EXIT_FAILURE);
+		}
+		coprocessors[coprocessor_count++] = strtoul(argv[++i], NULL, 0);
+	  } else if (val && strcmp(argv[i], "--sync-cycles") == 0) {
+		sync_cycles = strtoull(argv[++i], NULL, 0);
+	  } else if (val && strcmp(argv[i], "--cpu") == 0) {
+		int variant = inst_variant_id(argv[++i]);
+		if (variant < 0) {
+		  fprintf(stderr, "Unknown cpu \"%s\", use nmos, nmos-illegal or 65c02\n", argv[i]);
+		  exit(EXIT_FAILURE);
+		}
+		inst_select(variant);
+	  } else if (val && strcmp(argv[i], "--record") == 0) {
+		record = argv[++i];
+	  } else if (val && strcmp(argv[i], "--replay") == 0) {
+		replay = argv[++i];
+	  } else if (strcmp(argv[i], "--reload") == 0) {
+		reload = 1;
+	  } else if (strcmp(argv[i], "--reload-reset") == 0) {
+		reload = 1;
+		reload_cfg.reset = 1;
+	  } else if (strcmp(argv[i], "--perf-counters") == 0) {
+		perf = 1;
+	  } else if (val && strcmp(argv[i], "--perf-cycles") == 0) {
+		perf_cfg.max_cycles = strtoull(argv[++i], NULL, 0);
+	  }
+	}
+
+	// fuzzing runs headless and without peripherals
+	if (fuzz) {
+	  cpu_reset();
+	  return fuzz_run(&fuzz_cfg);
+	}
+
+	// so does profiling, both passes must execute the same instructions
+	if (perf) {
+	  cpu_reset();
+	  return perf_run(&perf_cfg);
+	}
+
+	// the export is the 64K image, the banks would be missing from it
+	if (shm_name && mapper) {
+	  fprintf(stderr, "--shm-export can't be used with banked memory...\n");
+	  exit(EXIT_FAILURE);
+	}
+
+	// a reload changes the machine behind the log's back, and the ROM window
+	// of a banked image isn't the program
+	if (reload && (record || replay || mapper_cfg.rom)) {
+	  fprintf(stderr, "--reload can't be used with --record, --replay or --rom-banks...\n");
+	  exit(EXIT_FAILURE);
+	}
+
+	// the debug server runs the program itself: it delivers no logged input,
+	// doesn't log what clients write and doesn't watch the program file
+	if (debug_socket && (record || replay || reload)) {
+	  fprintf(stderr, "--debug-socket can't be used with --record, --replay or --reload...\n");
+	  exit(EXIT_FAILURE);
+	}
+
+	// from here on the machine lives in the shared region
+	if (shm_name && shm_export(shm_name)) {
+	  exit(EXIT_FAILURE);
+	}
+	if (mapper && mapper_init(&mapper_cfg)) {
+	  exit(EXIT_FAILURE);
+	}
+
+    via_init(VIA_BASE);
+	if (DISPLAY) {
+	  display_init(display_base);
+	}
+	if (keyboard) {
+	  keyboard_init(keyboard_base);
+	}
+	if (uart) {
+	  // the terminal belongs to the interface, unless there is none
+	  if (!uart_out) uart_out = headless ? "-" : "uart.log";
+	  if (!uart_in && headless) uart_in = "-";
+
+	  if (uart_init(uart_base, uart_out, uart_in)) {
+		exit(EXIT_FAILURE);
 	  }
 	}
+    cpu_reset();
+
+	// on the bus of the main cpu, memory and devices included
+	multi_init(sync_cycles);
+	for (uint8_t c = 0; c < coprocessor_count; c++) {
+	  multi_add(coprocessors[c]);
+	}
+
+	// both start from the machine as it is now
+	if ((record && replay_record(record)) || (replay && replay_open(replay))) {
+	  exit(EXIT_FAILURE);
+	}
+
+	if (reload && reload_init(&reload_cfg)) {
+	  exit(EXIT_FAILURE);
+	}
+
+	// the debug server replaces the interface, clients drive the cpu
+	if (debug_socket) {
+	  return debug_serve(debug_socket);
+	}
+
+	// no interface at all: run until BRK or an idle loop nothing will wake up
+	// (an idle loop waiting on the console sleeps until its input comes), a
+	// replay runs until where the recording stopped
+	if (headless) {
+	  uint8_t reason = CPU_STOP_BUDGET;
+	  do {
+		replay_deliver();
+		if (replay_over()) {
+		  break;
+		}
+		reload_poll();
+		uart_poll();
+		reason = multi_run(replay_budget(RUN_SLICE * 100),
+						 replay_playing() ? 0 : CPU_STOP_BRK | CPU_STOP_IDLE, NULL);
+		uart_flush();
+	  } while (reason == CPU_STOP_BUDGET || (reason == CPU_STOP_IDLE && uart_wait()));
+
+	  mem_dump();
+	  return 0;
+	}
+
+	// the display draws with unicode half blocks
+	setlocale(LC_CTYPE, "");
 	
     WINDOW* win = newwin(WIN_ROWS, WIN_COLS, 0, 0);
     if ((win = initscr()) == NULL) {
@@ -56,14 +315,38 @@ int main(int argc, char **argv) {
 	init_pair(GREEN, COLOR_GREEN, COLOR_BLACK);
 	init_pair(BLUE, COLOR_BLUE, COLOR_BLACK);
 	init_pair(RED, COLOR_RED, COLOR_BLACK);
+	if (DISPLAY) {
+	  display_colors();
+	}
 
     curs_set(0);
     noecho();
+	cbreak();
+	typeahead(-1); // the input thread owns the terminal input
+
+	if (kinput_start()) {
+	  endwin();
+	  fprintf(stderr, "Can't start the input thread...\n");
+	  exit(EXIT_FAILURE);
+	}
     box(win, 0, 0);
     wrefresh(win);
 
+	// set when the program is stuck in an idle loop, see cpu_run()
+	uint8_t idle = 0;
+
 	// program loop
     while (1) {
+		double frame_start = interface_clock(), exec = 0;
+
+		// logged inputs due now (a reset while stopped...)
+		replay_deliver();
+
+		// a rebuilt program may get out of its idle loop
+		if (reload_poll()) {
+		  idle = 0;
+		}
+
 		// draw the app header
 		attron(COLOR_PAIR(HEADER_PAIR));
 		  FILL_ROW();
@@ -73,11 +356,17 @@ int main(int argc, char **argv) {
 		// interface
 		interface_display_cpu(3, 6);
 		interface_show_status(60, 6);
+		interface_show_stats(60, 12);
 		interface_show_zeropage(3, 8);
 		interface_show_ROM(3, 28);
         interface_show_stack(60, 28);
+		if (DISPLAY) {
+		  display_render(96, 6);
+		}
 		wrefresh(win);
 
+		double render = interface_clock() - frame_start;
+
 		if (MODE == AUTO_MODE) {
 		  // draw mode at top left
 		  attron(COLOR_PAIR(RED));
@@ -91,16 +380,47 @@ int main(int argc, char **argv) {
 			attroff(COLOR_PAIR(YELLOW));
 			// show help commands
 			interface_show_help(3, 4);
+			kinput_wait(FRAME_TIME);
+			kinput_listen();
+		  } else if (idle) {
+			// parked in a loop nothing will wake up, wait for a key
+			attron(COLOR_PAIR(YELLOW));
+			  mvprintw(2, 25, "[PROGRAM STATUS]: IDLE   ");
+			attroff(COLOR_PAIR(YELLOW));
+			interface_show_help(3, 4);
+			kinput_wait(FRAME_TIME);
+			if (kinput_listen() | uart_poll()) {
+			  idle = 0;
+			}
+		  } else if (kinput_paused()) {
+			attron(COLOR_PAIR(YELLOW));
+			  mvprintw(2, 25, "[PROGRAM STATUS]: PAUSED ");
+			attroff(COLOR_PAIR(YELLOW));
+			interface_show_help(3, 4);
+			kinput_wait(FRAME_TIME);
 			kinput_listen();
 		  } else { 
 			// show assembler program status
 			attron(COLOR_PAIR(GREEN));
 			  mvprintw(2, 25, "[PROGRAM STATUS]: RUNNING");
 			attroff(COLOR_PAIR(GREEN));
-			cpu_exec();
+			interface_show_help(3, 4);
+			exec = interface_clock();
+			// a replay wakes idle loops up itself
+			uint8_t stop_idle = replay_playing() ? 0 : CPU_STOP_IDLE;
+			// a frame's worth of instructions, stopping where the checks above would
+			uint8_t reason;
+			do {
+			  replay_deliver();
+			  uart_poll();
+			  reason = multi_run(replay_budget(RUN_SLICE), stop_idle | CPU_STOP_IFLAG, NULL);
+			} while (reason == CPU_STOP_BUDGET && interface_clock() - exec < FRAME_TIME);
+			idle = reason == CPU_STOP_IDLE;
+			exec = interface_clock() - exec;
+
+			// keys typed meanwhile, without ever waiting for one
+			kinput_listen();
 		  }
-		  
-		  usleep(1000); // 10000 microseconds
 		} else {
 		  // draw mode at top left
 		  attron(COLOR_PAIR(GREEN));
@@ -108,14 +428,20 @@ int main(int argc, char **argv) {
 		  attroff(COLOR_PAIR(GREEN));
 		  
 		  interface_show_help(3, 4);
+		  kinput_wait(FRAME_TIME);
 		  kinput_listen();
 		}
 
+		interface_stats_frame(exec, render);
+		uart_flush();
+
 		if (kinput_should_quit()) {
 		  break;
 		}
     }
 
+	kinput_stop();
+
     delwin(win);
     endwin();
 
@@ -0,0 +1,140 @@
+#include "lz.h"
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * Byte oriented LZ77, tuned for speed over ratio. The compressed stream is a
+ * sequence of:
+ *
+ *  - 0x00-0x7F: n + 1 literal bytes follow
+ *  - 0x80-0xFF: copy (c & 0x7F) + LZ_MIN_MATCH bytes from u16 offset back,
+ *               the copy may overlap what it produces (runs)
+ *
+ * A match costs 3 bytes, shorter ones wouldn't shrink anything (and would
+ * break the bound of lz.h). Matches are found with a single probe in a hash
+ * table of 4-byte sequences. The table lives on the stack of each call, so
+ * compressing is reentrant; it's sized after the block, small blocks (pages)
+ * only clear a few entries.
+ * */
+#define LZ_MIN_MATCH    4
+#define LZ_MAX_MATCH    (0x7F + LZ_MIN_MATCH)
+#define LZ_MAX_LITERALS 0x80
+#define LZ_MAX_OFFSET   0xFFFF
+
+// hash table of 1 << bits entries, bits going up with the block size
+#define LZ_HASH_MIN_BITS    8
+#define LZ_HASH_BITS        12
+
+static uint32_t hash(const uint8_t* p, uint32_t bits) {
+    uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    return (v * 2654435761u) >> (32 - bits);
+}
+
+/**
+ * put_literals: emits a literal run, split in chunks the format can encode
+ * @param src The literals
+ * @param n Their number
+ * @param dst The output
+ * @param out Position in the output, advanced
+ * @param cap The size of the output
+ * @return 0 if success, 1 if the output is full
+ * */
+static int put_literals(const uint8_t* src, uint32_t n, uint8_t* dst, uint32_t* out, uint32_t cap) {
+    while (n > 0) {
+        uint32_t chunk = n < LZ_MAX_LITERALS ? n : LZ_MAX_LITERALS;
+
+        if (*out + 1 + chunk > cap) return 1;
+
+        dst[(*out)++] = chunk - 1;
+        memcpy(dst + *out, src, chunk);
+        *out += chunk;
+        src += chunk;
+        n -= chunk;
+    }
+
+    return 0;
+}
+
+/**
+ * lz_compress: Compress a block
+ * @param src The block
+ * @param len Its size
+ * @param dst The output
+ * @param cap The size of the output, LZ_BOUND(len) is always enough
+ * @return the compressed size, 0 if it doesn't fit in cap
+ * */
+uint32_t lz_compress(const uint8_t* src, uint32_t len, uint8_t* dst, uint32_t cap) {
+    uint32_t table[1 << LZ_HASH_BITS];
+    uint32_t i = 0, literals = 0, out = 0, bits = LZ_HASH_MIN_BITS;
+
+    // about an entry per position, candidates start past every position
+    while (bits < LZ_HASH_BITS && (1u << bits) < len) bits++;
+    memset(table, 0xFF, sizeof(uint32_t) << bits);
+
+    while (i + LZ_MIN_MATCH <= len) {
+        uint32_t h = hash(src + i, bits);
+        uint32_t cand = table[h];
+        table[h] = i;
+
+        if (cand >= i || i - cand > LZ_MAX_OFFSET || memcmp(src + cand, src + i, LZ_MIN_MATCH)) {
+            i++;
+            continue;
+        }
+
+        uint32_t m = LZ_MIN_MATCH;
+        while (i + m < len && m < LZ_MAX_MATCH && src[cand + m] == src[i + m]) m++;
+
+        if (put_literals(src + literals, i - literals, dst, &out, cap)) return 0;
+        if (out + 3 > cap) return 0;
+
+        dst[out++] = 0x80 | (m - LZ_MIN_MATCH);
+        dst[out++] = (i - cand) & 0xFF;
+        dst[out++] = (i - cand) >> 8;
+
+        i += m;
+        literals = i;
+    }
+
+    if (put_literals(src + literals, len - literals, dst, &out, cap)) return 0;
+    return out;
+}
+
+/**
+ * lz_decompress: Decompress a block
+ * @param src The compressed block
+ * @param len Its size
+ * @param dst The output
+ * @param cap The size of the output
+ * @return the decompressed size, 0 if the block is corrupted or too large
+ * */
+uint32_t lz_decompress(const uint8_t* src, uint32_t len, uint8_t* dst, uint32_t cap) {
+    uint32_t in = 0, out = 0;
+
+    while (in < len) {
+        uint8_t c = src[in++];
+
+        if (c < 0x80) {
+            uint32_t n = c + 1;
+            if (in + n > len || out + n > cap) return 0;
+
+            memcpy(dst + out, src + in, n);
+            in += n;
+            out += n;
+            continue;
+        }
+
+        if (in + 2 > len) return 0;
+
+        uint32_t n = (c & 0x7F) + LZ_MIN_MATCH;
+        uint32_t offset = src[in] | (src[in + 1] << 8);
+        in += 2;
+
+        if (offset == 0 || offset > out || out + n > cap) return 0;
+
+        // byte by byte, a copy overlapping its own output repeats it
+        for (uint32_t j = 0; j < n; j++, out++) dst[out] = dst[out - offset];
+    }
+
+    return out;
+}
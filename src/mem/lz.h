@@ -0,0 +1,12 @@
+#ifndef INC_6502_LZ_H
+#define INC_6502_LZ_H
+
+#include <stdint.h>
+
+// worst case size of the compressed form of len bytes
+#define LZ_BOUND(len)   ((len) + ((len) + 127) / 128)
+
+uint32_t lz_compress(const uint8_t* src, uint32_t len, uint8_t* dst, uint32_t cap);
+uint32_t lz_decompress(const uint8_t* src, uint32_t len, uint8_t* dst, uint32_t cap);
+
+#endif
@@ -19,6 +19,21 @@
  * */
 struct mem memory;
 
+// memory currently attached to the cpu, see mem_attach()
+static struct mem* cur = &memory;
+
+// devices attached to the bus, see mem_map_io()
+struct mem_io* mem_io_map[0x100];
+
+// pages written since the last snapshot
+uint8_t mem_dirty[0x100];
+
+// where each page is read and written, and the banks selected, see mapper.c
+uint8_t* mem_read_map[0x100];
+uint8_t* mem_write_map[0x100];
+uint8_t mem_banks[MEM_BANK_REGS];
+void (*mem_select_banks)(const uint8_t* banks);
+
 
 char *to_binary(int n) {
   /* from: https://www.programmingsimplified.com/c/source-code/c-program-convert-decimal-to-binary */
@@ -52,13 +67,13 @@ static uint8_t write_mem(uint16_t addr, int8_t data) {
     // data type" if (!(addr >= 0x0000 && addr <= 0xFFFF)) return 1;
   
     if (addr <= ZERO_PAGE + 0xff) {
-        memory.zero_page[addr] = data;
+        cur->zero_page[addr] = data;
     } else if (addr >= SYS_STACK && addr <= SYS_STACK + 0xff) {
-        memory.stack[addr - 0x0100] = data;
+        cur->stack[addr - 0x0100] = data;
     } else if (addr >= 0xFFFA) {
-        memory.last_six[addr - 0xFDFA] = data;
+        cur->last_six[addr - 0xFFFA] = data;
     } else {
-        memory.data[addr - 0x0200] = data;
+        cur->data[addr - 0x0200] = data;
     }
 
     return 0;
@@ -121,18 +136,20 @@ static void load_program(char *filename) {
  * @return void
  * */
 void mem_init(char *filename) {
-    memset(memory.zero_page, 0, sizeof(memory.zero_page));
-    memset(memory.stack, 0, sizeof(memory.stack));
-    memset(memory.data, 0, sizeof(memory.data));
+    memset(cur->zero_page, 0, sizeof(cur->zero_page));
+    memset(cur->stack, 0, sizeof(cur->stack));
+    memset(cur->data, 0, sizeof(cur->data));
 
     // im not really sure about this
-    memory.last_six[0] = 0xA;
-    memory.last_six[1] = 0xB;
-    memory.last_six[2] = 0xC;
-    memory.last_six[3] = 0xD;
-    memory.last_six[4] = 0xE;
-    memory.last_six[5] = 0xF;
+    cur->last_six[0] = 0xA;
+    cur->last_six[1] = 0xB;
+    cur->last_six[2] = 0xC;
+    cur->last_six[3] = 0xD;
+    cur->last_six[4] = 0xE;
+    cur->last_six[5] = 0xF;
 	
+    mem_map_image();
+
 	if (strlen(filename) > 0) {
 	  load_program(filename);
 	  printf("\n[-!-] Verifying program loaded... NAME: \"%s\"\n", filename);
@@ -146,50 +163,157 @@ void mem_init(char *filename) {
  * mem_get_ptr: returns pointer to currently active memory struct
  * */
 struct mem* mem_get_ptr(void) {
-    struct mem* mp = &memory;
+    struct mem* mp = cur;
     return mp;
 }
 
 /**
- * mem_dump: Dumps the memory to a file called dump.bin
- *
+ * mem_attach: Makes another memory the active one, used to switch between
+ *             machines sharing the same core
+ * @param mp The memory, NULL for the default one
+ * @return void
+ * */
+void mem_attach(struct mem* mp) {
+    uint8_t* old = (uint8_t*)cur;
+
+    cur = mp ? mp : &memory;
+    if ((uint8_t*)cur == old) return;
+
+    // the pages that showed the old image show the new one, banks stay
+    for (uint32_t page = 0; page < 0x100; page++) {
+        if (mem_read_map[page] == old + (page << 8)) mem_read_map[page] = mem_raw() + (page << 8);
+        if (mem_write_map[page] == old + (page << 8)) mem_write_map[page] = mem_raw() + (page << 8);
+    }
+}
+
+/**
+ * mem_map_image: Point every page at the attached image, windows of banks
+ *                included (their mapper has to map them again)
  * @param void
- * @return 0 if success, 1 if fail
+ * @return void
  * */
-int mem_dump(void) {
-    // 100% there's a better way to do this
+void mem_map_image(void) {
+    for (uint32_t page = 0; page < 0x100; page++) {
+        mem_read_map[page] = mem_raw() + (page << 8);
+        mem_write_map[page] = mem_read_map[page];
+    }
+}
 
-    FILE* fp = fopen("dump.bin", "wb+");
-    if (fp == NULL) return 1;
+/**
+ * mem_raw: returns the memory as a flat 64K image, indexed by address
+ * */
+uint8_t* mem_raw(void) { return (uint8_t*)cur; }
+
+/**
+ * mem_page: Where the bytes of a page are read, in the image or in the bank
+ *           it shows (for code that reads the whole machine, writes go
+ *           through mem_write_map: a ROM bank can't be written)
+ * @param page The page
+ * @return its 256 bytes
+ * */
+uint8_t* mem_page(uint8_t page) { return mem_read_map[page]; }
+
+/**
+ * mem_map_io: Attach a device to the pages covering the given range, every
+ *             access to them goes to the device instead of the RAM
+ * @param base The first address of the range
+ * @param size The size of the range in bytes
+ * @param io The device handlers, NULL gives the pages back to the RAM
+ * @return void
+ * */
+void mem_map_io(uint16_t base, uint16_t size, struct mem_io* io) {
+    uint32_t last = (uint32_t)base + size - 1;
+
+    for (uint32_t page = base >> 8; page <= (last >> 8) && page < 0x100; page++) {
+        mem_io_map[page] = io;
+    }
+}
 
-    size_t wb = fwrite(memory.zero_page, 1, sizeof(memory.zero_page), fp);
-    if (wb != sizeof(memory.zero_page)) {
-        printf("[FAILED] Errors while dumping the zero page.\n");
-        fclose(fp);
-        return 1;
+/**
+ * next_device: Walks the devices on the bus, a device being on consecutive
+ *              pages it's seen once
+ * @param page The page to start from, moved past the device
+ * @return the device, NULL once every page is walked
+ * */
+static struct mem_io* next_device(uint32_t* page) {
+    while (*page < 0x100) {
+        struct mem_io* io = mem_io_map[(*page)++];
+
+        if (io && (*page == 1 || mem_io_map[*page - 2] != io)) return io;
     }
-    wb = fwrite(memory.stack, 1, sizeof(memory.stack), fp);
 
-    if (wb != sizeof(memory.stack)) {
-        printf("[FAILED] Errors while dumping the system stack.\n");
-        fclose(fp);
-        return 1;
+    return NULL;
+}
+
+/**
+ * mem_io_reset: Pull the reset line of every device on the bus
+ * @param void
+ * @return void
+ * */
+void mem_io_reset(void) {
+    uint32_t page = 0;
+    struct mem_io* io;
+
+    while ((io = next_device(&page))) {
+        if (io->reset) io->reset(io->ctx);
     }
+}
 
-    wb = fwrite(memory.data, 1, sizeof(memory.data), fp);
+/**
+ * mem_io_save: Copy the state of the devices on the bus, one after the other
+ *              in address order
+ * @param state MEM_IO_STATE bytes
+ * @return void
+ * */
+void mem_io_save(uint8_t* state) {
+    uint32_t page = 0, used = 0;
+    struct mem_io* io;
 
-    if (wb != sizeof(memory.data)) {
-        printf("[FAILED] Errors while dumping the program data.\n");
-        fclose(fp);
-        return 1;
+    while ((io = next_device(&page))) {
+        if (!io->save || used + io->state_size > MEM_IO_STATE) continue;
+
+        io->save(state + used, io->ctx);
+        used += io->state_size;
     }
+}
 
-    wb = fwrite(memory.last_six, 1, sizeof(memory.last_six), fp);
+/**
+ * mem_io_restore: Bring the devices back to a state saved by mem_io_save(),
+ *                 the same devices must be on the bus
+ * @param state MEM_IO_STATE bytes
+ * @return void
+ * */
+void mem_io_restore(const uint8_t* state) {
+    uint32_t page = 0, used = 0;
+    struct mem_io* io;
+
+    while ((io = next_device(&page))) {
+        if (!io->restore || used + io->state_size > MEM_IO_STATE) continue;
+
+        io->restore(state + used, io->ctx);
+        used += io->state_size;
+    }
+}
+
+/**
+ * mem_dump: Dumps the memory to a file called dump.bin
+ *
+ * @param void
+ * @return 0 if success, 1 if fail
+ * */
+int mem_dump(void) {
+    // 100% there's a better way to do this
+
+    FILE* fp = fopen("dump.bin", "wb+");
+    if (fp == NULL) return 1;
 
-    if (wb != sizeof(memory.last_six)) {
-        printf("[FAILED] Errors while dumping the last six reserved bytes.\n");
-        fclose(fp);
-        return 1;
+    // page by page, banked ones show the bank selected
+    for (uint16_t page = 0; page < 0x100; page++) {
+        if (fwrite(mem_page(page), 1, 0x100, fp) != 0x100) {
+            printf("[FAILED] Errors while dumping page 0x%02X.\n", page);
+            fclose(fp);
+            return 1;
+        }
     }
 
     fclose(fp);
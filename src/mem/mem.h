@@ -10,16 +10,72 @@
 #define SYS_STACK		0x0100 
 #define ROM 			0x8000
 
+/*
+ * The fields follow the address space, so the struct can also be seen as a
+ * flat 64K image (see mem_raw())
+ * */
 struct mem {
     uint8_t zero_page[0x100];
     uint8_t stack[0x100];
-    uint8_t last_six[0x06];
     uint8_t data[TOTAL_MEM - 0x206];
+    uint8_t last_six[0x06];
+};
+
+/*
+ * Memory mapped devices are decoded with a page (256 bytes) granularity,
+ * a device smaller than a page sees its registers mirrored across it.
+ *
+ * The other handlers can be NULL: reset is pulled with the cpu reset line
+ * (see mem_io_reset()), save and restore keep the state of the device in
+ * snapshots, state_size bytes of the MEM_IO_STATE shared by all of them.
+ * */
+#define MEM_IO_STATE 256
+
+struct mem_io {
+    uint8_t (*read)(uint16_t addr, void* ctx);
+    void (*write)(uint16_t addr, uint8_t data, void* ctx);
+    void (*reset)(void* ctx);
+    void (*save)(uint8_t* state, void* ctx);
+    void (*restore)(const uint8_t* state, void* ctx);
+    uint32_t state_size;
+    void* ctx;
 };
 
+// one entry per page, NULL means plain RAM
+extern struct mem_io* mem_io_map[0x100];
+
+// one entry per page, set when the cpu writes to it (see snapshot.c)
+extern uint8_t mem_dirty[0x100];
+
+/*
+ * One entry per page, where the cpu reads its 256 bytes and where it writes
+ * them: into the attached image (see mem_attach()), or for bank switched
+ * pages (see mapper.c) into the bank their window shows. Every entry is
+ * valid, an access is a single lookup, and a switch only moves the pointers
+ * of its window.
+ *
+ * The banks selected are part of the machine: mem_banks holds them for
+ * snapshots and replays, mem_select_banks maps saved ones back (NULL when
+ * nothing is banked).
+ * */
+#define MEM_BANK_REGS 2
+
+extern uint8_t* mem_read_map[0x100];
+extern uint8_t* mem_write_map[0x100];
+extern uint8_t mem_banks[MEM_BANK_REGS];
+extern void (*mem_select_banks)(const uint8_t* banks);
+
 char *to_binary(int n);
 void mem_init(char *filename);
 int mem_dump(void);
 struct mem* mem_get_ptr(void);
+uint8_t* mem_raw(void);
+uint8_t* mem_page(uint8_t page);
+void mem_map_image(void);
+void mem_attach(struct mem* mp);
+void mem_map_io(uint16_t base, uint16_t size, struct mem_io* io);
+void mem_io_reset(void);
+void mem_io_save(uint8_t* state);
+void mem_io_restore(const uint8_t* state);
 
 #endif
@@ -0,0 +1,224 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "shm.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "../cpu/cpu.h"
+#include "mem.h"
+
+/**
+ * Live machine state in POSIX shared memory:
+ *
+ * The memory the cpu works on is moved into the shared region (see
+ * mem_attach()), so other processes mapping it read-only see every write as
+ * it happens, without copies. The registers can't be moved the same way (the
+ * core keeps them in a global), they are copied into the header each time
+ * the cpu stops, under the seqlock.
+ *
+ * The emulator is the only writer. shm_begin() and shm_end() bracket the
+ * changes made from outside the cpu (reset, debugger pokes...), they nest so
+ * a run inside a debugger command counts once. Runs themselves only raise
+ * the running flag: holding the seqlock for a whole run would starve the
+ * readers of a machine running flat out.
+ * */
+
+// the exported region, NULL when not exporting
+static struct shm_state* st = NULL;
+static char path[256];
+
+// shm_begin() calls not matched by shm_end() yet
+static uint32_t depth = 0;
+
+static void publish_regs(void) {
+    st->regs = cpu;
+    st->clock = cpu_clock;
+    st->instructions = cpu_instructions;
+}
+
+/**
+ * shm_export: Create the shared region and move the machine into it, the
+ *             region is removed when the emulator exits
+ * @param name The name of the region, as for shm_open() ("/" is optional)
+ * @return 0 if success, 1 if failure
+ * */
+int shm_export(const char* name) {
+    snprintf(path, sizeof(path), "%s%s", name[0] == '/' ? "" : "/", name);
+
+    int fd = shm_open(path, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("[x] SHM -> shm_open");
+        return 1;
+    }
+
+    if (ftruncate(fd, SHM_SIZE) < 0) {
+        perror("[x] SHM -> ftruncate");
+        close(fd);
+        shm_unlink(path);
+        return 1;
+    }
+
+    void* region = mmap(NULL, SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (region == MAP_FAILED) {
+        perror("[x] SHM -> mmap");
+        shm_unlink(path);
+        return 1;
+    }
+
+    st = region;
+    st->magic = SHM_MAGIC;
+    st->version = SHM_VERSION;
+    st->seq = 0;
+    st->mem_offset = SHM_MEM_OFFSET;
+    st->running = 0;
+
+    // the program is already loaded, bring it along
+    struct mem* m = (struct mem*)((uint8_t*)region + SHM_MEM_OFFSET);
+    memcpy(m, mem_raw(), TOTAL_MEM);
+
+    struct cpu_context ctx;
+    cpu_save_context(&ctx);
+    ctx.mem = m;
+    cpu_load_context(&ctx);
+
+    publish_regs();
+    atexit(shm_close);
+
+    fprintf(stderr, "[shm] exporting the machine as %s\n", path);
+    return 0;
+}
+
+/**
+ * shm_begin: The state is about to change, readers must wait
+ * @param void
+ * @return void
+ * */
+void shm_begin(void) {
+    if (!st || depth++ > 0) return;
+
+    __atomic_store_n(&st->seq, st->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/**
+ * shm_end: The state is consistent again, publish the registers
+ * @param void
+ * @return void
+ * */
+void shm_end(void) {
+    if (!st || depth == 0 || --depth > 0) return;
+
+    publish_regs();
+    __atomic_store_n(&st->seq, st->seq + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * shm_running: The cpu starts or stops executing, the registers are
+ *              published when it stops
+ * @param on 1 when it starts, 0 when it stops
+ * @return void
+ * */
+void shm_running(uint8_t on) {
+    if (!st) return;
+
+    if (on) {
+        __atomic_store_n(&st->running, 1, __ATOMIC_RELEASE);
+        return;
+    }
+
+    shm_begin();
+    st->running = 0;
+    shm_end();
+}
+
+/**
+ * shm_close: Stop exporting, the memory goes back to the default one
+ * @param void
+ * @return void
+ * */
+void shm_close(void) {
+    if (!st) return;
+
+    // the default memory takes over, with the current content
+    struct cpu_context ctx;
+    cpu_save_context(&ctx);
+    ctx.mem = NULL;
+    cpu_load_context(&ctx);
+    memcpy(mem_raw(), (uint8_t*)st + SHM_MEM_OFFSET, TOTAL_MEM);
+
+    munmap(st, SHM_SIZE);
+    shm_unlink(path);
+    st = NULL;
+    depth = 0;
+}
+
+/*
+ * =============================================
+ * READERS
+ * =============================================
+ */
+
+/**
+ * shm_attach: Map the region exported by an emulator, read-only
+ * @param name The name given to the emulator
+ * @return the state, NULL if failure
+ * */
+const struct shm_state* shm_attach(const char* name) {
+    char p[256];
+    snprintf(p, sizeof(p), "%s%s", name[0] == '/' ? "" : "/", name);
+
+    int fd = shm_open(p, O_RDONLY, 0);
+    if (fd < 0) return NULL;
+
+    void* region = mmap(NULL, SHM_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (region == MAP_FAILED) return NULL;
+
+    const struct shm_state* s = region;
+    if (s->magic != SHM_MAGIC || s->version != SHM_VERSION) {
+        munmap(region, SHM_SIZE);
+        return NULL;
+    }
+
+    return s;
+}
+
+/**
+ * shm_mem: The 64K image of an attached region, indexed by address
+ * */
+const uint8_t* shm_mem(const struct shm_state* s) { return (const uint8_t*)s + s->mem_offset; }
+
+/**
+ * shm_read_begin: Start reading, to be paired with shm_read_retry():
+ *
+ *     do {
+ *         seq = shm_read_begin(s);
+ *         ... copy what's needed ...
+ *     } while (shm_read_retry(s, seq));
+ *
+ * @param s The attached region
+ * @return the sequence number to give to shm_read_retry()
+ * */
+uint32_t shm_read_begin(const struct shm_state* s) {
+    return __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * shm_read_retry: Check what was read since shm_read_begin()
+ * @param s The attached region
+ * @param seq What shm_read_begin() returned
+ * @return 1 if the state changed meanwhile (or was changing), 0 if consistent
+ * */
+int shm_read_retry(const struct shm_state* s, uint32_t seq) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return (seq & 1) || __atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq;
+}
@@ -0,0 +1,53 @@
+#ifndef INC_6502_SHM_H
+#define INC_6502_SHM_H
+
+#include <stdint.h>
+
+#include "../cpu/cpu.h"
+#include "mem.h"
+
+#define SHM_MAGIC       0x32303536  // "6502"
+#define SHM_VERSION     1
+
+// the header takes the first page, the memory starts on the next one
+#define SHM_MEM_OFFSET  4096
+#define SHM_SIZE        (SHM_MEM_OFFSET + TOTAL_MEM)
+
+/*
+ * Head of the shared region, the 64K image follows at mem_offset. The
+ * memory is the one the cpu works on, it isn't copied.
+ *
+ * seq is a seqlock: it is odd while the emulator changes the state, a reader
+ * saw a consistent state if seq was the same even value before and after it
+ * looked. See shm_read_begin().
+ *
+ * running is set while the cpu executes: the memory is then live, ahead of
+ * the registers, which are only published when the cpu stops. A reader
+ * needing both to match also checks that running was clear.
+ * */
+struct shm_state {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t seq;
+    uint32_t mem_offset;
+    uint32_t running;
+    uint32_t reserved;
+    uint64_t clock;
+    uint64_t instructions;
+    struct central_processing_unit regs;
+};
+
+// emulator side
+int shm_export(const char* name);
+void shm_begin(void);
+void shm_end(void);
+void shm_running(uint8_t on);
+void shm_close(void);
+
+// reader side
+const struct shm_state* shm_attach(const char* name);
+const uint8_t* shm_mem(const struct shm_state* st);
+uint32_t shm_read_begin(const struct shm_state* st);
+int shm_read_retry(const struct shm_state* st, uint32_t seq);
+
+#endif
@@ -0,0 +1,172 @@
+#include "snapshot.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../cpu/cpu.h"
+#include "lz.h"
+#include "mem.h"
+
+#define PAGE_RAW    0x100
+
+static const uint8_t zeros[0x100];
+
+/**
+ * snapshot_save: Copy the state of the machine, the dirty pages tracking
+ *                starts over from here
+ * @param snap Where to save the state
+ * @return void
+ * */
+void snapshot_save(struct snapshot* snap) {
+    snap->cpu = cpu;
+    snap->clock = cpu_clock;
+    snap->cycles = cycles;
+    memcpy(snap->banks, mem_banks, sizeof(mem_banks));
+    mem_io_save(snap->io);
+
+    for (uint16_t page = 0; page < 0x100; page++) {
+        memcpy(snap->mem + (page << 8), mem_page(page), 0x100);
+    }
+
+    memset(mem_dirty, 0, sizeof(mem_dirty));
+}
+
+/**
+ * select_banks: Map the banks of a saved state back, before its memory is
+ *               copied in (it goes to these banks)
+ * @param banks The saved banks
+ * @return void
+ * */
+static void select_banks(const uint8_t* banks) {
+    if (mem_select_banks && memcmp(banks, mem_banks, sizeof(mem_banks))) mem_select_banks(banks);
+}
+
+static void restore_regs(const struct snapshot* snap) {
+    cpu = snap->cpu;
+    cpu_clock = snap->clock;
+    cycles = snap->cycles;
+    select_banks(snap->banks);
+    mem_io_restore(snap->io);
+
+    cpu_forget();
+}
+
+/**
+ * snapshot_restore: Bring the whole machine back to a saved state
+ * @param snap The saved state
+ * @return void
+ * */
+void snapshot_restore(const struct snapshot* snap) {
+    restore_regs(snap);
+
+    for (uint16_t page = 0; page < 0x100; page++) {
+        memcpy(mem_write_map[page], snap->mem + (page << 8), 0x100);
+    }
+
+    memset(mem_dirty, 0, sizeof(mem_dirty));
+}
+
+/**
+ * snapshot_restore_dirty: Same as snapshot_restore() but only the pages the
+ *                         cpu wrote to are copied back. Only valid if the
+ *                         snapshot is the last one saved or restored.
+ * @param snap The saved state
+ * @return void
+ * */
+void snapshot_restore_dirty(const struct snapshot* snap) {
+    restore_regs(snap);
+
+    for (uint16_t page = 0; page < 0x100; page++) {
+        if (!mem_dirty[page]) continue;
+
+        memcpy(mem_write_map[page], snap->mem + (page << 8), 0x100);
+        mem_dirty[page] = 0;
+    }
+}
+
+/**
+ * snapshot_pack: Compressed copy of the machine, see struct snapshot_packed.
+ *                The dirty pages tracking isn't touched
+ * @param base The snapshot to share the unchanged pages with, NULL for none
+ * @return the packed snapshot (to be freed with free()), NULL if out of memory
+ * */
+struct snapshot_packed* snapshot_pack(const struct snapshot* base) {
+    // room for every page raw, shrunk to what they take once compressed
+    struct snapshot_packed* packed = malloc(sizeof(*packed) + 0x100 * PAGE_RAW);
+    if (!packed) return NULL;
+
+    uint32_t size = 0;
+
+    for (uint16_t page = 0; page < 0x100; page++) {
+        const uint8_t* src = mem_page(page);
+        const uint8_t* same = base ? base->mem + (page << 8) : zeros;
+
+        if (memcmp(src, same, 0x100) == 0) {
+            packed->page_len[page] = 0;
+            continue;
+        }
+
+        // pages that don't shrink are kept as they are
+        uint32_t n = lz_compress(src, 0x100, packed->data + size, PAGE_RAW - 1);
+        if (n == 0) {
+            memcpy(packed->data + size, src, PAGE_RAW);
+            n = PAGE_RAW;
+        }
+
+        packed->page_len[page] = n;
+        size += n;
+    }
+
+    struct snapshot_packed* shrunk = realloc(packed, sizeof(*packed) + size);
+    if (shrunk) packed = shrunk;
+
+    packed->cpu = cpu;
+    packed->clock = cpu_clock;
+    packed->cycles = cycles;
+    memcpy(packed->banks, mem_banks, sizeof(mem_banks));
+    mem_io_save(packed->io);
+    packed->base = base;
+    packed->size = size;
+
+    return packed;
+}
+
+/**
+ * snapshot_unpack: Bring the whole machine back to a packed state
+ * @param packed The saved state, its base must still be there
+ * @return void
+ * */
+void snapshot_unpack(const struct snapshot_packed* packed) {
+    const uint8_t* src = packed->data;
+
+    cpu = packed->cpu;
+    cpu_clock = packed->clock;
+    cycles = packed->cycles;
+    select_banks(packed->banks);
+    mem_io_restore(packed->io);
+    cpu_forget();
+
+    for (uint16_t page = 0; page < 0x100; page++) {
+        uint8_t* dst = mem_write_map[page];
+        uint16_t n = packed->page_len[page];
+
+        if (n == 0) {
+            memcpy(dst, packed->base ? packed->base->mem + (page << 8) : zeros, 0x100);
+        } else if (n == PAGE_RAW) {
+            memcpy(dst, src, 0x100);
+        } else {
+            lz_decompress(src, n, dst, 0x100);
+        }
+        src += n;
+    }
+
+    memset(mem_dirty, 0, sizeof(mem_dirty));
+}
+
+/**
+ * snapshot_packed_size: Memory taken by a packed snapshot
+ * */
+size_t snapshot_packed_size(const struct snapshot_packed* packed) {
+    return sizeof(*packed) + packed->size;
+}
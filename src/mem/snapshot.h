@@ -0,0 +1,49 @@
+#ifndef INC_6502_SNAPSHOT_H
+#define INC_6502_SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../cpu/cpu.h"
+#include "mem.h"
+
+/*
+ * Full copy of the machine: registers, clock, the banks selected, the state
+ * of the devices that keep one (see struct mem_io, their pending events come
+ * back with it) and the 64K of memory (banked pages as the cpu sees them).
+ * Other scheduled events and the banks switched out aren't part of it.
+ * */
+struct snapshot {
+    struct central_processing_unit cpu;
+    uint64_t clock;
+    uint32_t cycles;
+    uint8_t banks[MEM_BANK_REGS];
+    uint8_t io[MEM_IO_STATE];
+    uint8_t mem[TOTAL_MEM];
+};
+
+/*
+ * Compressed copy of the machine, for keeping many of them. Pages identical
+ * to the same page of a base snapshot aren't stored (with no base, pages of
+ * zeros aren't), the others are compressed with lz.c.
+ * */
+struct snapshot_packed {
+    struct central_processing_unit cpu;
+    uint64_t clock;
+    uint32_t cycles;
+    uint8_t banks[MEM_BANK_REGS];
+    uint8_t io[MEM_IO_STATE];
+    const struct snapshot* base;    // must outlive the packed snapshot
+    uint32_t size;                  // of data
+    uint16_t page_len[0x100];       // 0: same as the base, 0x100: raw, else compressed
+    uint8_t data[];
+};
+
+void snapshot_save(struct snapshot* snap);
+void snapshot_restore(const struct snapshot* snap);
+void snapshot_restore_dirty(const struct snapshot* snap);
+struct snapshot_packed* snapshot_pack(const struct snapshot* base);
+void snapshot_unpack(const struct snapshot_packed* packed);
+size_t snapshot_packed_size(const struct snapshot_packed* packed);
+
+#endif
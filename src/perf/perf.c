@@ -0,0 +1,381 @@
+#define _GNU_SOURCE
+
+#include "perf.h"
+
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../cpu/cpu.h"
+#include "../cpu/instructions.h"
+#include "../mem/snapshot.h"
+
+/**
+ * Host performance counters around the interpreter:
+ *
+ * The program is profiled twice from the same saved state. The stepped pass
+ * runs one instruction per cpu_run() call, the cost is charged to the class
+ * of the opcode the cpu fetched (from lookup). The fast pass then runs the
+ * same cycles in a single cpu_run(), with superinstructions and everything,
+ * and gives the real totals.
+ *
+ * Reading the counters costs a syscall, so the stepped pass only reads them
+ * where the class changes: it goes in chunks, each traced first (classes
+ * only, no counters), then run again from a snapshot taken before it with a
+ * read after each run of instructions of the same class. The cost of a read,
+ * measured beforehand, is subtracted but the figures are only good to
+ * compare classes with each other. Counters the host doesn't have (VMs often
+ * expose no PMU at all) are reported as n/a.
+ * */
+
+#define PERF_COUNTERS 5
+
+// classes the opcodes are grouped in, see class_of()
+#define PERF_CLASSES 10
+
+// instructions traced at once by the stepped pass, see trace_chunk()
+#define PERF_CHUNK 0x10000
+
+static const struct {
+    const char* name;
+    const char* column;
+    uint32_t type;
+    uint64_t config;
+} counters[PERF_COUNTERS] = {
+    {"host cycles", "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"host instructions", "instrs", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"branch misses", "br-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {"cache misses", "cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {"task clock (ns)", "ns", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+};
+
+static const char* class_names[PERF_CLASSES] = {
+    "load/store", "alu", "shift/rmw", "register", "flags",
+    "branch", "jump/call", "stack", "undocumented", "illegal",
+};
+
+static const char* class_members[PERF_CLASSES - 2] = {
+    "LDA LDX LDY STA STX STY",
+    "ADC SBC AND ORA EOR CMP CPX CPY BIT",
+    "ASL LSR ROL ROR INC DEC",
+    "INX INY DEX DEY TAX TAY TXA TYA TSX TXS",
+    "CLC SEC CLI SEI CLV CLD SED",
+    "BPL BMI BVC BVS BCC BCS BNE BEQ",
+    "JMP JSR RTS RTI BRK",
+    "PHA PLA PHP PLP",
+};
+
+// file descriptors of the group, -1 if the counter is missing
+static int fds[PERF_COUNTERS];
+static int leader = -1;
+
+// position of each counter in a group read, -1 if missing
+static int slot[PERF_COUNTERS];
+static int open_count = 0;
+
+// class of each opcode, see class_of()
+static uint8_t classes[256];
+
+// classes of the traced chunk, consecutive instructions of a class counted once
+static struct {
+    uint8_t class;
+    uint32_t count;
+} runs[PERF_CHUNK];
+static uint32_t run_count = 0;
+
+/*
+ * =============================================
+ * HELPERS
+ * =============================================
+ */
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * class_of: opcode class, by instruction name. NOP and the "???" entries
+ * that still do something are undocumented, the others illegal
+ * @param opcode The opcode
+ * @return the class index
+ * */
+static uint8_t class_of(uint8_t opcode) {
+    const char* name = lookup[opcode].name;
+
+    if (inst_is_illegal(opcode)) return PERF_CLASSES - 1;
+
+    for (uint8_t c = 0; c < PERF_CLASSES - 2; c++) {
+        if (strcmp(name, "???") != 0 && strstr(class_members[c], name)) return c;
+    }
+
+    return PERF_CLASSES - 2;
+}
+
+/**
+ * open_counters: opens every counter the host has in a single group, so they
+ * are read together. User space only, that's where the interpreter runs.
+ * @param void
+ * @return the number of counters opened
+ * */
+static int open_counters(void) {
+    for (int i = 0; i < PERF_COUNTERS; i++) {
+        struct perf_event_attr attr;
+
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = counters[i].type;
+        attr.config = counters[i].config;
+        attr.disabled = leader < 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+
+        fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+        slot[i] = -1;
+
+        if (fds[i] < 0) continue;
+
+        if (leader < 0) leader = fds[i];
+        slot[i] = open_count++;
+    }
+
+    return open_count;
+}
+
+static void close_counters(void) {
+    for (int i = 0; i < PERF_COUNTERS; i++) {
+        if (fds[i] >= 0) close(fds[i]);
+    }
+}
+
+/**
+ * read_counters: reads the whole group
+ * @param out One value per counter, missing ones are left at 0
+ * @return 0 if success, 1 if failure
+ * */
+static int read_counters(uint64_t* out) {
+    uint64_t buf[1 + PERF_COUNTERS];
+
+    if (read(leader, buf, sizeof(buf)) < (ssize_t)((1 + open_count) * sizeof(uint64_t))) return 1;
+
+    for (int i = 0; i < PERF_COUNTERS; i++) out[i] = slot[i] >= 0 ? buf[1 + slot[i]] : 0;
+    return 0;
+}
+
+/**
+ * calibrate: cost of a read, between two reads in a row, the smallest of
+ * many tries so noise isn't subtracted from the measurements
+ * @param cost One value per counter
+ * @return void
+ * */
+static void calibrate(uint64_t* cost) {
+    uint64_t a[PERF_COUNTERS], b[PERF_COUNTERS];
+
+    for (int i = 0; i < PERF_COUNTERS; i++) cost[i] = UINT64_MAX;
+
+    for (int n = 0; n < 10000; n++) {
+        read_counters(a);
+        read_counters(b);
+        for (int i = 0; i < PERF_COUNTERS; i++) {
+            if (b[i] - a[i] < cost[i]) cost[i] = b[i] - a[i];
+        }
+    }
+}
+
+static void print_value(int counter, double val) {
+    if (slot[counter] < 0) {
+        printf(" %12s", "n/a");
+    } else {
+        printf(" %12.2f", val);
+    }
+}
+
+/*
+ * =============================================
+ * PASSES
+ * =============================================
+ */
+
+/**
+ * trace_chunk: steps up to PERF_CHUNK instructions without reading the
+ * counters and records their classes
+ * @param end Cycle the pass stops at
+ * @return 1 if the pass is over (BRK or end reached), 0 otherwise
+ * */
+static uint8_t trace_chunk(uint64_t end) {
+    run_count = 0;
+
+    for (uint32_t n = 0; n < PERF_CHUNK; n++) {
+        if (cpu_clock >= end) return 1;
+
+        uint8_t reason = cpu_run(1, CPU_STOP_BRK, NULL);
+        uint8_t c = classes[cpu_last_opcode()];
+
+        if (run_count == 0 || runs[run_count - 1].class != c) {
+            runs[run_count].class = c;
+            runs[run_count++].count = 0;
+        }
+        runs[run_count - 1].count++;
+
+        if (reason == CPU_STOP_BRK) return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * measure_chunk: steps the traced chunk again, reading the counters after each
+ * run of instructions of the same class
+ * @param cost Cost of a read, see calibrate()
+ * @param per_class Counters charged to each class
+ * @param class_count Instructions of each class
+ * @return 0 if success, 1 if the instructions aren't the traced ones
+ * */
+static int measure_chunk(const uint64_t* cost, uint64_t per_class[][PERF_COUNTERS],
+                         uint64_t* class_count) {
+    uint64_t before[PERF_COUNTERS], after[PERF_COUNTERS];
+
+    read_counters(before);
+
+    for (uint32_t r = 0; r < run_count; r++) {
+        uint8_t c = runs[r].class, diverged = 0;
+
+        for (uint32_t n = 0; n < runs[r].count; n++) {
+            cpu_run(1, CPU_STOP_BRK, NULL);
+            diverged |= classes[cpu_last_opcode()] != c;
+        }
+        read_counters(after);
+
+        if (diverged) return 1;
+
+        for (int i = 0; i < PERF_COUNTERS; i++) {
+            uint64_t delta = after[i] - before[i];
+            per_class[c][i] += delta > cost[i] ? delta - cost[i] : 0;
+            before[i] = after[i];
+        }
+        class_count[c] += runs[r].count;
+    }
+
+    return 0;
+}
+
+/**
+ * perf_default_config: Fill a configuration with the defaults
+ * @param cfg The configuration
+ * @return void
+ * */
+void perf_default_config(struct perf_config* cfg) { cfg->max_cycles = 100000000; }
+
+/**
+ * perf_run: Profile the loaded program and print the report, the cpu must be
+ *           initialized and reset
+ * @param cfg The configuration
+ * @return 0 if success, 1 if no counter could be opened
+ * */
+int perf_run(struct perf_config* cfg) {
+    static struct snapshot base, chunk;
+
+    uint64_t cost[PERF_COUNTERS], before[PERF_COUNTERS], after[PERF_COUNTERS];
+    uint64_t per_class[PERF_CLASSES][PERF_COUNTERS];
+    uint64_t class_count[PERF_CLASSES];
+    uint64_t total[PERF_COUNTERS];
+
+    if (open_counters() == 0) {
+        fprintf(stderr, "[x] PERF -> no counter available (perf_event_paranoid?)\n");
+        return 1;
+    }
+
+    ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    calibrate(cost);
+
+    memset(per_class, 0, sizeof(per_class));
+    memset(class_count, 0, sizeof(class_count));
+    for (int op = 0; op < 256; op++) classes[op] = class_of(op);
+    snapshot_save(&base);
+
+    // stepped pass: one instruction per cpu_run(), attributed to its class
+    uint64_t start = cpu_clock, end = start + cfg->max_cycles, instructions = 0;
+    uint8_t over = 0;
+
+    fprintf(stderr, "[perf] stepped pass...\n");
+
+    while (!over) {
+        snapshot_save(&chunk);
+        over = trace_chunk(end);
+        snapshot_restore(&chunk);
+        cpu_forget();
+
+        if (measure_chunk(cost, per_class, class_count)) {
+            fprintf(stderr, "[x] PERF -> the program didn't run the same twice, stopping early\n");
+            break;
+        }
+    }
+
+    for (uint8_t c = 0; c < PERF_CLASSES; c++) instructions += class_count[c];
+
+    uint64_t span = cpu_clock - start;
+
+    // fast pass: the same cycles in one go
+    snapshot_restore(&base);
+    cpu_forget();
+
+    fprintf(stderr, "[perf] fast pass...\n");
+
+    double t = now_seconds();
+    read_counters(before);
+    cpu_run(span, CPU_STOP_BRK, NULL);
+    read_counters(after);
+    t = now_seconds() - t;
+
+    ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    for (int i = 0; i < PERF_COUNTERS; i++) total[i] = after[i] - before[i];
+
+    if (instructions == 0) instructions = 1;
+
+    printf("\n%llu instructions, %llu cycles emulated in %.3f s (%.1f MHz)\n\n",
+           (unsigned long long)instructions, (unsigned long long)span, t,
+           span / (t + 1e-9) / 1e6);
+
+    printf("%-20s %12s %12s %12s\n", "fast pass", "total", "/instr", "/cycle");
+    for (int i = 0; i < PERF_COUNTERS; i++) {
+        printf("%-20s", counters[i].name);
+        if (slot[i] < 0) {
+            printf(" %12s %12s %12s\n", "n/a", "n/a", "n/a");
+            continue;
+        }
+        printf(" %12llu %12.2f %12.2f\n", (unsigned long long)total[i],
+               (double)total[i] / instructions, (double)total[i] / (span ? span : 1));
+    }
+
+    printf("\n%-14s %10s %7s", "stepped pass", "count", "share");
+    for (int i = 0; i < PERF_COUNTERS; i++) printf(" %12s", counters[i].column);
+    printf("\n%-14s %10s %7s %12s\n", "", "", "", "(per instr)");
+
+    for (uint8_t c = 0; c < PERF_CLASSES; c++) {
+        if (class_count[c] == 0) continue;
+
+        printf("%-14s %10llu %6.1f%%", class_names[c], (unsigned long long)class_count[c],
+               100.0 * class_count[c] / instructions);
+        for (int i = 0; i < PERF_COUNTERS; i++) {
+            print_value(i, (double)per_class[c][i] / class_count[c]);
+        }
+        printf("\n");
+    }
+
+    // the two figures telling dispatch and memory bound loops apart
+    if (slot[2] >= 0 && slot[3] >= 0) {
+        printf("\nbranch misses per instruction: %.3f, cache misses per instruction: %.3f\n",
+               (double)total[2] / instructions, (double)total[3] / instructions);
+    }
+
+    close_counters();
+    return 0;
+}
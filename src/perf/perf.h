@@ -0,0 +1,13 @@
+#ifndef INC_6502_PERF_H
+#define INC_6502_PERF_H
+
+#include <stdint.h>
+
+struct perf_config {
+    uint64_t max_cycles;    // emulated cycles to profile (stops earlier on BRK)
+};
+
+void perf_default_config(struct perf_config* cfg);
+int perf_run(struct perf_config* cfg);
+
+#endif
@@ -0,0 +1,154 @@
+#include "display.h"
+
+#include <ncurses.h>
+#include <stdint.h>
+
+#include "../mem/mem.h"
+#include "../utils/misc.h"
+
+/**
+ * 32x32 pixels framebuffer:
+ *
+ * The pixels are plain RAM (snapshots, the debug server and the shared
+ * memory export see them), the device is only mapped over it to snoop the
+ * writes: each one marks its pixel row dirty, and the renderer only redraws
+ * the rows that changed since the last frame.
+ *
+ * Two pixel rows make a text row: each cell is an upper half block, colored
+ * with the top pixel and drawn over the bottom pixel. That takes a color pair
+ * per combination of two colors, terminals without enough of them get a
+ * coarser picture (top pixels only).
+ * */
+static struct {
+    uint16_t base;
+
+    // one bit per pixel row, see display_write()
+    uint32_t dirty;
+
+    // set by display_colors(), 0 when the pairs for half blocks are missing
+    uint8_t half_blocks;
+} display;
+
+static struct mem_io display_io;
+
+// the 16 colors: in a 256 colors terminal, in a 16 and in an 8 colors one
+static const short palette_256[16] = {
+    16, 231, 124, 80, 127, 34, 19, 227, 172, 94, 210, 238, 244, 120, 69, 250,
+};
+static const short palette_16[16] = {0, 15, 1, 6, 5, 2, 4, 11, 3, 3, 9, 8, 7, 10, 12, 7};
+static const short palette_8[16] = {0, 7, 1, 6, 5, 2, 4, 3, 3, 1, 1, 0, 7, 2, 4, 7};
+
+// the upper half block, the locale must be UTF-8 aware
+#define HALF_BLOCK "\xe2\x96\x80"
+
+/*
+ * =============================================
+ * DEVICE
+ * =============================================
+ */
+
+static uint8_t display_read(uint16_t addr, void* ctx) { return mem_page(addr >> 8)[addr & 0xFF]; }
+
+/**
+ * display_write: stores the pixel in RAM and marks its row dirty
+ * @param addr The accessed address
+ * @param data The pixel, only the low nibble is shown
+ * @param ctx unused
+ * @return void
+ * */
+static void display_write(uint16_t addr, uint8_t data, void* ctx) {
+    mem_write_map[addr >> 8][addr & 0xFF] = data;
+    mem_dirty[addr >> 8] = 1;
+
+    uint16_t offset = addr - display.base;
+    if (offset < DISPLAY_SIZE) display.dirty |= 1u << (offset / DISPLAY_WIDTH);
+}
+
+/**
+ * display_init: Map the framebuffer over the RAM
+ * @param base Its first address, rounded down to a page
+ * @return void
+ * */
+void display_init(uint16_t base) {
+    display.base = base & 0xFF00;
+    if (display.base > 0x10000 - DISPLAY_SIZE) display.base = 0x10000 - DISPLAY_SIZE;
+    display.dirty = 0xFFFFFFFF;
+
+    display_io.read = &display_read;
+    display_io.write = &display_write;
+    display_io.ctx = NULL;
+    mem_map_io(display.base, DISPLAY_SIZE, &display_io);
+
+    debug_print("(display_init) mapped at 0x%X\n", display.base);
+}
+
+/*
+ * =============================================
+ * RENDERING
+ * =============================================
+ */
+
+/**
+ * display_colors: Set up the color pairs, once ncurses colors are started
+ * @param void
+ * @return void
+ * */
+void display_colors(void) {
+    const short* palette = COLORS >= 256 ? palette_256 : COLORS >= 16 ? palette_16 : palette_8;
+
+    display.half_blocks = COLOR_PAIRS >= DISPLAY_PAIRS + 16 * 16;
+
+    for (short top = 0; top < 16; top++) {
+        if (!display.half_blocks) {
+            init_pair(DISPLAY_PAIRS + top, palette[top], palette[top]);
+            continue;
+        }
+        for (short bottom = 0; bottom < 16; bottom++) {
+            init_pair(DISPLAY_PAIRS + top * 16 + bottom, palette[top], palette[bottom]);
+        }
+    }
+
+    display_invalidate();
+}
+
+/**
+ * display_invalidate: Redraw everything on the next frame, for when the
+ * pixels were changed behind the device's back
+ * @param void
+ * @return void
+ * */
+void display_invalidate(void) { display.dirty = 0xFFFFFFFF; }
+
+/**
+ * display_render: Draw the pixel rows changed since the last call
+ * @param start_x Start position X to print it
+ * @param start_y Start position Y to print it
+ * @return void
+ * */
+void display_render(uint8_t start_x, uint8_t start_y) {
+    mvprintw(start_y, start_x, " Display $%04X ", display.base);
+
+    for (uint8_t row = 0; row < DISPLAY_HEIGHT / 2; row++) {
+        if (!((display.dirty >> (row * 2)) & 3)) continue;
+
+        // rows of pixels don't cross pages, the base is page aligned
+        uint16_t addr = display.base + row * 2 * DISPLAY_WIDTH;
+        const uint8_t* top = mem_page(addr >> 8) + (addr & 0xFF);
+        const uint8_t* bottom = top + DISPLAY_WIDTH;
+
+        move(start_y + 1 + row, start_x);
+        for (uint8_t col = 0; col < DISPLAY_WIDTH; col++) {
+            // pairs past 255 don't fit in COLOR_PAIR()
+            if (display.half_blocks) {
+                color_set(DISPLAY_PAIRS + (top[col] & 0xF) * 16 + (bottom[col] & 0xF), NULL);
+                addstr(HALF_BLOCK);
+            } else {
+                color_set(DISPLAY_PAIRS + (top[col] & 0xF), NULL);
+                addch(' ');
+            }
+        }
+        color_set(0, NULL);
+    }
+
+    display.dirty = 0;
+}
@@ -0,0 +1,22 @@
+#ifndef INC_6502_DISPLAY_H
+#define INC_6502_DISPLAY_H
+
+#include <stdint.h>
+
+// 32x32 pixels, one byte each (the low nibble picks one of 16 colors)
+#define DISPLAY_WIDTH   32
+#define DISPLAY_HEIGHT  32
+#define DISPLAY_SIZE    (DISPLAY_WIDTH * DISPLAY_HEIGHT)
+
+// default location of the framebuffer: $0200 to $05FF
+#define DISPLAY_BASE    0x0200
+
+// first color pair used by the display, the interface ones come before
+#define DISPLAY_PAIRS   32
+
+void display_init(uint16_t base);
+void display_colors(void);
+void display_invalidate(void);
+void display_render(uint8_t start_x, uint8_t start_y);
+
+#endif
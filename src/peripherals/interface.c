@@ -1,12 +1,16 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "interface.h"
 
 #include <stdio.h>
 #include <ncurses.h>
 #include <string.h>
 #include <stdint.h>
+#include <time.h>
 
 #include "../cpu/cpu.h"
 #include "../mem/mem.h"
+#include "keyboard.h"
 
 // style methods
 void CENTER_TEXT(int row, char *str) {
@@ -18,7 +22,12 @@ void FILL_ROW(void) {
 }
 
 void interface_show_help(uint8_t start_x, uint8_t start_y) {
-    mvprintw(start_y, start_x, "Commands -> Enter: Execute new instruction, r: Resets the CPU, q: Quits");
+  // with a keyboard, the program gets the plain keys (see kinput.c)
+  if (keyboard_mapped()) {
+    mvprintw(start_y, start_x, "Commands -> ^N: Execute new instruction, ^R: Resets the CPU, ^P: Pauses, ^X: Quits");
+  } else {
+    mvprintw(start_y, start_x, "Commands -> Enter: Execute new instruction, r: Resets the CPU, p: Pauses, q: Quits");
+  }
 }
 
 /**
@@ -31,6 +40,97 @@ void interface_display_cpu(uint8_t start_x, uint8_t start_y) {
              cpu.ac, cpu.pc, cpu.sp, cpu.x, cpu.y);
 }
 
+/*
+ * Speed figures of the stats panel. Frames are accumulated over a short
+ * window and published at its end, so numbers stay readable.
+ * */
+#define STATS_WINDOW 0.5
+
+static struct {
+  double start;				// wall clock at the start of the window
+  double exec, render;		// time spent in each, in the window
+  uint64_t frames;
+  uint64_t clock, instructions;	// cpu counters at the start of the window
+
+  // published figures
+  double mhz, ns_per_instr, instr_per_frame, exec_share, render_share;
+} stats;
+
+/**
+ * interface_clock: monotonic time, cheap enough to be read every frame
+ * @param void
+ * @return the time in seconds
+ * */
+double interface_clock(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * interface_stats_frame: accounts for a frame, called once per frame
+ * @param exec Time spent executing instructions during the frame
+ * @param render Time spent drawing it
+ * @return void
+ * */
+void interface_stats_frame(double exec, double render) {
+  double now = interface_clock();
+
+  if (stats.start == 0) {
+	stats.start = now;
+	stats.clock = cpu_clock;
+	stats.instructions = cpu_instructions;
+	return;
+  }
+
+  stats.exec += exec;
+  stats.render += render;
+  stats.frames++;
+
+  double wall = now - stats.start;
+  if (wall < STATS_WINDOW) return;
+
+  uint64_t instructions = cpu_instructions - stats.instructions;
+
+  stats.mhz = (cpu_clock - stats.clock) / wall / 1e6;
+  stats.ns_per_instr = instructions ? stats.exec * 1e9 / instructions : 0;
+  stats.instr_per_frame = (double)instructions / stats.frames;
+  stats.exec_share = 100 * stats.exec / wall;
+  stats.render_share = 100 * stats.render / wall;
+
+  stats.start = now;
+  stats.exec = stats.render = 0;
+  stats.frames = 0;
+  stats.clock = cpu_clock;
+  stats.instructions = cpu_instructions;
+}
+
+/**
+ * interface_show_stats: prints the speed of the emulator, see
+ * interface_stats_frame()
+ * @param start_x Start position X to print it
+ * @param start_y Start position Y to print it
+ * @return void
+ * */
+void interface_show_stats(uint8_t start_x, uint8_t start_y) {
+  uint8_t x = start_x;
+  uint8_t y = start_y;
+
+  mvprintw(y++, x, " Stats ");
+  mvprintw(y++, x, "cycles:  %-14llu", (unsigned long long)cpu_clock);
+  mvprintw(y++, x, "speed:   %-8.3f MHz  ", stats.mhz);
+
+  // instructions stepped from the keyboard aren't timed
+  if (stats.ns_per_instr > 0) {
+	mvprintw(y++, x, "host:    %-8.1f ns/instr", stats.ns_per_instr);
+  } else {
+	mvprintw(y++, x, "host:    -                ");
+  }
+
+  mvprintw(y++, x, "instr/frame: %-10.1f", stats.instr_per_frame);
+  mvprintw(y++, x, "exec: %5.1f%% render: %5.1f%%", stats.exec_share, stats.render_share);
+}
+
 void interface_show_status(uint8_t start_x, uint8_t start_y) {
   uint8_t x = start_x;
   uint8_t y = start_y;
@@ -60,7 +160,8 @@ void interface_show_status(uint8_t start_x, uint8_t start_y) {
  * @param start_y Start position Y to print it
  * */
 void interface_show_ROM(uint8_t start_x, uint8_t start_y) {
-  struct mem* mp = mem_get_ptr();
+  // the bank selected when it's banked
+  const uint8_t* rom = mem_page(ROM >> 8);
 
   uint16_t count_addr = ROM;
   
@@ -81,7 +182,7 @@ void interface_show_ROM(uint8_t start_x, uint8_t start_y) {
 	// highlights the current instruction.
 	(i + 0x200 == cpu.pc) ? attron(COLOR_PAIR(ROM_PAIR)) : attroff(COLOR_PAIR(ROM_PAIR));
 
-	mvprintw(y, x, "%02X", mp->data[i]);
+	mvprintw(y, x, "%02X", rom[i - (ROM - 0x0200)]);
 
 	if (cell_pos == 0xf) {
 	  cell_pos = 0;					
@@ -29,5 +29,8 @@ void interface_show_ROM(uint8_t start_x, uint8_t start_y);
 void interface_show_stack(uint8_t start_x, uint8_t start_y);
 void interface_show_help(uint8_t start_x, uint8_t start_y);
 void interface_show_status(uint8_t start_x, uint8_t start_y);
+void interface_show_stats(uint8_t start_x, uint8_t start_y);
+void interface_stats_frame(double exec, double render);
+double interface_clock(void);
 
 #endif
@@ -0,0 +1,111 @@
+#include "keyboard.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../cpu/cpu.h"
+#include "../mem/mem.h"
+#include "../utils/misc.h"
+
+/**
+ * Keyboard register:
+ *
+ * Holds the last key typed (see kinput.c for where keys come from) and a
+ * ready flag, set by a new key and cleared by reading it. A key typed before
+ * the previous one was read replaces it and raises the overrun flag. The
+ * device can pull the IRQ line while a key is ready.
+ *
+ * keyboard_press() is only called from the emulation thread, the device
+ * needs no locking.
+ * */
+static struct {
+    uint8_t mapped;
+    uint8_t data;
+    uint8_t status;
+    uint8_t control;
+} kbd;
+
+static struct mem_io kbd_io;
+
+static void update_irq(void) {
+    if ((kbd.status & KBD_READY) && (kbd.control & KBD_IRQ_ENABLE)) {
+        cpu_irq_assert(IRQ_SRC_KEYBOARD);
+    } else {
+        cpu_irq_release(IRQ_SRC_KEYBOARD);
+    }
+}
+
+/**
+ * kbd_read: register reads, reading the data acknowledges the key, any
+ *           other read changes nothing (a loop polling the status is idle)
+ * @param addr The accessed address, only the low 2 bits are decoded
+ * @param ctx unused
+ * @return the register value
+ * */
+static uint8_t kbd_read(uint16_t addr, void* ctx) {
+    if ((addr & 0x3) != KBD_DATA || !(kbd.status & (KBD_READY | KBD_OVERRUN))) cpu_quiet_read();
+
+    switch (addr & 0x3) {
+        case KBD_DATA:
+            kbd.status &= ~(KBD_READY | KBD_OVERRUN);
+            update_irq();
+            return kbd.data;
+
+        case KBD_STATUS:
+            return kbd.status;
+
+        case KBD_CONTROL:
+            return kbd.control;
+
+        default:
+            return 0;
+    }
+}
+
+/**
+ * kbd_write: register writes, only the control one is writable
+ * @param addr The accessed address, only the low 2 bits are decoded
+ * @param data The written value
+ * @param ctx unused
+ * @return void
+ * */
+static void kbd_write(uint16_t addr, uint8_t data, void* ctx) {
+    if ((addr & 0x3) != KBD_CONTROL) return;
+
+    kbd.control = data & KBD_IRQ_ENABLE;
+    update_irq();
+}
+
+/**
+ * keyboard_init: Map the keyboard in the address space
+ * @param base Where to map it
+ * @return void
+ * */
+void keyboard_init(uint16_t base) {
+    memset(&kbd, 0, sizeof(kbd));
+    kbd.mapped = 1;
+
+    kbd_io.read = &kbd_read;
+    kbd_io.write = &kbd_write;
+    kbd_io.ctx = NULL;
+    mem_map_io(base, 0x4, &kbd_io);
+
+    debug_print("(keyboard_init) mapped at 0x%X\n", base);
+}
+
+// keyboard_mapped: whether the program has a keyboard, see kinput.c
+uint8_t keyboard_mapped(void) { return kbd.mapped; }
+
+/**
+ * keyboard_press: A key was typed
+ * @param key The character
+ * @return void
+ * */
+void keyboard_press(uint8_t key) {
+    if (kbd.status & KBD_READY) kbd.status |= KBD_OVERRUN;
+
+    kbd.data = key;
+    kbd.status |= KBD_READY;
+    update_irq();
+}
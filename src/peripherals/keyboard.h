@@ -0,0 +1,25 @@
+#ifndef INC_6502_KEYBOARD_H
+#define INC_6502_KEYBOARD_H
+
+#include <stdint.h>
+
+// default location of the keyboard (mirrored on its page)
+#define KEYBOARD_BASE   0x5000
+
+// registers, offset from the base address
+#define KBD_DATA        0x0     // last key, reading it clears the ready flag
+#define KBD_STATUS      0x1     // see KBD_READY and KBD_OVERRUN
+#define KBD_CONTROL     0x2     // see KBD_IRQ_ENABLE
+
+// status bits
+#define KBD_READY       (1 << 7)
+#define KBD_OVERRUN     (1 << 6)    // a key was lost before being read
+
+// control bits
+#define KBD_IRQ_ENABLE  (1 << 0)    // IRQ while a key is ready
+
+void keyboard_init(uint16_t base);
+uint8_t keyboard_mapped(void);
+void keyboard_press(uint8_t key);
+
+#endif
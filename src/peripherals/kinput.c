@@ -1,38 +1,186 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "kinput.h"
 
-#include <ncurses.h>
+#include <pthread.h>
 #include <stdint.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "../cpu/cpu.h"
-#include "interface.h"
+#include "../cpu/multi.h"
+#include "../replay/replay.h"
+#include "keyboard.h"
+
+/**
+ * Keyboard input:
+ *
+ * A dedicated thread reads the terminal and pushes the keys in a single
+ * producer single consumer queue, the emulation loop drains it once per
+ * frame with kinput_listen() and never waits on the terminal. When there is
+ * nothing to run, kinput_wait() sleeps on a condition variable the thread
+ * signals with each key.
+ *
+ * The control keys are emulator commands. The plain ones are commands too
+ * unless the program has a keyboard (see keyboard.c), it gets them all then.
+ *
+ * What reaches the program (its keys, resets) goes in the input log when
+ * recording. While replaying it comes from the log, the typed keys only
+ * drive the emulator.
+ * */
+#define KEY_CTRL(c)     ((c) & 0x1F)
+
+// must be a power of 2, keys typed while it's full are dropped
+#define QUEUE_SIZE      256
+
+static struct {
+    uint8_t keys[QUEUE_SIZE];
+    uint32_t head;  // written by the input thread only
+    uint32_t tail;  // written by the emulation thread only
+} queue;
+
+// signaled when a key is pushed, see kinput_wait()
+static pthread_mutex_t typed_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t typed = PTHREAD_COND_INITIALIZER;
 
 uint8_t QUIT = 0;
+static uint8_t PAUSED = 0;
+
+static pthread_t reader;
+
+/*
+ * =============================================
+ * QUEUE
+ * =============================================
+ */
+
+static void push(uint8_t key) {
+    uint32_t head = __atomic_load_n(&queue.head, __ATOMIC_RELAXED);
+
+    if (head - __atomic_load_n(&queue.tail, __ATOMIC_ACQUIRE) == QUEUE_SIZE) return;
+
+    queue.keys[head & (QUEUE_SIZE - 1)] = key;
+    __atomic_store_n(&queue.head, head + 1, __ATOMIC_RELEASE);
+
+    pthread_mutex_lock(&typed_lock);
+    pthread_cond_signal(&typed);
+    pthread_mutex_unlock(&typed_lock);
+}
+
+static int pop(void) {
+    uint32_t tail = __atomic_load_n(&queue.tail, __ATOMIC_RELAXED);
+
+    if (tail == __atomic_load_n(&queue.head, __ATOMIC_ACQUIRE)) return -1;
+
+    uint8_t key = queue.keys[tail & (QUEUE_SIZE - 1)];
+    __atomic_store_n(&queue.tail, tail + 1, __ATOMIC_RELEASE);
+    return key;
+}
 
 /**
- * kinput_listen: listens for keyboard events and exuctes respective actions
+ * read_keys: body of the input thread, until the terminal is closed
+ * @param arg unused
+ * @return NULL
+ * */
+static void* read_keys(void* arg) {
+    uint8_t buf[64];
+    ssize_t n;
+
+    while ((n = read(STDIN_FILENO, buf, sizeof(buf))) > 0) {
+        for (ssize_t i = 0; i < n; i++) push(buf[i]);
+    }
+
+    return NULL;
+}
+
+/*
+ * =============================================
+ * COMMANDS
+ * =============================================
+ */
+
+/**
+ * kinput_start: starts the input thread, the terminal must already deliver
+ * keys one by one (cbreak mode)
+ * @param void
+ * @return 0 if success, 1 if failure
+ * */
+uint8_t kinput_start(void) {
+    return pthread_create(&reader, NULL, &read_keys, NULL) != 0;
+}
+
+/**
+ * kinput_stop: stops the input thread, it's blocked reading the terminal
  * @param void
  * @return void
  * */
-void kinput_listen(void) {
-    char c = getch();
+void kinput_stop(void) {
+    pthread_cancel(reader);
+    pthread_join(reader, NULL);
+}
 
-    switch (c) {
-        case '\n':
-            cpu_exec();
-            break;
+/**
+ * kinput_listen: handles the keys typed since the last call, never blocks
+ * @param void
+ * @return the number of keys handled
+ * */
+uint32_t kinput_listen(void) {
+    uint8_t plain = !keyboard_mapped();
+    uint8_t live = !replay_playing();
+    uint32_t count = 0;
+    int c;
 
-        case 'r':
-            cpu_reset();
-            break;
+    while ((c = pop()) >= 0) {
+        count++;
 
-        case 'q':
+        if (c == KEY_CTRL('n') || (plain && (c == '\n' || c == '\r'))) {
+            replay_deliver();
+            multi_run(1, 0, NULL);
+        } else if (c == KEY_CTRL('r') || (plain && c == 'r')) {
+            if (!live) continue;
+            replay_log(REPLAY_RESET, NULL, 0);
+            multi_reset();
+        } else if (c == KEY_CTRL('p') || (plain && c == 'p')) {
+            PAUSED = !PAUSED;
+        } else if (c == KEY_CTRL('x') || (plain && c == 'q')) {
             QUIT = 1;
-            break;
+        } else if (!plain && live) {
+            uint8_t key = c;
+            replay_log(REPLAY_KEY, &key, 1);
+            keyboard_press(key);
+        }
+    }
+
+    return count;
+}
 
-        default:
-            break;
+/**
+ * kinput_wait: sleeps until a key is typed, for when there is nothing to
+ * run
+ * @param seconds The longest to wait
+ * @return void
+ * */
+void kinput_wait(double seconds) {
+    struct timespec until;
+
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += (time_t)seconds;
+    until.tv_nsec += (long)((seconds - (time_t)seconds) * 1e9);
+    if (until.tv_nsec >= 1000000000L) {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000L;
     }
+
+    // the key is pushed before the signal, under the lock it can't be missed
+    pthread_mutex_lock(&typed_lock);
+    while (__atomic_load_n(&queue.head, __ATOMIC_ACQUIRE) == queue.tail) {
+        if (pthread_cond_timedwait(&typed, &typed_lock, &until) != 0) break;
+    }
+    pthread_mutex_unlock(&typed_lock);
 }
 
 // kinput_should_quit: sends quit signal by returning QUIT status
 uint8_t kinput_should_quit(void) { return QUIT; }
+
+// kinput_paused: whether auto mode was paused from the keyboard
+uint8_t kinput_paused(void) { return PAUSED; }
@@ -3,7 +3,11 @@
 
 #include <stdint.h>
 
-void kinput_listen(void);
+uint8_t kinput_start(void);
+void kinput_stop(void);
+uint32_t kinput_listen(void);
+void kinput_wait(double seconds);
 uint8_t kinput_should_quit(void);
+uint8_t kinput_paused(void);
 
-#endif
\ No newline at end of file
+#endif
\ No newline at end of file
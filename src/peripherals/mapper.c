@@ -0,0 +1,237 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "mapper.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../cpu/cpu.h"
+#include "../mem/mem.h"
+#include "../utils/misc.h"
+
+/**
+ * Bank switching:
+ *
+ * The banks live outside the 64K image and the core reads and writes the
+ * pages of a window through mem_read_map and mem_write_map: switching a
+ * bank only points the pages of its window at another part of the banks,
+ * nothing is copied. The code the core runs ahead (superinstructions and
+ * native loops) stays off banked pages, so there's nothing to invalidate
+ * either.
+ *
+ * ROM banks are the image file mapped read-only, the host only reads in the
+ * parts the program touches. Writes to the ROM window go to a page nobody
+ * reads, the banks never change. The end of the image (with the
+ * vectors) is copied above the window once and for all. The banks selected
+ * are kept in mem_banks, with the rest of the machine.
+ * */
+static struct {
+    uint8_t* rom;
+    uint8_t* ram;
+
+    uint32_t rom_banks, rom_bank_size;
+    uint32_t ram_banks, ram_bank_size;
+    uint16_t ram_window;
+} mapper;
+
+// where the writes to ROM end up
+static uint8_t rom_sink[0x100];
+
+static struct mem_io mapper_io;
+
+/*
+ * =============================================
+ * HELPERS
+ * =============================================
+ */
+
+/**
+ * map_window: points the pages of a window at a bank
+ * @param addr Where the window starts
+ * @param size The size of the window
+ * @param bank The first byte of the bank
+ * @param writable 1 if writes go to the bank, 0 if they're dropped
+ * @return void
+ * */
+static void map_window(uint16_t addr, uint32_t size, uint8_t* bank, uint8_t writable) {
+    for (uint32_t offset = 0; offset < size; offset += 0x100) {
+        uint8_t page = (addr + offset) >> 8;
+
+        mem_read_map[page] = bank + offset;
+        mem_write_map[page] = writable ? bank + offset : rom_sink;
+    }
+}
+
+static void select_rom(uint8_t bank) {
+    bank %= mapper.rom_banks;
+    mem_banks[MAPPER_ROM_BANK] = bank;
+
+    map_window(ROM, mapper.rom_bank_size, mapper.rom + (size_t)bank * mapper.rom_bank_size, 0);
+}
+
+static void select_ram(uint8_t bank) {
+    bank %= mapper.ram_banks;
+    mem_banks[MAPPER_RAM_BANK] = bank;
+
+    map_window(mapper.ram_window, mapper.ram_bank_size,
+               mapper.ram + (size_t)bank * mapper.ram_bank_size, 1);
+}
+
+/**
+ * select_banks: Map the banks of a saved machine back, see mem_select_banks
+ * @param banks The banks, indexed by register
+ * @return void
+ * */
+static void select_banks(const uint8_t* banks) {
+    if (mapper.rom_banks) select_rom(banks[MAPPER_ROM_BANK]);
+    if (mapper.ram_banks) select_ram(banks[MAPPER_RAM_BANK]);
+}
+
+/**
+ * load_rom: Maps the banked image
+ * @param path The file
+ * @param size Where to put its size
+ * @return 0 if success, 1 if failure
+ * */
+static int load_rom(const char* path, long* size) {
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "[x] MAPPER -> can't open \"%s\": %s\n", path, strerror(errno));
+        if (fd >= 0) close(fd);
+        return 1;
+    }
+
+    *size = st.st_size;
+    if (*size < 0x8000 || *size % mapper.rom_bank_size || *size / mapper.rom_bank_size > 0x100) {
+        fprintf(stderr, "[x] MAPPER -> \"%s\" must be whole banks, from 32K up to 256 of them\n", path);
+        close(fd);
+        return 1;
+    }
+
+    // the mapping outlives the descriptor
+    void* rom = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (rom == MAP_FAILED) {
+        fprintf(stderr, "[x] MAPPER -> can't map \"%s\": %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    mapper.rom = rom;
+    mapper.rom_banks = *size / mapper.rom_bank_size;
+    return 0;
+}
+
+/**
+ * check_size: a bank must be made of whole pages and fit its half of the
+ *             address space
+ * @param what The name of the setting, for the error
+ * @param size The value
+ * @return 0 if valid, 1 if not
+ * */
+static int check_size(const char* what, uint32_t size) {
+    if (size == 0 || size > 0x8000 || size % 0x100) {
+        fprintf(stderr, "[x] MAPPER -> %s must be a multiple of 256 up to 32K\n", what);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * =============================================
+ * DEVICE
+ * =============================================
+ */
+
+static uint8_t mapper_read(uint16_t addr, void* ctx) {
+    return mem_banks[addr & 0x1];
+}
+
+static void mapper_write(uint16_t addr, uint8_t data, void* ctx) {
+    if ((addr & 0x1) == MAPPER_ROM_BANK) {
+        if (mapper.rom_banks) select_rom(data);
+    } else {
+        if (mapper.ram_banks) select_ram(data);
+    }
+}
+
+/**
+ * mapper_default_config: Fills a config with the default settings
+ * @param cfg The config
+ * @return void
+ * */
+void mapper_default_config(struct mapper_config* cfg) {
+    cfg->rom = NULL;
+    cfg->rom_bank_size = MAPPER_ROM_BANK_SIZE;
+    cfg->ram_banks = 0;
+    cfg->ram_bank_size = MAPPER_RAM_BANK_SIZE;
+    cfg->ram_window = MAPPER_RAM_WINDOW;
+    cfg->base = MAPPER_BASE;
+}
+
+/**
+ * mapper_init: Load the banks, map bank 0 of the image (copying the end of
+ *              it above the ROM window) and of the RAM, then the bank
+ *              registers
+ * @param cfg The settings
+ * @return 0 if success, 1 if failure
+ * */
+int mapper_init(const struct mapper_config* cfg) {
+    memset(&mapper, 0, sizeof(mapper));
+    mapper.rom_bank_size = cfg->rom_bank_size;
+    mapper.ram_bank_size = cfg->ram_bank_size;
+    mapper.ram_banks = cfg->ram_banks;
+    mapper.ram_window = cfg->ram_window;
+
+    if (cfg->rom && check_size("the ROM bank size", mapper.rom_bank_size)) return 1;
+    if (mapper.ram_banks) {
+        if (check_size("the RAM bank size", mapper.ram_bank_size)) return 1;
+
+        // the zero page and the stack are read straight by the core
+        if (mapper.ram_window % 0x100 || mapper.ram_window < 0x200 ||
+            (uint32_t)mapper.ram_window + mapper.ram_bank_size > ROM) {
+            fprintf(stderr, "[x] MAPPER -> the RAM window must be page aligned, above the stack and below ROM\n");
+            return 1;
+        }
+    }
+
+    if (cfg->rom) {
+        long size;
+        uint32_t fixed = 0x10000 - ROM - mapper.rom_bank_size;
+
+        if (load_rom(cfg->rom, &size)) return 1;
+
+        select_rom(0);
+        memcpy(mem_raw() + ROM + mapper.rom_bank_size, mapper.rom + size - fixed, fixed);
+    }
+
+    if (mapper.ram_banks) {
+        mapper.ram = calloc(mapper.ram_banks, mapper.ram_bank_size);
+        if (!mapper.ram) {
+            fprintf(stderr, "[x] MAPPER -> can't allocate the RAM banks: %s\n", strerror(errno));
+            return 1;
+        }
+
+        select_ram(0);
+    }
+
+    mem_select_banks = &select_banks;
+    cpu_forget();
+
+    mapper_io.read = &mapper_read;
+    mapper_io.write = &mapper_write;
+    mapper_io.ctx = NULL;
+    mem_map_io(cfg->base, 0x2, &mapper_io);
+
+    debug_print("(mapper_init) %u ROM banks, %u RAM banks, registers at 0x%X\n",
+                mapper.rom_banks, mapper.ram_banks, cfg->base);
+    return 0;
+}
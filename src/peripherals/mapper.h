@@ -0,0 +1,34 @@
+#ifndef INC_6502_MAPPER_H
+#define INC_6502_MAPPER_H
+
+#include <stdint.h>
+
+// default location of the bank registers (mirrored on its page)
+#define MAPPER_BASE         0x5200
+
+// registers, offset from the base address, reading gives the current bank
+#define MAPPER_ROM_BANK     0x0     // bank of the image seen in the ROM window
+#define MAPPER_RAM_BANK     0x1     // bank seen in the RAM window
+
+/*
+ * The ROM window starts at ROM (0x8000) and is one bank large, the rest of
+ * the space above it shows the end of the image (the vectors) whatever bank
+ * is selected. A 32K bank switches the whole upper half.
+ * */
+#define MAPPER_ROM_BANK_SIZE 0x4000
+#define MAPPER_RAM_BANK_SIZE 0x2000
+#define MAPPER_RAM_WINDOW    0x2000
+
+struct mapper_config {
+    const char* rom;        // banked image, NULL for none
+    uint32_t rom_bank_size;
+    uint32_t ram_banks;     // 0 for none
+    uint32_t ram_bank_size;
+    uint16_t ram_window;
+    uint16_t base;          // where the registers are mapped
+};
+
+void mapper_default_config(struct mapper_config* cfg);
+int mapper_init(const struct mapper_config* cfg);
+
+#endif
@@ -0,0 +1,244 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "uart.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../cpu/cpu.h"
+#include "../mem/mem.h"
+#include "../replay/replay.h"
+#include "../utils/misc.h"
+
+/**
+ * Serial console:
+ *
+ * Transmitted bytes are appended to a large buffer, written out in one go
+ * when it fills up and whenever the frontend calls uart_flush() (once per
+ * frame, at exit...), a program printing a lot doesn't pay a syscall per
+ * character. Received bytes are read the same way, a buffer at a time,
+ * without ever blocking: the ready flag stays clear until input is there.
+ *
+ * New input is only looked for by the frontend, once per slice of the run
+ * (uart_poll()), not by the registers: a program polling the status costs no
+ * syscall per read and, the status reads changing nothing, its loop is idle
+ * (see cpu_quiet_read()). Headless, a program idling on its input waits for
+ * it in uart_wait() instead of spinning. The input then always arrives
+ * between two instructions, which is what the input log records (see
+ * replay.c). While replaying, the input comes from the log instead.
+ * */
+static struct {
+    int out, in;
+
+    uint8_t tx[UART_BUFFER];
+    uint32_t tx_len;
+
+    uint8_t rx[4096];
+    uint32_t rx_pos, rx_len;
+    uint8_t rx_eof;
+} uart = {.out = -1, .in = -1};
+
+static struct mem_io uart_io;
+
+/*
+ * =============================================
+ * HELPERS
+ * =============================================
+ */
+
+/**
+ * open_end: opens one end of the line
+ * @param path The file, "-" for the standard stream, NULL for none
+ * @param std The standard stream
+ * @param flags The open() flags
+ * @return the file descriptor, -1 for none, -2 if failure
+ * */
+static int open_end(const char* path, int std, int flags) {
+    if (!path) return -1;
+    if (strcmp(path, "-") == 0) return std;
+
+    int fd = open(path, flags, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "[x] UART -> can't open \"%s\": %s\n", path, strerror(errno));
+        return -2;
+    }
+    return fd;
+}
+
+/**
+ * waiting: whether the line can still bring input the program hasn't got
+ * @param void
+ * @return 1 if the buffer is empty and the input isn't over, 0 otherwise
+ * */
+static uint8_t waiting(void) {
+    return uart.rx_pos == uart.rx_len && !uart.rx_eof && uart.in >= 0 && !replay_playing();
+}
+
+/**
+ * refill: reads what's available of the input, if the buffer is empty
+ * @param timeout How long to wait for it in ms, -1 for as long as it takes
+ * @return 1 if input came in or ended, 0 otherwise
+ * */
+static uint8_t refill(int timeout) {
+    if (!waiting()) return 0;
+
+    struct pollfd pfd = {uart.in, POLLIN, 0};
+    if (poll(&pfd, 1, timeout) <= 0) return 0;
+
+    ssize_t n = read(uart.in, uart.rx, sizeof(uart.rx));
+    if (n < 0 && (errno == EINTR || errno == EAGAIN)) return 0;
+
+    uart.rx_pos = 0;
+    uart.rx_len = n > 0 ? n : 0;
+    uart.rx_eof = n <= 0;
+
+    if (uart.rx_eof) replay_log(REPLAY_UART_EOF, NULL, 0);
+    else replay_log(REPLAY_UART, uart.rx, uart.rx_len);
+    return 1;
+}
+
+/*
+ * =============================================
+ * DEVICE
+ * =============================================
+ */
+
+/**
+ * uart_read: register reads, reading the data consumes the byte, any other
+ *            read changes nothing
+ * @param addr The accessed address, only the low bit is decoded
+ * @param ctx unused
+ * @return the register value
+ * */
+static uint8_t uart_read(uint16_t addr, void* ctx) {
+    uint8_t ready = uart.rx_pos < uart.rx_len;
+
+    if ((addr & 0x1) == UART_DATA && ready) return uart.rx[uart.rx_pos++];
+
+    cpu_quiet_read();
+    if ((addr & 0x1) == UART_DATA) return 0;
+
+    return UART_TX_READY | (ready ? UART_RX_READY : 0) |
+           (uart.rx_eof || uart.in < 0 ? UART_RX_EOF : 0);
+}
+
+/**
+ * uart_write: register writes, writing the data transmits it
+ * @param addr The accessed address, only the low bit is decoded
+ * @param data The written value
+ * @param ctx unused
+ * @return void
+ * */
+static void uart_write(uint16_t addr, uint8_t data, void* ctx) {
+    if ((addr & 0x1) != UART_DATA || uart.out < 0) return;
+
+    uart.tx[uart.tx_len++] = data;
+    if (uart.tx_len == UART_BUFFER) uart_flush();
+}
+
+/**
+ * uart_init: Map the UART and open both ends of the line, the output is
+ *            flushed at exit
+ * @param base Where to map it
+ * @param out Where the transmitted bytes go, "-" for stdout, NULL to drop them
+ * @param in Where the received bytes come from, "-" for stdin, NULL for none
+ * @return 0 if success, 1 if failure
+ * */
+int uart_init(uint16_t base, const char* out, const char* in) {
+    memset(&uart, 0, sizeof(uart));
+
+    uart.out = open_end(out, STDOUT_FILENO, O_WRONLY | O_CREAT | O_TRUNC);
+    uart.in = open_end(in, STDIN_FILENO, O_RDONLY);
+    if (uart.out == -2 || uart.in == -2) return 1;
+
+    // what was printed before must come out first
+    fflush(stdout);
+
+    uart_io.read = &uart_read;
+    uart_io.write = &uart_write;
+    uart_io.ctx = NULL;
+    mem_map_io(base, 0x2, &uart_io);
+
+    atexit(uart_flush);
+
+    debug_print("(uart_init) mapped at 0x%X\n", base);
+    return 0;
+}
+
+/**
+ * uart_receive: Give the UART input from elsewhere than its line (replay)
+ * @param data The received bytes, NULL for the end of the input
+ * @param len Their number
+ * @return void
+ * */
+void uart_receive(const uint8_t* data, uint32_t len) {
+    if (!data) {
+        uart.rx_eof = 1;
+        return;
+    }
+
+    // what's left first
+    memmove(uart.rx, uart.rx + uart.rx_pos, uart.rx_len - uart.rx_pos);
+    uart.rx_len -= uart.rx_pos;
+    uart.rx_pos = 0;
+
+    if (len > sizeof(uart.rx) - uart.rx_len) len = sizeof(uart.rx) - uart.rx_len;
+    memcpy(uart.rx + uart.rx_len, data, len);
+    uart.rx_len += len;
+}
+
+/**
+ * uart_poll: Look for new input, without blocking. Called by the frontend
+ *            between two slices of the run
+ * @param void
+ * @return 1 if input came in or ended, 0 otherwise
+ * */
+uint8_t uart_poll(void) { return refill(0); }
+
+/**
+ * uart_wait: Block until new input comes in or the input ends, for a program
+ *            that went idle waiting on it
+ * @param void
+ * @return 1 if it did, 0 if there is nothing to wait for (no input, bytes
+ *         still unread, input over or replayed)
+ * */
+uint8_t uart_wait(void) {
+    while (waiting()) {
+        if (refill(-1)) return 1;
+    }
+    return 0;
+}
+
+/**
+ * uart_input_fd: Where new input would come from, to wait on it with others
+ * @param void
+ * @return the file descriptor, -1 if there is nothing to wait for (see
+ *         uart_wait())
+ * */
+int uart_input_fd(void) { return waiting() ? uart.in : -1; }
+
+/**
+ * uart_flush: Write out the buffered output
+ * @param void
+ * @return void
+ * */
+void uart_flush(void) {
+    uint32_t done = 0;
+
+    while (done < uart.tx_len) {
+        ssize_t n = write(uart.out, uart.tx + done, uart.tx_len - done);
+
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break; // the other end is gone, drop it
+
+        done += n;
+    }
+
+    uart.tx_len = 0;
+}
@@ -0,0 +1,28 @@
+#ifndef INC_6502_UART_H
+#define INC_6502_UART_H
+
+#include <stdint.h>
+
+// default location of the UART (mirrored on its page)
+#define UART_BASE       0x5100
+
+// registers, offset from the base address
+#define UART_DATA       0x0     // write: transmit, read: receive
+#define UART_STATUS     0x1     // see UART_RX_READY...
+
+// status bits
+#define UART_RX_READY   (1 << 7)    // a byte can be read from UART_DATA
+#define UART_TX_READY   (1 << 6)    // always set, the output is buffered
+#define UART_RX_EOF     (1 << 5)    // the input is over
+
+// bytes buffered before a write()
+#define UART_BUFFER     (64 * 1024)
+
+int uart_init(uint16_t base, const char* out, const char* in);
+void uart_receive(const uint8_t* data, uint32_t len);
+uint8_t uart_poll(void);
+uint8_t uart_wait(void);
+int uart_input_fd(void);
+void uart_flush(void);
+
+#endif
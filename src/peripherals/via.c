@@ -0,0 +1,653 @@
+#include "via.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../cpu/cpu.h"
+#include "../cpu/sched.h"
+#include "../mem/mem.h"
+#include "../utils/misc.h"
+
+/**
+ * 6522 Versatile Interface Adapter:
+ *
+ *  - two 8-bit ports (A and B) with their data direction registers
+ *  - T1: 16-bit timer, one-shot or free-running (optionally toggling PB7)
+ *  - T2: 16-bit timer, one-shot or counting pulses on PB6
+ *  - an 8-bit shift register clocked by T2, the system clock or CB1
+ *  - interrupt flag/enable registers driving the cpu IRQ line
+ *
+ * The timers are never decremented cycle by cycle: loading a timer records
+ * the cycle it started at and schedules its expiry on the scheduler, reading
+ * a counter computes its value from the current cycle. An idle VIA doesn't
+ * cost anything.
+ * */
+static struct {
+    uint8_t ora, orb;
+    uint8_t ddra, ddrb;
+    uint8_t acr, pcr;
+    uint8_t ifr, ier;
+    uint8_t sr;
+
+    // levels driven from the outside on the port and control lines
+    uint8_t pins_a, pins_b;
+    uint8_t ca1, ca2, cb1, cb2;
+
+    // PB7 level when it's driven by T1 (ACR bit 7)
+    uint8_t pb7;
+
+    // T1: the counter held t1_base at cycle t1_start
+    uint16_t t1_latch;
+    uint16_t t1_base;
+    uint64_t t1_start;
+    uint64_t t1_due;
+    int t1_event;
+
+    // T2: only the low byte is latched, the counter is t2_count in pulse mode
+    uint8_t t2_latch;
+    uint16_t t2_base;
+    uint64_t t2_start;
+    uint64_t t2_due;
+    uint8_t t2_armed;
+    uint16_t t2_count;
+    int t2_event;
+
+    // shift register: bits shifted so far, completion time of timed modes
+    uint8_t sr_bits;
+    uint64_t sr_due;
+    int sr_event;
+    void (*sr_sink)(uint8_t data);
+} via;
+
+static struct mem_io via_io;
+
+/*
+ * =============================================
+ * HELPERS
+ * =============================================
+ */
+
+// ACR decoding
+#define T1_FREE_RUN()   (via.acr & 0x40)
+#define T1_PB7()        (via.acr & 0x80)
+#define T2_PULSES()     (via.acr & 0x20)
+#define SR_MODE()       ((via.acr >> 2) & 0x07)
+
+/**
+ * update_irq: drives the cpu IRQ line from the flag and enable registers
+ * @param void
+ * @return void
+ * */
+static void update_irq(void) {
+    if (via.ifr & via.ier & 0x7F) {
+        cpu_irq_assert(IRQ_SRC_VIA);
+    } else {
+        cpu_irq_release(IRQ_SRC_VIA);
+    }
+}
+
+static void set_ifr(uint8_t bits) {
+    via.ifr |= bits;
+    update_irq();
+}
+
+static void clear_ifr(uint8_t bits) {
+    via.ifr &= ~bits;
+    update_irq();
+}
+
+/**
+ * t1_value: computes the T1 counter from the current cycle. In free-running
+ * mode the counter goes from the latch down to 0xFFFF and reloads, a period
+ * lasts latch + 2 cycles.
+ * @param void
+ * @return the counter
+ * */
+static uint16_t t1_value(void) {
+    uint64_t elapsed = cpu_now() - via.t1_start;
+
+    if (T1_FREE_RUN() && elapsed > (uint64_t)via.t1_base + 1) {
+        elapsed -= (uint64_t)via.t1_base + 2;
+        return via.t1_latch - (uint16_t)(elapsed % ((uint64_t)via.t1_latch + 2));
+    }
+
+    return (uint16_t)(via.t1_base - elapsed);
+}
+
+/**
+ * t2_value: computes the T2 counter from the current cycle
+ * @param void
+ * @return the counter
+ * */
+static uint16_t t2_value(void) {
+    if (T2_PULSES()) return via.t2_count;
+    return (uint16_t)(via.t2_base - (cpu_now() - via.t2_start));
+}
+
+/*
+ * =============================================
+ * EVENTS
+ * =============================================
+ */
+
+/**
+ * t1_expire: T1 reached 0xFFFF. A free-running timer reloads from the latch
+ * on the next cycle and schedules its next expiry, a one-shot keeps counting
+ * down without interrupting again.
+ * @param ctx unused
+ * @return void
+ * */
+static void t1_expire(void* ctx) {
+    (void)ctx;
+    via.t1_event = -1;
+    set_ifr(VIA_INT_T1);
+
+    if (T1_FREE_RUN()) {
+        via.pb7 ^= 1;
+
+        via.t1_start = via.t1_due + 1;
+        via.t1_base = via.t1_latch;
+        via.t1_due = via.t1_start + via.t1_base + 1;
+        via.t1_event = sched_add(via.t1_due, &t1_expire, NULL);
+    } else {
+        via.pb7 = 1;
+    }
+}
+
+static void t2_expire(void* ctx) {
+    (void)ctx;
+    via.t2_event = -1;
+
+    if (via.t2_armed) {
+        via.t2_armed = 0;
+        set_ifr(VIA_INT_T2);
+    }
+}
+
+/**
+ * sr_done: eight bits went through the shift register. Shifting in samples
+ * CB2, shifting out rotates the register back to its original value.
+ * @param ctx unused
+ * @return void
+ * */
+static void sr_done(void* ctx) {
+    (void)ctx;
+    via.sr_event = -1;
+    via.sr_bits = 8;
+
+    if (SR_MODE() < 4) {
+        via.sr = via.cb2 ? 0xFF : 0x00;
+    } else if (via.sr_sink) {
+        via.sr_sink(via.sr);
+    }
+
+    set_ifr(VIA_INT_SR);
+}
+
+/**
+ * sync: runs the expiries that are due at the current bus cycle but haven't
+ * been picked up by the cpu yet (it only checks at the end of instructions),
+ * so reads of the flags within the same instruction are consistent
+ * @param void
+ * @return 1 if an expiry ran, 0 otherwise
+ * */
+static uint8_t sync(void) {
+    uint64_t now = cpu_now();
+    uint8_t fired = 0;
+
+    if (via.t1_event != -1 && via.t1_due <= now) {
+        sched_cancel(via.t1_event);
+        t1_expire(NULL);
+        fired = 1;
+    }
+    if (via.t2_event != -1 && via.t2_due <= now) {
+        sched_cancel(via.t2_event);
+        t2_expire(NULL);
+        fired = 1;
+    }
+    if (via.sr_event != -1 && via.sr_due <= now) {
+        sched_cancel(via.sr_event);
+        sr_done(NULL);
+        fired = 1;
+    }
+
+    return fired;
+}
+
+/**
+ * sr_start: reading or writing the shift register starts a new byte
+ * @param void
+ * @return void
+ * */
+static void sr_start(void) {
+    uint8_t mode = SR_MODE();
+    uint64_t bit_time;
+
+    clear_ifr(VIA_INT_SR);
+    sched_cancel(via.sr_event);
+    via.sr_event = -1;
+    via.sr_bits = 0;
+
+    switch (mode) {
+        case 1:
+        case 5:
+            // T2 low byte sets the CB1 half period
+            bit_time = 2 * ((uint64_t)via.t2_latch + 2);
+            break;
+        case 2:
+        case 6:
+            bit_time = 2;
+            break;
+        default:
+            // disabled, free-running or clocked by CB1
+            return;
+    }
+
+    via.sr_due = cpu_now() + 8 * bit_time;
+    via.sr_event = sched_add(via.sr_due, &sr_done, NULL);
+}
+
+/*
+ * =============================================
+ * BUS INTERFACE
+ * =============================================
+ */
+
+static uint8_t read_port_b(void) {
+    uint8_t val = (via.orb & via.ddrb) | (via.pins_b & ~via.ddrb);
+
+    if (T1_PB7()) val = (val & 0x7F) | (via.pb7 << 7);
+    return val;
+}
+
+static uint8_t read_port_a(void) {
+    return (via.ora & via.ddra) | (via.pins_a & ~via.ddra);
+}
+
+/**
+ * counter_until: first cycle a timer counter read returns something else at.
+ * The counter goes down by one each cycle, the low byte changes on the next
+ * one and the high byte once the low byte wraps.
+ * @param value The counter
+ * @param high 1 for a read of the high byte
+ * @return the cycle
+ * */
+static uint64_t counter_until(uint16_t value, uint8_t high) {
+    return cpu_now() + (high ? (uint64_t)(value & 0xFF) + 1 : 1);
+}
+
+/**
+ * via_read: register reads, some of them acknowledge interrupts. A read that
+ * ran no expiry and acknowledged nothing is quiet (see cpu_quiet_read()), so
+ * a program polling the flags or a counter can be found idle.
+ * @param addr The accessed address, only the low nibble is decoded
+ * @param ctx unused
+ * @return the register value
+ * */
+static uint8_t via_read(uint16_t addr, void* ctx) {
+    (void)ctx;
+    uint8_t ifr = via.ifr;
+    uint8_t fired = sync();
+    uint8_t data = 0;
+    // when the value read changes on its own, see cpu_quiet_read_until()
+    uint64_t until = SCHED_NEVER;
+    uint16_t value;
+
+    switch (addr & 0x0F) {
+        case VIA_ORB:
+            clear_ifr(VIA_INT_CB1 | ((via.pcr & 0x20) ? 0 : VIA_INT_CB2));
+            data = read_port_b();
+            break;
+        case VIA_ORA:
+            clear_ifr(VIA_INT_CA1 | ((via.pcr & 0x02) ? 0 : VIA_INT_CA2));
+            data = read_port_a();
+            break;
+        case VIA_ORA_NH:
+            data = read_port_a();
+            break;
+        case VIA_DDRB:
+            data = via.ddrb;
+            break;
+        case VIA_DDRA:
+            data = via.ddra;
+            break;
+        case VIA_T1CL:
+            clear_ifr(VIA_INT_T1);
+            value = t1_value();
+            data = value & 0xFF;
+            until = counter_until(value, 0);
+            break;
+        case VIA_T1CH:
+            value = t1_value();
+            data = value >> 8;
+            until = counter_until(value, 1);
+            break;
+        case VIA_T1LL:
+            data = via.t1_latch & 0xFF;
+            break;
+        case VIA_T1LH:
+            data = via.t1_latch >> 8;
+            break;
+        case VIA_T2CL:
+            clear_ifr(VIA_INT_T2);
+            value = t2_value();
+            data = value & 0xFF;
+            // counting pulses, only PB6 changes it
+            if (!T2_PULSES()) until = counter_until(value, 0);
+            break;
+        case VIA_T2CH:
+            value = t2_value();
+            data = value >> 8;
+            if (!T2_PULSES()) until = counter_until(value, 1);
+            break;
+        case VIA_SR:
+            // starts shifting the next byte, never quiet
+            sr_start();
+            return via.sr;
+        case VIA_ACR:
+            data = via.acr;
+            break;
+        case VIA_PCR:
+            data = via.pcr;
+            break;
+        case VIA_IFR:
+            data = via.ifr | ((via.ifr & via.ier & 0x7F) ? 0x80 : 0x00);
+            break;
+        case VIA_IER:
+            data = via.ier | 0x80;
+            break;
+    }
+
+    if (!fired && via.ifr == ifr) cpu_quiet_read_until(until);
+
+    return data;
+}
+
+/**
+ * via_write: register writes, loading a timer schedules its expiry
+ * @param addr The accessed address, only the low nibble is decoded
+ * @param data The written value
+ * @param ctx unused
+ * @return void
+ * */
+static void via_write(uint16_t addr, uint8_t data, void* ctx) {
+    (void)ctx;
+    sync();
+
+    switch (addr & 0x0F) {
+        case VIA_ORB:
+            via.orb = data;
+            clear_ifr(VIA_INT_CB1 | ((via.pcr & 0x20) ? 0 : VIA_INT_CB2));
+            break;
+        case VIA_ORA:
+            via.ora = data;
+            clear_ifr(VIA_INT_CA1 | ((via.pcr & 0x02) ? 0 : VIA_INT_CA2));
+            break;
+        case VIA_ORA_NH:
+            via.ora = data;
+            break;
+        case VIA_DDRB:
+            via.ddrb = data;
+            break;
+        case VIA_DDRA:
+            via.ddra = data;
+            break;
+        case VIA_T1CL:
+        case VIA_T1LL:
+            via.t1_latch = (via.t1_latch & 0xFF00) | data;
+            break;
+        case VIA_T1CH:
+            // load the counter on the next cycle and start counting
+            via.t1_latch = (via.t1_latch & 0x00FF) | (data << 8);
+            clear_ifr(VIA_INT_T1);
+
+            via.t1_start = cpu_now() + 1;
+            via.t1_base = via.t1_latch;
+            via.t1_due = via.t1_start + via.t1_base + 1;
+            via.pb7 = 0;
+
+            sched_cancel(via.t1_event);
+            via.t1_event = sched_add(via.t1_due, &t1_expire, NULL);
+            break;
+        case VIA_T1LH:
+            via.t1_latch = (via.t1_latch & 0x00FF) | (data << 8);
+            clear_ifr(VIA_INT_T1);
+            break;
+        case VIA_T2CL:
+            via.t2_latch = data;
+            break;
+        case VIA_T2CH:
+            clear_ifr(VIA_INT_T2);
+            via.t2_armed = 1;
+
+            sched_cancel(via.t2_event);
+            via.t2_event = -1;
+
+            if (T2_PULSES()) {
+                via.t2_count = (data << 8) | via.t2_latch;
+            } else {
+                via.t2_start = cpu_now() + 1;
+                via.t2_base = (data << 8) | via.t2_latch;
+                via.t2_due = via.t2_start + via.t2_base + 1;
+                via.t2_event = sched_add(via.t2_due, &t2_expire, NULL);
+            }
+            break;
+        case VIA_SR:
+            via.sr = data;
+            sr_start();
+            break;
+        case VIA_ACR:
+            via.acr = data;
+            break;
+        case VIA_PCR:
+            via.pcr = data;
+            break;
+        case VIA_IFR:
+            clear_ifr(data & 0x7F);
+            break;
+        case VIA_IER:
+            if (data & 0x80) {
+                via.ier |= data & 0x7F;
+            } else {
+                via.ier &= ~(data & 0x7F);
+            }
+            update_irq();
+            break;
+    }
+}
+
+/*
+ * =============================================
+ * EXTERNAL LINES
+ * =============================================
+ */
+
+/**
+ * edge: tells if a transition matches the active edge selected in the PCR
+ * @param old The previous level
+ * @param level The new level
+ * @param positive 1 if the PCR selects the positive edge
+ * @return 1 on an active transition, 0 otherwise
+ * */
+static uint8_t edge(uint8_t old, uint8_t level, uint8_t positive) {
+    return positive ? (!old && level) : (old && !level);
+}
+
+void via_set_port_a(uint8_t pins) { via.pins_a = pins; }
+
+/**
+ * via_set_port_b: drives the port B input pins, a falling edge on PB6 is
+ * counted by T2 in pulse counting mode
+ * @param pins The levels of the 8 lines
+ * @return void
+ * */
+void via_set_port_b(uint8_t pins) {
+    uint8_t old = via.pins_b;
+    via.pins_b = pins;
+
+    if ((old & 0x40) && !(pins & 0x40)) via_pulse_pb6();
+}
+
+uint8_t via_port_a(void) { return read_port_a(); }
+
+uint8_t via_port_b(void) { return read_port_b(); }
+
+void via_set_ca1(uint8_t level) {
+    if (edge(via.ca1, level, via.pcr & 0x01)) set_ifr(VIA_INT_CA1);
+    via.ca1 = level;
+}
+
+void via_set_ca2(uint8_t level) {
+    // only the input modes (PCR bit 3 clear) sense CA2
+    if (!(via.pcr & 0x08) && edge(via.ca2, level, via.pcr & 0x04)) {
+        set_ifr(VIA_INT_CA2);
+    }
+    via.ca2 = level;
+}
+
+/**
+ * via_set_cb1: drives CB1, which also clocks the shift register in the
+ * external clock modes (a bit per rising edge)
+ * @param level The new level
+ * @return void
+ * */
+void via_set_cb1(uint8_t level) {
+    uint8_t mode = SR_MODE();
+
+    if ((mode == 3 || mode == 7) && via.sr_bits < 8 && !via.cb1 && level) {
+        if (mode == 3) {
+            via.sr = (via.sr << 1) | (via.cb2 & 1);
+        } else {
+            via.sr = (via.sr << 1) | (via.sr >> 7);
+        }
+
+        if (++via.sr_bits == 8) {
+            if (mode == 7 && via.sr_sink) via.sr_sink(via.sr);
+            set_ifr(VIA_INT_SR);
+        }
+    }
+
+    if (edge(via.cb1, level, via.pcr & 0x10)) set_ifr(VIA_INT_CB1);
+    via.cb1 = level;
+}
+
+void via_set_cb2(uint8_t level) {
+    if (!(via.pcr & 0x80) && edge(via.cb2, level, via.pcr & 0x40)) {
+        set_ifr(VIA_INT_CB2);
+    }
+    via.cb2 = level;
+}
+
+/**
+ * via_pulse_pb6: counts a pulse on PB6, T2 interrupts once when the count
+ * reaches zero
+ * @param void
+ * @return void
+ * */
+void via_pulse_pb6(void) {
+    if (!T2_PULSES()) return;
+
+    via.t2_count--;
+    if (via.t2_count == 0 && via.t2_armed) {
+        via.t2_armed = 0;
+        set_ifr(VIA_INT_T2);
+    }
+}
+
+/**
+ * via_on_shift_out: registers a receiver for the bytes shifted out on CB2
+ * @param fn The receiver, NULL to drop them
+ * @return void
+ * */
+void via_on_shift_out(void (*fn)(uint8_t data)) { via.sr_sink = fn; }
+
+/**
+ * via_reset: the reset line clears every register but the timers and the
+ * shift register
+ * @param void
+ * @return void
+ * */
+void via_reset(void) {
+    sched_cancel(via.t1_event);
+    sched_cancel(via.t2_event);
+    sched_cancel(via.sr_event);
+    via.t1_event = via.t2_event = via.sr_event = -1;
+
+    via.ora = via.orb = 0;
+    via.ddra = via.ddrb = 0;
+    via.acr = via.pcr = 0;
+    via.ifr = via.ier = 0;
+    via.t2_armed = 0;
+    via.sr_bits = 8;
+    via.pb7 = 1;
+
+    update_irq();
+}
+
+// the cpu reset line, see mem_io_reset()
+static void via_reset_line(void* ctx) {
+    (void)ctx;
+    via_reset();
+}
+
+/**
+ * via_save: copies the registers and timers for a snapshot
+ * @param state sizeof(via) bytes
+ * @param ctx unused
+ * @return void
+ * */
+static void via_save(uint8_t* state, void* ctx) {
+    (void)ctx;
+    memcpy(state, &via, sizeof(via));
+}
+
+/**
+ * via_restore: brings back a state saved by via_save(), with the expiries
+ * that were pending then (at the cycle they were due). The shift register
+ * output stays with the host that set it.
+ * @param state sizeof(via) bytes
+ * @param ctx unused
+ * @return void
+ * */
+static void via_restore(const uint8_t* state, void* ctx) {
+    (void)ctx;
+    void (*sink)(uint8_t data) = via.sr_sink;
+
+    sched_cancel(via.t1_event);
+    sched_cancel(via.t2_event);
+    sched_cancel(via.sr_event);
+
+    memcpy(&via, state, sizeof(via));
+    via.sr_sink = sink;
+
+    if (via.t1_event != -1) via.t1_event = sched_add(via.t1_due, &t1_expire, NULL);
+    if (via.t2_event != -1) via.t2_event = sched_add(via.t2_due, &t2_expire, NULL);
+    if (via.sr_event != -1) via.sr_event = sched_add(via.sr_due, &sr_done, NULL);
+
+    update_irq();
+}
+
+/**
+ * via_init: Attach the VIA to the bus
+ * @param base The address of the first register
+ * @return void
+ * */
+void via_init(uint16_t base) {
+    memset(&via, 0, sizeof(via));
+    via.t1_event = via.t2_event = via.sr_event = -1;
+    via.pins_a = via.pins_b = 0xFF;
+    via.ca1 = via.ca2 = via.cb1 = via.cb2 = 1;
+    via_reset();
+
+    via_io.read = &via_read;
+    via_io.write = &via_write;
+    via_io.reset = &via_reset_line;
+    via_io.save = &via_save;
+    via_io.restore = &via_restore;
+    via_io.state_size = sizeof(via);
+    via_io.ctx = NULL;
+    mem_map_io(base, 0x10, &via_io);
+
+    debug_print("(via_init) mapped at 0x%X\n", base);
+}
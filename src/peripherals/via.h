@@ -0,0 +1,49 @@
+#ifndef INC_6502_VIA_H
+#define INC_6502_VIA_H
+
+#include <stdint.h>
+
+// default location of the VIA in the address space (mirrored on its page)
+#define VIA_BASE        0x6000
+
+// registers, offset from the base address
+#define VIA_ORB         0x0
+#define VIA_ORA         0x1
+#define VIA_DDRB        0x2
+#define VIA_DDRA        0x3
+#define VIA_T1CL        0x4
+#define VIA_T1CH        0x5
+#define VIA_T1LL        0x6
+#define VIA_T1LH        0x7
+#define VIA_T2CL        0x8
+#define VIA_T2CH        0x9
+#define VIA_SR          0xA
+#define VIA_ACR         0xB
+#define VIA_PCR         0xC
+#define VIA_IFR         0xD
+#define VIA_IER         0xE
+#define VIA_ORA_NH      0xF
+
+// interrupt flag/enable bits
+#define VIA_INT_CA2     (1 << 0)
+#define VIA_INT_CA1     (1 << 1)
+#define VIA_INT_SR      (1 << 2)
+#define VIA_INT_CB2     (1 << 3)
+#define VIA_INT_CB1     (1 << 4)
+#define VIA_INT_T2      (1 << 5)
+#define VIA_INT_T1      (1 << 6)
+
+void via_init(uint16_t base);
+void via_reset(void);
+void via_set_port_a(uint8_t pins);
+void via_set_port_b(uint8_t pins);
+uint8_t via_port_a(void);
+uint8_t via_port_b(void);
+void via_set_ca1(uint8_t level);
+void via_set_ca2(uint8_t level);
+void via_set_cb1(uint8_t level);
+void via_set_cb2(uint8_t level);
+void via_pulse_pb6(void);
+void via_on_shift_out(void (*fn)(uint8_t data));
+
+#endif
@@ -0,0 +1,229 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "reload.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "../cpu/cpu.h"
+#include "../cpu/multi.h"
+#include "../mem/mem.h"
+#include "../mem/shm.h"
+#include "../peripherals/display.h"
+#include "../utils/misc.h"
+
+/**
+ * Hot reload:
+ *
+ * The directory of the program is watched with inotify, so that a rebuild
+ * is seen whether the assembler rewrites the file in place or replaces it
+ * (a rename over it). Only finished writes count: a file still being written
+ * isn't reloaded half way.
+ *
+ * The new file is laid out the way mem_init() does it, then compared with
+ * memory: only the bytes that differ are written, and only their pages lose
+ * their decoded superinstructions (see cpu_written()). Bytes the previous
+ * program covered and the new one doesn't go back to what mem_init() leaves
+ * there, so a program that shrank leaves no tail behind. The rest of the
+ * machine, RAM and registers included, is left alone unless a reset was
+ * asked for. Pages of devices are skipped, they belong to them.
+ *
+ * The readers of the shared memory export wait while the program is being
+ * rewritten, and the display is redrawn whole since the bytes went around
+ * its write snooping.
+ * */
+static struct {
+    int fd;             // inotify, -1 when not watching
+    char path[PATH_MAX];
+    const char* name;   // the file name in path, what the events carry
+    uint8_t reset;
+} reload = {.fd = -1};
+
+// the program as mem_init() would load it, and which addresses it covers
+static uint8_t image[TOTAL_MEM];
+static uint8_t covered[TOTAL_MEM];
+
+// the addresses covered by the program in memory
+static uint8_t loaded[TOTAL_MEM];
+
+/*
+ * =============================================
+ * HELPERS
+ * =============================================
+ */
+
+/**
+ * read_image: reads the program into image[], at ROM and wrapping around
+ *             0xFFFF like mem_init(), with the same reset vector and what
+ *             mem_init() puts where the program isn't
+ * @param void
+ * @return the size of the file, 0 if it can't be read or is empty
+ * */
+static uint32_t read_image(void) {
+    static uint8_t buf[0x4000];
+    uint32_t size = 0;
+    size_t n;
+
+    FILE* fp = fopen(reload.path, "rb");
+    if (!fp) return 0;
+
+    memset(image, 0, sizeof(image));
+    memset(covered, 0, sizeof(covered));
+    for (uint8_t i = 0; i < 6; i++) image[0xFFFA + i] = 0xA + i;
+
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        for (size_t i = 0; i < n; i++, size++) {
+            uint16_t addr = ROM + size;
+
+            image[addr] = buf[i];
+            covered[addr] = 1;
+        }
+    }
+    fclose(fp);
+
+    image[0xFFFC] = ROM & 0xFF;
+    image[0xFFFD] = ROM >> 8;
+    covered[0xFFFC] = covered[0xFFFD] = 1;
+
+    return size;
+}
+
+/**
+ * apply_image: writes the bytes of image[] that differ from memory, where
+ *              the new program or the previous one is
+ * @param void
+ * @return the number of bytes written
+ * */
+static uint32_t apply_image(void) {
+    uint8_t* raw = mem_raw();
+    uint32_t changed = 0;
+
+    for (uint32_t page = 0; page < 0x100; page++) {
+        int32_t first = -1, last = -1;
+
+        // devices and banked pages aren't the program
+        if (mem_io_map[page] || mem_page(page) != raw + (page << 8)) continue;
+
+        for (uint32_t addr = page << 8; addr < (page + 1) << 8; addr++) {
+            if (!(covered[addr] || loaded[addr]) || raw[addr] == image[addr]) continue;
+
+            raw[addr] = image[addr];
+            if (first < 0) first = addr;
+            last = addr;
+            changed++;
+        }
+
+        if (first >= 0) cpu_written(first, last - first + 1);
+    }
+
+    memcpy(loaded, covered, sizeof(loaded));
+    return changed;
+}
+
+/*
+ * =============================================
+ * API
+ * =============================================
+ */
+
+/**
+ * reload_default_config: Fills a config with the default settings
+ * @param cfg The config
+ * @return void
+ * */
+void reload_default_config(struct reload_config* cfg) {
+    cfg->path = NULL;
+    cfg->reset = 0;
+}
+
+/**
+ * reload_init: Start watching the program for changes
+ * @param cfg The settings
+ * @return 0 if success, 1 if failure
+ * */
+int reload_init(const struct reload_config* cfg) {
+    char dir[PATH_MAX];
+    char* slash;
+
+    if (!cfg->path || !*cfg->path || strlen(cfg->path) >= sizeof(reload.path)) {
+        fprintf(stderr, "[x] RELOAD -> there is no program file to watch\n");
+        return 1;
+    }
+
+    strcpy(reload.path, cfg->path);
+    strcpy(dir, cfg->path);
+    reload.reset = cfg->reset;
+
+    slash = strrchr(dir, '/');
+    if (slash) {
+        reload.name = reload.path + (slash - dir) + 1;
+        if (slash == dir) slash++;
+        *slash = '\0';
+    } else {
+        reload.name = reload.path;
+        strcpy(dir, ".");
+    }
+
+    reload.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (reload.fd < 0) {
+        fprintf(stderr, "[x] RELOAD -> inotify: %s\n", strerror(errno));
+        return 1;
+    }
+
+    if (inotify_add_watch(reload.fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        fprintf(stderr, "[x] RELOAD -> can't watch \"%s\": %s\n", dir, strerror(errno));
+        close(reload.fd);
+        reload.fd = -1;
+        return 1;
+    }
+
+    // what mem_init() loaded, from the same file
+    if (read_image()) memcpy(loaded, covered, sizeof(loaded));
+
+    debug_print("(reload_init) watching \"%s\" in \"%s\"\n", reload.name, dir);
+    return 0;
+}
+
+/**
+ * reload_poll: Reload the program if it changed since the last call, never
+ *              waits. Must be called between runs, with the main cpu loaded
+ * @param void
+ * @return 1 if it was reloaded, 0 if not
+ * */
+uint8_t reload_poll(void) {
+    union {
+        struct inotify_event ev;
+        char buf[4096];
+    } events;
+    uint8_t changed = 0;
+    ssize_t len;
+
+    if (reload.fd < 0) return 0;
+
+    while ((len = read(reload.fd, events.buf, sizeof(events.buf))) > 0) {
+        for (ssize_t pos = 0; pos < len;) {
+            const struct inotify_event* ev = (const struct inotify_event*)(events.buf + pos);
+
+            if (ev->len && strcmp(ev->name, reload.name) == 0) changed = 1;
+            pos += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+
+    // an empty file is a build that failed, keep the program running
+    if (!changed || read_image() == 0) return 0;
+
+    shm_begin();
+    uint32_t bytes = apply_image();
+    if (reload.reset) multi_reset();
+    shm_end();
+
+    display_invalidate();
+
+    debug_print("(reload_poll) %u bytes changed\n", bytes);
+    return 1;
+}
@@ -0,0 +1,15 @@
+#ifndef INC_6502_RELOAD_H
+#define INC_6502_RELOAD_H
+
+#include <stdint.h>
+
+struct reload_config {
+    const char* path;   // the program, as given to mem_init()
+    uint8_t reset;      // reset the cpus after a reload, or keep running
+};
+
+void reload_default_config(struct reload_config* cfg);
+int reload_init(const struct reload_config* cfg);
+uint8_t reload_poll(void);
+
+#endif
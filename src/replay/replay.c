@@ -0,0 +1,314 @@
+#include "replay.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../cpu/cpu.h"
+#include "../cpu/multi.h"
+#include "../mem/mem.h"
+#include "../peripherals/keyboard.h"
+#include "../peripherals/uart.h"
+
+/**
+ * Record/replay:
+ *
+ * A run is a function of the machine it starts from and of what comes from
+ * the outside: keys, resets and the bytes the UART receives. Everything else
+ * (timers, interrupts, the display...) follows from them. Recording logs
+ * each input with the cycle it took effect at, replaying feeds them back at
+ * those same cycles: the runs are identical however fast they go.
+ *
+ * Inputs only ever take effect between instructions: keys, resets and the
+ * UART's input (looked for once per slice of the run, see uart_poll()) all
+ * come in between cpu_run() calls. The replay caps each run at the next
+ * event's cycle, which is then always an instruction boundary.
+ *
+ * The log ends with a hash of the machine, the replay checks it.
+ * */
+struct event {
+    uint64_t cycle;
+    uint8_t type;
+    uint32_t len;
+    const uint8_t* data;
+};
+
+// recording
+static FILE* out = NULL;
+static uint64_t last_cycle = 0;
+
+// replaying
+static uint8_t* file = NULL;
+static struct event* events = NULL;
+static uint32_t count = 0, next = 0;
+static uint8_t over = 0;
+static char verdict[96];
+
+/*
+ * =============================================
+ * HELPERS
+ * =============================================
+ */
+
+/**
+ * machine_hash: FNV-1a of the memory, registers and clock, then of the banks
+ *               selected when memory is banked
+ * @param void
+ * @return the hash
+ * */
+static uint64_t machine_hash(void) {
+    uint8_t regs[] = {cpu.pc & 0xFF, cpu.pc >> 8, cpu.ac, cpu.x, cpu.y, cpu.sp, cpu.sr};
+    uint64_t h = 14695981039346656037ULL;
+
+    for (uint16_t page = 0; page < 0x100; page++) {
+        const uint8_t* bytes = mem_page(page);
+        for (uint16_t i = 0; i < 0x100; i++) h = (h ^ bytes[i]) * 1099511628211ULL;
+    }
+    for (uint32_t i = 0; i < sizeof(regs); i++) h = (h ^ regs[i]) * 1099511628211ULL;
+    for (uint32_t i = 0; i < 8; i++) h = (h ^ ((cpu_clock >> (i * 8)) & 0xFF)) * 1099511628211ULL;
+
+    // machines without banks keep the hash they always had
+    if (mem_select_banks) {
+        for (uint32_t i = 0; i < sizeof(mem_banks); i++) h = (h ^ mem_banks[i]) * 1099511628211ULL;
+    }
+
+    return h;
+}
+
+static void put_varint(uint64_t v) {
+    while (v >= 0x80) {
+        fputc((v & 0x7F) | 0x80, out);
+        v >>= 7;
+    }
+    fputc(v, out);
+}
+
+static void put_u64(uint64_t v) {
+    for (int i = 0; i < 8; i++) fputc((v >> (i * 8)) & 0xFF, out);
+}
+
+/**
+ * get_varint: reads a varint of the log
+ * @param pos Position in the log, advanced
+ * @param size Size of the log
+ * @param v The value
+ * @return 0 if success, 1 if the log is truncated
+ * */
+static int get_varint(uint32_t* pos, uint32_t size, uint64_t* v) {
+    *v = 0;
+
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (*pos >= size) return 1;
+
+        uint8_t b = file[(*pos)++];
+        *v |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) return 0;
+    }
+    return 1;
+}
+
+static uint64_t get_u64(const uint8_t* p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) v |= (uint64_t)p[i] << (i * 8);
+    return v;
+}
+
+/*
+ * =============================================
+ * RECORDING
+ * =============================================
+ */
+
+// the recording ends with the emulator
+static void finish_recording(void) {
+    if (!out) return;
+
+    replay_log(REPLAY_END, NULL, 0);
+    fclose(out);
+    out = NULL;
+}
+
+/**
+ * replay_record: Start recording the inputs, from the current state of the
+ *                machine
+ * @param path The log file
+ * @return 0 if success, 1 if failure
+ * */
+int replay_record(const char* path) {
+    out = fopen(path, "wb");
+    if (!out) {
+        fprintf(stderr, "[x] RECORD -> can't create \"%s\"\n", path);
+        return 1;
+    }
+
+    fwrite(REPLAY_MAGIC, 1, 8, out);
+    put_u64(machine_hash());
+    last_cycle = cpu_clock;
+
+    atexit(finish_recording);
+    return 0;
+}
+
+/**
+ * replay_log: Log an input, taking effect at the current cycle
+ * @param type The REPLAY_* type
+ * @param data The payload (key, UART bytes)
+ * @param len Its length
+ * @return void
+ * */
+void replay_log(uint8_t type, const uint8_t* data, uint32_t len) {
+    if (!out) return;
+
+    put_varint(cpu_clock - last_cycle);
+    last_cycle = cpu_clock;
+    fputc(type, out);
+
+    switch (type) {
+        case REPLAY_KEY:
+            fputc(data[0], out);
+            break;
+
+        case REPLAY_UART:
+            put_varint(len);
+            fwrite(data, 1, len, out);
+            break;
+
+        case REPLAY_END:
+            put_u64(machine_hash());
+            break;
+    }
+}
+
+uint8_t replay_recording(void) { return out != NULL; }
+
+/*
+ * =============================================
+ * REPLAYING
+ * =============================================
+ */
+
+static void report(void) {
+    if (verdict[0]) fprintf(stderr, "%s\n", verdict);
+}
+
+/**
+ * replay_open: Load a log to replay, the machine must be in the state it
+ *              was recorded from
+ * @param path The log file
+ * @return 0 if success, 1 if failure
+ * */
+int replay_open(const char* path) {
+    FILE* fp = fopen(path, "rb");
+    if (!fp) {
+        fprintf(stderr, "[x] REPLAY -> can't open \"%s\"\n", path);
+        return 1;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    file = malloc(size > 0 ? size : 1);
+    if (!file || fread(file, 1, size, fp) != (size_t)size || size < 16 ||
+        memcmp(file, REPLAY_MAGIC, 8) != 0) {
+        fprintf(stderr, "[x] REPLAY -> \"%s\" isn't an input log\n", path);
+        fclose(fp);
+        return 1;
+    }
+    fclose(fp);
+
+    if (get_u64(file + 8) != machine_hash()) {
+        fprintf(stderr, "[x] REPLAY -> the log was recorded from another program or setup\n");
+        return 1;
+    }
+
+    // one event takes at least 2 bytes
+    events = malloc((size / 2 + 1) * sizeof(*events));
+    if (!events) return 1;
+
+    uint32_t pos = 16;
+    uint64_t cycle = cpu_clock;
+
+    while (pos < (uint32_t)size) {
+        struct event* e = &events[count];
+        uint64_t delta, len = 0;
+
+        if (get_varint(&pos, size, &delta) || pos >= (uint32_t)size) break;
+        e->cycle = cycle += delta;
+        e->type = file[pos++];
+
+        if (e->type == REPLAY_KEY) len = 1;
+        if (e->type == REPLAY_END) len = 8;
+        if (e->type == REPLAY_UART && get_varint(&pos, size, &len)) break;
+        if (pos + len > (uint64_t)size) break;
+
+        e->len = len;
+        e->data = file + pos;
+        pos += len;
+        count++;
+    }
+
+    if (pos < (uint32_t)size) fprintf(stderr, "[!] REPLAY -> the log is truncated\n");
+
+    atexit(report);
+    return 0;
+}
+
+// replay_playing: whether logged inputs are still to come, the input is live after
+uint8_t replay_playing(void) { return events != NULL && next < count; }
+
+// replay_over: whether the replay reached the end of the recording
+uint8_t replay_over(void) { return over; }
+
+/**
+ * replay_budget: Caps a cycle budget so that the run stops on the next event
+ * @param budget The cycles the caller wants to run
+ * @return the cycles it may run, 0 if an event is due now
+ * */
+uint64_t replay_budget(uint64_t budget) {
+    if (!replay_playing()) return budget;
+
+    uint64_t due = events[next].cycle;
+    uint64_t room = due > cpu_clock ? due - cpu_clock : 0;
+
+    return room < budget ? room : budget;
+}
+
+/**
+ * replay_deliver: Apply the events due by the current cycle, to be called
+ *                 between runs
+ * @param void
+ * @return void
+ * */
+void replay_deliver(void) {
+    while (replay_playing() && events[next].cycle <= cpu_clock) {
+        const struct event* e = &events[next++];
+
+        switch (e->type) {
+            case REPLAY_KEY:
+                keyboard_press(e->data[0]);
+                break;
+
+            case REPLAY_RESET:
+                multi_reset();
+                break;
+
+            case REPLAY_UART:
+                uart_receive(e->data, e->len);
+                break;
+
+            case REPLAY_UART_EOF:
+                uart_receive(NULL, 0);
+                break;
+
+            case REPLAY_END:
+                over = 1;
+                snprintf(verdict, sizeof(verdict), "[replay] %s at cycle %llu",
+                         get_u64(e->data) == machine_hash() ? "identical to the recording"
+                                                            : "DIVERGED from the recording",
+                         (unsigned long long)cpu_clock);
+                break;
+        }
+    }
+}
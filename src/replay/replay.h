@@ -0,0 +1,29 @@
+#ifndef INC_6502_REPLAY_H
+#define INC_6502_REPLAY_H
+
+#include <stdint.h>
+
+/*
+ * Input log: the magic, then the hash of the machine when recording started,
+ * then the events. Each event is a varint of the cycles elapsed since the
+ * previous one, a type and its payload:
+ * */
+#define REPLAY_KEY          1   // u8 key, given to the keyboard register
+#define REPLAY_RESET        2   // reset from the keyboard
+#define REPLAY_UART         3   // varint length, the bytes the UART received
+#define REPLAY_UART_EOF     4   // the UART input is over
+#define REPLAY_END          5   // u64 hash of the machine, the recording stops
+
+#define REPLAY_MAGIC        "6502RPL1"
+
+int replay_record(const char* path);
+int replay_open(const char* path);
+uint8_t replay_recording(void);
+uint8_t replay_playing(void);
+uint8_t replay_over(void);
+
+void replay_log(uint8_t type, const uint8_t* data, uint32_t len);
+uint64_t replay_budget(uint64_t budget);
+void replay_deliver(void);
+
+#endif
@@ -0,0 +1,147 @@
+/*
+ * Bus traces of the cycle-stepped core, run by `make check`. A device mapped
+ * over the whole bus records every access with its cycle, and each program
+ * must produce the accesses of the real chip, one per cycle, dummy ones
+ * included.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../src/cpu/cpu.h"
+#include "../src/lib/emu6502.h"
+#include "../src/mem/mem.h"
+
+#ifndef CPU_CYCLE_STEPPED
+#error "the bus traces need the cycle-stepped core, build with -DCPU_CYCLE_STEPPED"
+#endif
+
+static int failures = 0;
+
+#define CHECK(cond, ...)                                \
+    do {                                                \
+        if (!(cond)) {                                  \
+            fprintf(stderr, "[x] %s: ", __func__);      \
+            fprintf(stderr, __VA_ARGS__);               \
+            fprintf(stderr, "\n");                      \
+            failures++;                                 \
+        }                                               \
+    } while (0)
+
+#define TRACE_MAX 16
+
+struct access {
+    uint16_t addr;
+    uint8_t write;
+};
+
+// what the device saw, and the memory behind it
+static struct access trace[TRACE_MAX];
+static uint64_t trace_cycles[TRACE_MAX];
+static uint32_t traced = 0;
+static uint8_t bus[0x10000];
+
+static struct mem_io recorder;
+
+static void record(uint16_t addr, uint8_t write) {
+    if (traced < TRACE_MAX) {
+        trace[traced] = (struct access){addr, write};
+        trace_cycles[traced] = cpu_now();
+    }
+    traced++;
+}
+
+static uint8_t recorder_read(uint16_t addr, void* ctx) {
+    record(addr, 0);
+    return bus[addr];
+}
+
+static void recorder_write(uint16_t addr, uint8_t data, void* ctx) {
+    record(addr, 1);
+    bus[addr] = data;
+}
+
+/*
+ * One step of a program with sp = $FD and every flag clear. $14/$15 point at
+ * $3000 for (zp,X). The IRQ case takes the interrupt after its CLC.
+ * */
+static const struct {
+    const char* name;
+    uint16_t at;
+    uint8_t prog[3];
+    uint8_t x;
+    uint8_t irq;
+    uint32_t len;
+    struct access want[TRACE_MAX];
+} traces[] = {
+    {"LDA abs,X across a page", 0x0200, {0xBD, 0xFF, 0x12}, 1, 0, 5,
+     {{0x0200, 0}, {0x0201, 0}, {0x0202, 0}, {0x1200, 0}, {0x1300, 0}}},
+    {"STA abs,X", 0x0200, {0x9D, 0x00, 0x12}, 1, 0, 5,
+     {{0x0200, 0}, {0x0201, 0}, {0x0202, 0}, {0x1201, 0}, {0x1201, 1}}},
+    {"INC zp", 0x0200, {0xE6, 0x10}, 0, 0, 5,
+     {{0x0200, 0}, {0x0201, 0}, {0x0010, 0}, {0x0010, 1}, {0x0010, 1}}},
+    {"LDA (zp,X)", 0x0200, {0xA1, 0x10}, 4, 0, 6,
+     {{0x0200, 0}, {0x0201, 0}, {0x0010, 0}, {0x0014, 0}, {0x0015, 0}, {0x3000, 0}}},
+    {"PLA", 0x0200, {0x68}, 0, 0, 4, {{0x0200, 0}, {0x0201, 0}, {0x01FD, 0}, {0x01FE, 0}}},
+    {"JSR", 0x0200, {0x20, 0x34, 0x12}, 0, 0, 6,
+     {{0x0200, 0}, {0x0201, 0}, {0x01FD, 0}, {0x01FD, 1}, {0x01FC, 1}, {0x0202, 0}}},
+    {"BNE taken across a page", 0x02FD, {0xD0, 0x10}, 0, 0, 4,
+     {{0x02FD, 0}, {0x02FE, 0}, {0x02FF, 0}, {0x020F, 0}}},
+    {"BRK", 0x0200, {0x00}, 0, 0, 7,
+     {{0x0200, 0}, {0x0201, 0}, {0x01FD, 1}, {0x01FC, 1}, {0x01FB, 1}, {0xFFFE, 0}, {0xFFFF, 0}}},
+    {"IRQ after CLC", 0x0200, {0x18}, 0, 1, 9,
+     {{0x0200, 0}, {0x0201, 0}, {0x0201, 0}, {0x0201, 0}, {0x01FD, 1}, {0x01FC, 1}, {0x01FB, 1},
+      {0xFFFE, 0}, {0xFFFF, 0}}},
+};
+
+// every access of the real chip, in order and on consecutive cycles
+static void bus_traces(void) {
+    emu6502* emu = emu6502_create();
+
+    recorder.read = &recorder_read;
+    recorder.write = &recorder_write;
+    mem_map_io(0x0000, 0xFFFF, &recorder);
+
+    for (size_t i = 0; i < sizeof(traces) / sizeof(traces[0]); i++) {
+        memset(bus, 0, sizeof(bus));
+        memcpy(bus + traces[i].at, traces[i].prog, sizeof(traces[i].prog));
+        bus[0x14] = 0x00;
+        bus[0x15] = 0x30;
+
+        emu6502_set_regs(emu, &(struct emu6502_regs){.pc = traces[i].at, .sp = 0xFD, .x = traces[i].x});
+        if (traces[i].irq) emu6502_irq(emu, 1);
+
+        traced = 0;
+        uint32_t cycles = emu6502_step(emu);
+        if (traces[i].irq) emu6502_irq(emu, 0);
+
+        CHECK(traced == traces[i].len && cycles == traces[i].len, "%s: %u accesses in %u cycles, want %u",
+              traces[i].name, traced, cycles, traces[i].len);
+
+        for (uint32_t n = 0; n < traced && n < traces[i].len; n++) {
+            const struct access* want = &traces[i].want[n];
+
+            CHECK(trace[n].addr == want->addr && trace[n].write == want->write,
+                  "%s: cycle %u %s $%04X, want %s $%04X", traces[i].name, n, trace[n].write ? "wrote" : "read",
+                  trace[n].addr, want->write ? "write" : "read", want->addr);
+            CHECK(trace_cycles[n] == trace_cycles[0] + n, "%s: access %u on cycle +%llu", traces[i].name, n,
+                  (unsigned long long)(trace_cycles[n] - trace_cycles[0]));
+        }
+    }
+
+    mem_map_io(0x0000, 0xFFFF, NULL);
+    emu6502_destroy(emu);
+}
+
+int main(void) {
+    bus_traces();
+
+    if (failures) {
+        fprintf(stderr, "[x] %d check(s) failed\n", failures);
+        return 1;
+    }
+
+    printf("[-!-] bus traces match\n");
+    return 0;
+}
@@ -0,0 +1,698 @@
+/*
+ * Regression checks of the core, run by `make check`. Each check prints what
+ * went wrong and the run fails if any did.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../src/cpu/batch.h"
+#include "../src/cpu/cpu.h"
+#include "../src/cpu/multi.h"
+#include "../src/cpu/sched.h"
+#include "../src/fuzz/fuzz.h"
+#include "../src/lib/emu6502.h"
+#include "../src/mem/lz.h"
+#include "../src/mem/snapshot.h"
+#include "../src/peripherals/mapper.h"
+#include "../src/peripherals/via.h"
+
+static int failures = 0;
+
+#define CHECK(cond, ...)                                \
+    do {                                                \
+        if (!(cond)) {                                  \
+            fprintf(stderr, "[x] %s: ", __func__);      \
+            fprintf(stderr, __VA_ARGS__);               \
+            fprintf(stderr, "\n");                      \
+            failures++;                                 \
+        }                                               \
+    } while (0)
+
+/*
+ * LDY #0, then a copy loop the core runs natively (LDA (src),Y / STA
+ * (dst),Y / INY / BNE) from $0300 to $0400, then BRK. The IRQ handler at
+ * $9000 is a BRK too.
+ * */
+static const uint8_t copy_prog[] = {0xA0, 0x00, 0xB1, 0x20, 0x91, 0x22, 0xC8, 0xD0, 0xF9, 0x00};
+
+static emu6502* copy_machine(void) {
+    emu6502* emu = emu6502_create();
+    const uint8_t ptrs[] = {0x00, 0x03, 0x00, 0x04};
+    const uint8_t vector[] = {0x00, 0x90};
+
+    emu6502_load_mem(emu, copy_prog, sizeof(copy_prog), 0x8000);
+    emu6502_load_mem(emu, ptrs, sizeof(ptrs), 0x0020);
+    emu6502_load_mem(emu, vector, sizeof(vector), 0xFFFE);
+    emu6502_reset(emu);
+    return emu;
+}
+
+// a step with an interrupt pending runs one instruction, then the interrupt
+static void step_with_pending_irq(void) {
+    emu6502* emu = copy_machine();
+    struct emu6502_regs regs;
+
+    emu6502_step(emu);
+    emu6502_irq(emu, 1);
+    uint32_t cycles = emu6502_step(emu);
+    emu6502_get_regs(emu, &regs);
+
+    CHECK(regs.pc == 0x9000 && regs.y == 0, "pc=$%04X y=%u after the step", regs.pc, regs.y);
+    CHECK(cycles <= 5 + 7, "the step took %u cycles", cycles);
+
+    emu6502_destroy(emu);
+}
+
+// swapping machines in forces a check at the next instruction, a step must
+// still run a single one
+static void step_after_swap(void) {
+    emu6502* a = copy_machine();
+    emu6502* b = copy_machine();
+    struct emu6502_regs regs;
+
+    emu6502_step(a);
+    emu6502_step(b);
+    uint32_t cycles = emu6502_step(a);
+    emu6502_get_regs(a, &regs);
+
+    CHECK(regs.pc == 0x8004 && cycles <= 6, "pc=$%04X after %u cycles", regs.pc, cycles);
+
+    emu6502_destroy(a);
+    emu6502_destroy(b);
+}
+
+// with a quantum of 1 a co-processor on a copy loop stays in step with the
+// main cpu
+static void lockstep_coprocessor(void) {
+    emu6502* emu = copy_machine();
+    // main cpu: INC $10 / JMP $9100, the co-processor runs the copy loop
+    const uint8_t busy[] = {0xE6, 0x10, 0x4C, 0x00, 0x91};
+
+    emu6502_load_mem(emu, busy, sizeof(busy), 0x9100);
+    emu6502_set_regs(emu, &(struct emu6502_regs){.pc = 0x9100, .sp = 0xFD});
+    emu6502_step(emu);
+
+    multi_init(1);
+    multi_add(0x8000);
+    multi_run(100, 0, NULL);
+
+    uint64_t main_clock = cpu_clock;
+    multi_select(1);
+    uint64_t co_clock = cpu_clock;
+    uint8_t copied = cpu.y;
+    multi_select(0);
+
+    CHECK(co_clock <= main_clock + 7, "co-processor at cycle %llu, main cpu at %llu",
+          (unsigned long long)co_clock, (unsigned long long)main_clock);
+    CHECK(copied < 16, "co-processor copied %u bytes in 100 cycles", copied);
+
+    multi_init(0);
+    emu6502_destroy(emu);
+}
+
+// run_until goes past breakpoints set by others and leaves them set, the one
+// on its own address included
+static void run_until_keeps_breakpoints(void) {
+    emu6502* emu = copy_machine();
+    struct emu6502_regs regs;
+
+    cpu_set_breakpoint(0x8006, 1);
+    cpu_set_breakpoint(0x8009, 1);
+    int stopped = emu6502_run_until(emu, 0x8009, NULL, NULL, 100000);
+    emu6502_get_regs(emu, &regs);
+
+    CHECK(stopped && regs.pc == 0x8009, "stopped=%d at pc=$%04X", stopped, regs.pc);
+    CHECK(cpu_set_breakpoint(0x8006, 0) == 1, "the breakpoint on the loop is gone");
+    CHECK(cpu_set_breakpoint(0x8009, 0) == 1, "the breakpoint on the target is gone");
+
+    emu6502_destroy(emu);
+}
+
+// every handle tracks the pages written since its own last snapshot
+static void dirty_pages_per_handle(void) {
+    emu6502* a = emu6502_create();
+    emu6502* b = emu6502_create();
+    struct snapshot* snap = malloc(sizeof(*snap));
+    struct emu6502_regs regs;
+
+    emu6502_get_regs(a, &regs);
+    snapshot_save(snap);
+    emu6502_write(a, 0x4000, 0x55);
+
+    emu6502_snapshot_free(emu6502_snapshot_save(b));
+
+    emu6502_get_regs(a, &regs);
+    snapshot_restore_dirty(snap);
+    uint8_t data = emu6502_read(a, 0x4000);
+    CHECK(data == 0x00, "read $%02X after restoring the dirty pages", data);
+
+    free(snap);
+    emu6502_destroy(a);
+    emu6502_destroy(b);
+}
+
+/*
+ * LDA $10 / ADC $11 / STA $20 / PHP / SBC $12 / STA $21 / PHP / AND $13 /
+ * EOR $14 / ORA $15 / STA $22 / PHP / CMP $16 / PHP / CPX $17 / PHP / BRK
+ * */
+static const uint8_t alu_prog[] = {
+    0xA5, 0x10, 0x65, 0x11, 0x85, 0x20, 0x08, 0xE5, 0x12, 0x85, 0x21, 0x08, 0x25, 0x13,
+    0x45, 0x14, 0x05, 0x15, 0x85, 0x22, 0x08, 0xC5, 0x16, 0x08, 0xE4, 0x17, 0x08, 0x00,
+};
+
+// the lane kernels (AVX2 ones when the host has it) agree with the core, in
+// binary and decimal mode, on a variant selected after the lanes were made
+static void batch_matches_core(const char* variant) {
+    struct batch b;
+    emu6502* emu = emu6502_create();
+    uint32_t seed = 12345;
+
+    if (batch_init(&b, BATCH_LANES)) {
+        CHECK(0, "batch_init failed");
+        return;
+    }
+    emu6502_set_cpu(variant);
+
+    for (uint8_t l = 0; l < BATCH_LANES; l++) {
+        uint8_t* m = batch_mem(&b, l);
+
+        memcpy(m + 0x8000, alu_prog, sizeof(alu_prog));
+        for (uint8_t i = 0x10; i < 0x18; i++) {
+            seed = seed * 1103515245 + 12345;
+            m[i] = seed >> 16;
+        }
+        b.x[l] = seed >> 8;
+        b.sr[l] = (l & 1 ? 1 << D : 0) | (l & 2 ? 1 << C : 0);
+    }
+
+    // the results and the flags pushed, as the core computes them
+    struct emu6502_regs regs[BATCH_LANES];
+    uint8_t results[BATCH_LANES][3], pushed[BATCH_LANES][4];
+
+    for (uint8_t l = 0; l < BATCH_LANES; l++) {
+        regs[l] = (struct emu6502_regs){.pc = 0x8000, .sp = b.sp[l], .x = b.x[l], .sr = b.sr[l]};
+
+        emu6502_load_mem(emu, batch_mem(&b, l), 0x10000, 0);
+        emu6502_set_regs(emu, &regs[l]);
+        while (emu6502_read(emu, regs[l].pc) != 0x00) {
+            emu6502_step(emu);
+            emu6502_get_regs(emu, &regs[l]);
+        }
+
+        emu6502_read_block(emu, 0x20, results[l], sizeof(results[l]));
+        emu6502_read_block(emu, 0x100 + regs[l].sp + 1, pushed[l], sizeof(pushed[l]));
+    }
+
+    batch_run(&b, 1000);
+
+    for (uint8_t l = 0; l < BATCH_LANES; l++) {
+        const uint8_t* m = batch_mem(&b, l);
+
+        CHECK(regs[l].a == b.a[l] && regs[l].sr == b.sr[l] && regs[l].sp == b.sp[l],
+              "%s lane %u: a=$%02X sr=$%02X, the core gives $%02X $%02X", variant, l, b.a[l], b.sr[l],
+              regs[l].a, regs[l].sr);
+        CHECK(memcmp(results[l], m + 0x20, 3) == 0 && memcmp(pushed[l], m + 0x100 + b.sp[l] + 1, 4) == 0,
+              "%s lane %u: results or pushed flags differ from the core", variant, l);
+    }
+
+    emu6502_set_cpu("nmos");
+    batch_free(&b);
+    emu6502_destroy(emu);
+}
+
+// snapshots bring the banks back with the memory, and restore the window
+// into the bank it was saved from. The mapper stays on the bus, it must run
+// last
+static void snapshot_keeps_banks(void) {
+    static uint8_t rom[4 * MAPPER_ROM_BANK_SIZE];
+    char path[] = "/tmp/check_banks.XXXXXX";
+    int fd = mkstemp(path);
+
+    // each bank is filled with 0x10 + its number
+    for (uint32_t i = 0; i < sizeof(rom); i++) rom[i] = 0x10 + i / MAPPER_ROM_BANK_SIZE;
+    if (fd < 0 || write(fd, rom, sizeof(rom)) != (ssize_t)sizeof(rom)) {
+        CHECK(0, "can't write the image");
+        return;
+    }
+    close(fd);
+
+    struct mapper_config cfg;
+    mapper_default_config(&cfg);
+    cfg.rom = path;
+    cfg.ram_banks = 2;
+
+    cpu_init();
+    int failed = mapper_init(&cfg);
+    unlink(path);
+    if (failed) {
+        CHECK(0, "mapper_init failed");
+        return;
+    }
+
+    struct snapshot* snap = malloc(sizeof(*snap));
+    cpu_write(MAPPER_BASE + MAPPER_ROM_BANK, 1);
+    cpu_write(MAPPER_BASE + MAPPER_RAM_BANK, 1);
+    cpu_write(MAPPER_RAM_WINDOW, 0xAA);
+    snapshot_save(snap);
+    struct snapshot_packed* packed = snapshot_pack(NULL);
+
+    for (uint8_t pass = 0; pass < 2; pass++) {
+        cpu_write(MAPPER_BASE + MAPPER_ROM_BANK, 2);
+        cpu_write(MAPPER_BASE + MAPPER_RAM_BANK, 0);
+        cpu_write(MAPPER_RAM_WINDOW, 0x55);
+
+        if (pass == 0) {
+            snapshot_restore(snap);
+        } else {
+            snapshot_unpack(packed);
+        }
+
+        uint8_t rom_bank = cpu_fetch(MAPPER_BASE + MAPPER_ROM_BANK);
+        uint8_t ram_bank = cpu_fetch(MAPPER_BASE + MAPPER_RAM_BANK);
+        uint8_t rom_byte = cpu_fetch(ROM), ram_byte = cpu_fetch(MAPPER_RAM_WINDOW);
+
+        CHECK(rom_bank == 1 && ram_bank == 1, "pass %u: banks %u and %u after the restore", pass,
+              rom_bank, ram_bank);
+        CHECK(rom_byte == 0x11 && ram_byte == 0xAA, "pass %u: read $%02X from ROM, $%02X from RAM",
+              pass, rom_byte, ram_byte);
+
+        // the write to bank 0 is still there
+        cpu_write(MAPPER_BASE + MAPPER_RAM_BANK, 0);
+        ram_byte = cpu_fetch(MAPPER_RAM_WINDOW);
+        CHECK(ram_byte == 0x55, "pass %u: bank 0 holds $%02X", pass, ram_byte);
+    }
+
+    free(packed);
+    free(snap);
+}
+
+/*
+ * NMOS decimal mode, from Bruce Clark's "Decimal Mode in NMOS 6500 series"
+ * (his examples first): ADC sets N and V from the half-adjusted sum and Z
+ * from the binary one, SBC sets every flag like a binary subtraction.
+ * Invalid BCD operands included.
+ * */
+static const struct {
+    uint8_t opcode;         // ADC # or SBC #
+    uint8_t a, b, carry;
+    uint8_t result, flags;  // N V Z C
+} decimal_vectors[] = {
+    {0x69, 0x00, 0x00, 0, 0x00, 0x02}, {0x69, 0x79, 0x00, 1, 0x80, 0xC0},
+    {0x69, 0x24, 0x56, 0, 0x80, 0xC0}, {0x69, 0x93, 0x82, 0, 0x75, 0x41},
+    {0x69, 0x89, 0x76, 0, 0x65, 0x01}, {0x69, 0x89, 0x76, 1, 0x66, 0x03},
+    {0x69, 0x80, 0xF0, 0, 0xD0, 0x41}, {0x69, 0x80, 0xFA, 0, 0xE0, 0x81},
+    {0x69, 0x2F, 0x4F, 0, 0x74, 0x00}, {0x69, 0x6F, 0x00, 1, 0x76, 0x00},
+    {0x69, 0x99, 0x01, 0, 0x00, 0x81}, {0x69, 0x58, 0x46, 1, 0x05, 0xC1},
+    {0x69, 0x15, 0x26, 0, 0x41, 0x00}, {0x69, 0x81, 0x92, 0, 0x73, 0x41},
+    {0x69, 0x99, 0x99, 1, 0x99, 0x41},
+    {0xE9, 0x00, 0x00, 0, 0x99, 0x80}, {0xE9, 0x00, 0x00, 1, 0x00, 0x03},
+    {0xE9, 0x00, 0x01, 1, 0x99, 0x80}, {0xE9, 0x0A, 0x00, 1, 0x0A, 0x01},
+    {0xE9, 0x0B, 0x00, 0, 0x0A, 0x01}, {0xE9, 0x9A, 0x00, 1, 0x9A, 0x81},
+    {0xE9, 0x9B, 0x00, 0, 0x9A, 0x81}, {0xE9, 0x40, 0x13, 1, 0x27, 0x01},
+    {0xE9, 0x32, 0x02, 0, 0x29, 0x01}, {0xE9, 0x21, 0x34, 1, 0x87, 0x80},
+    {0xE9, 0x80, 0x01, 1, 0x79, 0x41}, {0xE9, 0x50, 0x60, 1, 0x90, 0x80},
+};
+
+// SED / CLC or SEC / LDA #a / ADC or SBC #b / BRK, on every vector
+static void decimal_known_answers(void) {
+    emu6502* emu = emu6502_create();
+    struct emu6502_regs regs;
+
+    emu6502_set_cpu("nmos");
+
+    for (size_t i = 0; i < sizeof(decimal_vectors) / sizeof(decimal_vectors[0]); i++) {
+        const uint8_t prog[] = {
+            0xF8, decimal_vectors[i].carry ? 0x38 : 0x18, 0xA9, decimal_vectors[i].a,
+            decimal_vectors[i].opcode, decimal_vectors[i].b, 0x00,
+        };
+
+        emu6502_load_mem(emu, prog, sizeof(prog), 0x8000);
+        emu6502_reset(emu);
+        emu6502_run_until(emu, 0x8006, NULL, NULL, 1000);
+        emu6502_get_regs(emu, &regs);
+
+        CHECK(regs.a == decimal_vectors[i].result && (regs.sr & 0xC3) == decimal_vectors[i].flags,
+              "$%02X %s $%02X (C=%u): $%02X flags $%02X, expected $%02X flags $%02X",
+              decimal_vectors[i].a, decimal_vectors[i].opcode == 0x69 ? "+" : "-", decimal_vectors[i].b,
+              decimal_vectors[i].carry, regs.a, regs.sr & 0xC3, decimal_vectors[i].result,
+              decimal_vectors[i].flags);
+    }
+
+    emu6502_destroy(emu);
+}
+
+/*
+ * Starts T1 one-shot from $0100, then polls T1CH until it reads $80 (long
+ * after the timer ran out, when nothing is scheduled any more) and BRKs
+ * */
+static const uint8_t via_counter_prog[] = {
+    0xA9, 0x00, 0x8D, 0x04, 0x60, 0xA9, 0x01, 0x8D, 0x05, 0x60,
+    0xAD, 0x05, 0x60, 0xC9, 0x80, 0xD0, 0xF9, 0x00,
+};
+
+// polls IFR until a flag comes up, then BRKs
+static const uint8_t via_flags_prog[] = {0xAD, 0x0D, 0x60, 0xF0, 0xFB, 0x00};
+
+// polling the VIA is idle: the skipped iterations still count as
+// instructions, and a counter is never skipped past a change
+static void via_polling_idles(void) {
+    emu6502* emu = emu6502_create();
+    uint64_t clock[2], instructions[2];
+    uint8_t reason = CPU_STOP_BUDGET;
+
+    emu6502_load_mem(emu, via_counter_prog, sizeof(via_counter_prog), 0x8000);
+    via_init(VIA_BASE);
+
+    // one instruction per run never skips anything
+    for (uint8_t pass = 0; pass < 2; pass++) {
+        emu6502_reset(emu);
+        via_reset();
+        uint64_t start = cpu_clock, start_instructions = cpu_instructions;
+
+        if (pass == 0) {
+            while (cpu_run(1, CPU_STOP_BRK, NULL) != CPU_STOP_BRK) {}
+        } else {
+            reason = cpu_run(1000000, CPU_STOP_BRK | CPU_STOP_IDLE, NULL);
+        }
+        clock[pass] = cpu_clock - start;
+        instructions[pass] = cpu_instructions - start_instructions;
+    }
+
+    CHECK(reason == CPU_STOP_BRK, "the counter poll stopped on %u", reason);
+    CHECK(clock[0] == clock[1], "%llu cycles stepped, %llu run", (unsigned long long)clock[0],
+          (unsigned long long)clock[1]);
+    CHECK(instructions[0] == instructions[1], "%llu instructions stepped, %llu run",
+          (unsigned long long)instructions[0], (unsigned long long)instructions[1]);
+
+    emu6502_load_mem(emu, via_flags_prog, sizeof(via_flags_prog), 0x8000);
+    emu6502_reset(emu);
+    via_reset();
+    reason = cpu_run(1000000, CPU_STOP_BRK | CPU_STOP_IDLE, NULL);
+    CHECK(reason == CPU_STOP_IDLE, "the flag poll stopped on %u", reason);
+
+    mem_map_io(VIA_BASE, 0x10, NULL);
+    emu6502_destroy(emu);
+}
+
+// SEI / JMP *
+static const uint8_t via_wait_prog[] = {0x78, 0x4C, 0x01, 0x80};
+
+static void count_event(void* ctx) { (*(uint32_t*)ctx)++; }
+
+// an id kept after its event fired or got cancelled leaves the slot's next event alone
+static void sched_stale_ids(void) {
+    uint32_t fired = 0, kept = 0;
+
+    sched_init();
+    int old = sched_add(100, &count_event, &fired);
+    sched_run(100);
+    sched_add(200, &count_event, &kept);
+    sched_cancel(old);
+    sched_run(200);
+    CHECK(fired == 1 && kept == 1, "fired %u, then %u after cancelling a fired id", fired, kept);
+
+    old = sched_add(300, &count_event, &fired);
+    sched_cancel(old);
+    sched_add(400, &count_event, &kept);
+    sched_cancel(old);
+    sched_run(400);
+    CHECK(fired == 1 && kept == 2, "fired %u, then %u after cancelling an id twice", fired, kept);
+
+    sched_init();
+}
+
+/*
+ * Opcodes only some variants have, each run at $8000 until its BRK with
+ * $10-$13 preset. $12/$13 point at $10 for the (zp) mode.
+ * */
+static const struct {
+    const char* variant;
+    const char* name;
+    uint8_t prog[10];
+    uint8_t x;
+    uint8_t mem[4];
+    uint8_t want_a, want_x, want_flags;  // flags: N V Z C
+    uint8_t want_m10;
+} variant_vectors[] = {
+    {"65c02", "ADC decimal", {0xF8, 0x18, 0xA9, 0x99, 0x69, 0x01}, 0, {0}, 0x00, 0, 0x03, 0x00},
+    {"65c02", "SBC decimal", {0xF8, 0x38, 0xA9, 0x00, 0xE9, 0x01}, 0, {0}, 0x99, 0, 0x80, 0x00},
+    {"65c02", "TSB", {0xA9, 0x0F, 0x04, 0x10}, 0, {0xF1}, 0x0F, 0, 0x00, 0xFF},
+    {"65c02", "TSB none set", {0xA9, 0x0F, 0x04, 0x10}, 0, {0xF0}, 0x0F, 0, 0x02, 0xFF},
+    {"65c02", "TRB", {0xA9, 0x0F, 0x14, 0x10}, 0, {0xF1}, 0x0F, 0, 0x00, 0xF0},
+    {"65c02", "BIT #", {0xA9, 0x0F, 0x89, 0xF0}, 0, {0}, 0x0F, 0, 0x02, 0x00},
+    {"65c02", "LDA (zp)", {0xB2, 0x12}, 0, {0x5A, 0, 0x10, 0}, 0x5A, 0, 0x00, 0x5A},
+    {"65c02", "STA (zp)", {0xA9, 0x33, 0x92, 0x12}, 0, {0, 0, 0x10, 0}, 0x33, 0, 0x00, 0x33},
+    {"65c02", "JMP (abs,X)", {0x7C, 0x0E, 0x00, 0xEA, 0xEA, 0xEA, 0xA9, 0x77}, 2, {0x06, 0x80},
+     0x77, 2, 0x00, 0x06},
+    {"nmos-illegal", "LAX", {0xA7, 0x10}, 0, {0x80}, 0x80, 0x80, 0x80, 0x80},
+    {"nmos-illegal", "SAX", {0xA9, 0xF0, 0xA2, 0x3C, 0x87, 0x10}, 0, {0}, 0xF0, 0x3C, 0x00, 0x30},
+    {"nmos-illegal", "DCP", {0xA9, 0x40, 0xC7, 0x10}, 0, {0x41}, 0x40, 0, 0x03, 0x40},
+    {"nmos-illegal", "ISC", {0x38, 0xA9, 0x50, 0xE7, 0x10}, 0, {0x0F}, 0x40, 0, 0x01, 0x10},
+    {"nmos-illegal", "SLO", {0xA9, 0x01, 0x07, 0x10}, 0, {0x81}, 0x03, 0, 0x01, 0x02},
+    {"nmos-illegal", "RLA", {0x18, 0xA9, 0xFF, 0x27, 0x10}, 0, {0x81}, 0x02, 0, 0x01, 0x02},
+    {"nmos-illegal", "SRE", {0xA9, 0xF0, 0x47, 0x10}, 0, {0x03}, 0xF1, 0, 0x81, 0x01},
+    {"nmos-illegal", "RRA", {0x18, 0xA9, 0x10, 0x67, 0x10}, 0, {0x03}, 0x12, 0, 0x00, 0x01},
+    {"nmos-illegal", "ANC", {0xA9, 0xFF, 0x0B, 0x80}, 0, {0}, 0x80, 0, 0x81, 0x00},
+    {"nmos-illegal", "ALR", {0xA9, 0xFF, 0x4B, 0x03}, 0, {0}, 0x01, 0, 0x01, 0x00},
+    {"nmos-illegal", "ARR", {0x38, 0xA9, 0xFF, 0x6B, 0xFF}, 0, {0}, 0xFF, 0, 0x81, 0x00},
+    {"nmos-illegal", "SBX", {0xA9, 0xF0, 0xA2, 0x3C, 0xCB, 0x10}, 0, {0}, 0xF0, 0x20, 0x01, 0x00},
+    {"nmos-illegal", "NOP zp", {0x04, 0x10, 0xA9, 0x01}, 0, {0}, 0x01, 0, 0x00, 0x00},
+};
+
+// the opcodes of each variant do what that variant does
+static void variant_opcodes(void) {
+    emu6502* emu = emu6502_create();
+    struct emu6502_regs regs;
+
+    for (size_t i = 0; i < sizeof(variant_vectors) / sizeof(variant_vectors[0]); i++) {
+        emu6502_set_cpu(variant_vectors[i].variant);
+        emu6502_load_mem(emu, variant_vectors[i].prog, sizeof(variant_vectors[i].prog), 0x8000);
+        emu6502_load_mem(emu, variant_vectors[i].mem, sizeof(variant_vectors[i].mem), 0x10);
+        emu6502_set_regs(emu, &(struct emu6502_regs){.pc = 0x8000, .sp = 0xFD, .x = variant_vectors[i].x});
+        cpu_run(1000, CPU_STOP_BRK, NULL);
+        emu6502_get_regs(emu, &regs);
+
+        uint8_t m10 = emu6502_read(emu, 0x10);
+        CHECK(regs.a == variant_vectors[i].want_a && regs.x == variant_vectors[i].want_x &&
+                  (regs.sr & 0xC3) == variant_vectors[i].want_flags && m10 == variant_vectors[i].want_m10,
+              "%s %s: a=$%02X x=$%02X flags $%02X $10=$%02X", variant_vectors[i].variant,
+              variant_vectors[i].name, regs.a, regs.x, regs.sr & 0xC3, m10);
+    }
+
+    emu6502_set_cpu("nmos");
+    emu6502_destroy(emu);
+}
+
+/**
+ * lz_round_trip: Compresses a block and checks it comes back the same
+ * @param name What the block holds, for the messages
+ * @param src The block
+ * @param len Its size
+ * @return the compressed size
+ * */
+static uint32_t lz_round_trip(const char* name, const uint8_t* src, uint32_t len) {
+    static uint8_t packed[LZ_BOUND(0x10000)], back[0x10000];
+
+    uint32_t n = lz_compress(src, len, packed, LZ_BOUND(len));
+    uint32_t m = lz_decompress(packed, n, back, len);
+
+    CHECK(n > 0 && n <= LZ_BOUND(len), "%s: %u bytes compressed to %u", name, len, n);
+    CHECK(m == len && memcmp(src, back, len) == 0, "%s: %u bytes came back as %u", name, len, m);
+    return n;
+}
+
+// incompressible and highly repetitive blocks survive a round trip
+static void lz_round_trips(void) {
+    static uint8_t noise[0x10000], runs[0x10000];
+    uint32_t seed = 1;
+
+    for (uint32_t i = 0; i < sizeof(noise); i++) {
+        seed = seed * 1103515245 + 12345;
+        noise[i] = seed >> 16;
+        runs[i] = "6502"[i % 4] + (i >> 12);
+    }
+
+    uint32_t n = lz_round_trip("noise", noise, sizeof(noise));
+    CHECK(n == LZ_BOUND(sizeof(noise)), "noise compressed to %u bytes", n);
+    lz_round_trip("noise page", noise, 0x100);
+    lz_round_trip("short noise", noise, 3);
+
+    n = lz_round_trip("runs", runs, sizeof(runs));
+    CHECK(n < sizeof(runs) / 40, "runs compressed to %u bytes", n);
+    lz_round_trip("repeated page", runs + 0xF000, 0x100);
+}
+
+// a packed snapshot, with or without a base, brings back the memory and the
+// registers
+static void snapshot_pack_round_trips(void) {
+    emu6502* emu = emu6502_create();
+    struct snapshot* base = malloc(sizeof(*base));
+    uint8_t* mem = malloc(0x10000);
+    uint8_t* back = malloc(0x10000);
+    uint32_t seed = 7;
+
+    // noise, runs and zeros, page by page
+    for (uint32_t i = 0; i < 0x10000; i++) {
+        seed = seed * 1103515245 + 12345;
+        mem[i] = (i >> 8) % 3 == 0 ? seed >> 16 : (i >> 8) % 3 == 1 ? i >> 8 : 0;
+    }
+    emu6502_load_mem(emu, mem, 0x10000, 0);
+    emu6502_set_regs(emu, &(struct emu6502_regs){.pc = 0x1234, .sp = 0x56, .a = 0x78, .sr = 0x24});
+    snapshot_save(base);
+
+    for (uint8_t pass = 0; pass < 2; pass++) {
+        emu6502_write(emu, 0x4321, 0x99 + pass);
+        mem[0x4321] = 0x99 + pass;
+
+        struct snapshot_packed* packed = snapshot_pack(pass ? base : NULL);
+        emu6502_load_mem(emu, mem + 0x100, 0x10000 - 0x100, 0);
+        emu6502_set_regs(emu, &(struct emu6502_regs){.pc = 0x8000});
+
+        snapshot_unpack(packed);
+        struct emu6502_regs regs;
+        emu6502_get_regs(emu, &regs);
+        emu6502_read_block(emu, 0, back, 0x10000);
+
+        CHECK(memcmp(mem, back, 0x10000) == 0, "pass %u: the memory differs", pass);
+        CHECK(regs.pc == 0x1234 && regs.sp == 0x56 && regs.a == 0x78,
+              "pass %u: pc=$%04X sp=$%02X a=$%02X", pass, regs.pc, regs.sp, regs.a);
+        CHECK(snapshot_packed_size(packed) < 0x10000 * 2 / 3, "pass %u: packed in %zu bytes", pass,
+              snapshot_packed_size(packed));
+        free(packed);
+    }
+
+    free(back);
+    free(mem);
+    free(base);
+    emu6502_destroy(emu);
+}
+
+// the cpu reset line resets the VIA, and snapshots bring back its registers
+// along with the timer expiry that was pending
+static void via_reset_and_snapshot(void) {
+    emu6502* emu = emu6502_create();
+    struct snapshot* snap = malloc(sizeof(*snap));
+
+    emu6502_load_mem(emu, via_wait_prog, sizeof(via_wait_prog), 0x8000);
+    emu6502_reset(emu);
+    via_init(VIA_BASE);
+
+    cpu_write(VIA_BASE + VIA_IER, 0x80 | VIA_INT_T1);
+    cpu_write(VIA_BASE + VIA_T1CL, 0x00);
+    cpu_write(VIA_BASE + VIA_T1CH, 0x01);
+    snapshot_save(snap);
+
+    cpu_run(0x200, 0, NULL);
+    uint8_t ifr = cpu_fetch(VIA_BASE + VIA_IFR);
+    CHECK(ifr & VIA_INT_T1, "T1 didn't run out, IFR=$%02X", ifr);
+
+    snapshot_restore(snap);
+    ifr = cpu_fetch(VIA_BASE + VIA_IFR);
+    CHECK(!(ifr & VIA_INT_T1), "IFR=$%02X after the restore", ifr);
+
+    cpu_run(0x200, 0, NULL);
+    ifr = cpu_fetch(VIA_BASE + VIA_IFR);
+    CHECK(ifr & VIA_INT_T1, "the restored T1 didn't run out, IFR=$%02X", ifr);
+
+    emu6502_reset(emu);
+    uint8_t ier = cpu_fetch(VIA_BASE + VIA_IER);
+    ifr = cpu_fetch(VIA_BASE + VIA_IFR);
+    CHECK(ier == 0x80 && ifr == 0, "IER=$%02X IFR=$%02X after a reset", ier, ifr);
+
+    mem_map_io(VIA_BASE, 0x10, NULL);
+    free(snap);
+    emu6502_destroy(emu);
+}
+
+/*
+ * INC $40 / LDA $40 / CMP #1 / BEQ +1 / an illegal opcode / BRK: a run that
+ * doesn't start from the saved machine sees $40 above 1 and crashes
+ * */
+static const uint8_t fuzz_reset_prog[] = {0xE6, 0x40, 0xA5, 0x40, 0xC9, 0x01, 0xF0, 0x01, 0x02, 0x00};
+
+/*
+ * Crashes on the input "FUZ": one byte compared at a time (LDA $020x / CMP /
+ * BNE to the BRK), only coverage guidance gets through the three of them
+ * */
+static const uint8_t fuzz_magic_prog[] = {
+    0xAD, 0x00, 0x02, 0xC9, 'F', 0xD0, 0x0F, 0xAD, 0x01, 0x02, 0xC9, 'U', 0xD0,
+    0x08, 0xAD, 0x02, 0x02, 0xC9, 'Z', 0xD0, 0x01, 0x02, 0x00,
+};
+
+/**
+ * fuzz_target: Runs the fuzzer on a program loaded at $8000
+ * @param prog The program
+ * @param len Its size
+ * @param stop The stop address, -1 for none
+ * @param iterations The runs
+ * @return what fuzz_run() returned
+ * */
+static int fuzz_target(const uint8_t* prog, size_t len, int32_t stop, uint64_t iterations) {
+    emu6502* emu = emu6502_create();
+    struct fuzz_config cfg;
+
+    emu6502_load_mem(emu, prog, len, 0x8000);
+    emu6502_reset(emu);
+
+    fuzz_default_config(&cfg);
+    cfg.stop_addr = stop;
+    cfg.max_cycles = 1000;
+    cfg.iterations = iterations;
+    cfg.seed = 1;
+
+    int crashed = fuzz_run(&cfg);
+
+    emu6502_destroy(emu);
+    return crashed;
+}
+
+// every fuzz run starts from the saved machine, and a breakpoint already on
+// the stop address is still there after
+static void fuzz_resets_runs(void) {
+    int32_t stop = sizeof(fuzz_reset_prog) - 1 + 0x8000;
+
+    cpu_set_breakpoint(stop, 1);
+    CHECK(fuzz_target(fuzz_reset_prog, sizeof(fuzz_reset_prog), stop, 2000) == 0,
+          "a run saw memory left by the previous one");
+    CHECK(cpu_set_breakpoint(stop, 0) == 1, "the breakpoint on the stop address is gone");
+}
+
+// coverage leads the fuzzer through byte by byte comparisons
+static void fuzz_follows_coverage(void) {
+    CHECK(fuzz_target(fuzz_magic_prog, sizeof(fuzz_magic_prog), -1, 200000) == 1,
+          "no crash found behind three compared bytes");
+}
+
+int main(void) {
+    step_with_pending_irq();
+    step_after_swap();
+    lockstep_coprocessor();
+    sched_stale_ids();
+    run_until_keeps_breakpoints();
+    dirty_pages_per_handle();
+    batch_matches_core("nmos");
+    batch_matches_core("65c02");
+    decimal_known_answers();
+    variant_opcodes();
+    lz_round_trips();
+    snapshot_pack_round_trips();
+    fuzz_resets_runs();
+    fuzz_follows_coverage();
+    via_polling_idles();
+    via_reset_and_snapshot();
+    snapshot_keeps_banks();
+
+    if (failures) {
+        fprintf(stderr, "[x] %d check(s) failed\n", failures);
+        return 1;
+    }
+
+    printf("[-!-] all checks passed\n");
+    return 0;
+}
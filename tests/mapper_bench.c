@@ -0,0 +1,166 @@
+/*
+ * Cost of a ROM bank switch, run by `make bench`. Compares a switch done by
+ * the mapper (the pages of the window pointed at the bank) with copying the
+ * bank into the window, then measures what the switches cost a program that
+ * does them from a loop against the same loop storing to plain RAM. Each
+ * figure is the best of a few runs.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/cpu/cpu.h"
+#include "../src/mem/mem.h"
+#include "../src/peripherals/mapper.h"
+
+#define BANKS       16
+#define BANK_SIZE   MAPPER_ROM_BANK_SIZE
+#define SWITCHES    200000
+#define RUNS        5
+
+/*
+ * In the fixed part of the image at $C000, where the benchmark starts it:
+ *     LDX #0 / loop: INX / STX reg / LDY #n / read: LDA $8000,Y / DEY /
+ *     BNE read / JMP loop
+ * */
+static const uint8_t loop_prog[] = {
+    0xA2, 0x00, 0xE8, 0x8E, 0x00, 0x00, 0xA0, 0x00,
+    0xB9, 0x00, 0x80, 0x88, 0xD0, 0xFA, 0x4C, 0x02, 0xC0,
+};
+
+static uint8_t image[BANKS * BANK_SIZE];
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// each page of the window is read after the switch, as if the program ran
+// all over the bank
+static uint32_t touch_window(void) {
+    uint32_t sum = 0;
+
+    for (uint32_t page = ROM >> 8; page < (ROM + BANK_SIZE) >> 8; page++) sum += mem_page(page)[0];
+    return sum;
+}
+
+/**
+ * time_switches: Time one way of switching banks
+ * @param how 0: through the mapper, 1: the same then every page read,
+ *            2: copying the bank in a flat window then every page read
+ * @return the nanoseconds per switch
+ * */
+static double time_switches(uint8_t how) {
+    static uint32_t sum;
+    double best = 0;
+
+    for (uint8_t run = 0; run < RUNS; run++) {
+        double t = now();
+
+        for (uint32_t i = 0; i < SWITCHES; i++) {
+            if (how < 2) {
+                cpu_write(MAPPER_BASE, i & 1);
+            } else {
+                // what a flat window would do: copy the bank, forget its code
+                memcpy(mem_raw() + ROM, image + (i & 1) * BANK_SIZE, BANK_SIZE);
+                cpu_written(ROM, BANK_SIZE);
+            }
+            if (how) sum += touch_window();
+        }
+
+        t = now() - t;
+        if (run == 0 || t < best) best = t;
+    }
+
+    return best / SWITCHES * 1e9;
+}
+
+static void bench_switch(void) {
+    printf("switch, window untouched:           %7.0f ns\n", time_switches(0));
+    printf("switch, every page read after:      %7.0f ns\n", time_switches(1));
+    printf("copy of the bank, every page read:  %7.0f ns\n", time_switches(2));
+}
+
+/**
+ * run_loop: Run loop_prog for a number of switches
+ * @param reg Where the bank number is stored, the mapper or plain RAM
+ * @param reads Bytes read from the window between two switches
+ * @return the seconds it took
+ * */
+static double run_loop(uint16_t reg, uint8_t reads) {
+    uint8_t* raw = mem_raw();
+    uint64_t ran;
+    double best = 0;
+
+    raw[0xC004] = reg & 0xFF;
+    raw[0xC005] = reg >> 8;
+    raw[0xC007] = reads;
+
+    // LDX, INX, STX, LDY, then the read loop
+    uint64_t budget = (uint64_t)SWITCHES / 10 * (2 + 4 + 2 + 3 + reads * (4 + 2 + 3) - 1);
+
+    for (uint8_t run = 0; run < RUNS; run++) {
+        cpu_forget();
+        cpu_reset();
+        cpu.pc = 0xC000;
+
+        double t = now();
+        cpu_run(budget, 0, &ran);
+        t = now() - t;
+        if (run == 0 || t < best) best = t;
+    }
+
+    return best;
+}
+
+static void bench_program(void) {
+    static const uint8_t reads[] = {1, 8, 64, 255};
+
+    printf("\nreads between switches   plain RAM   switching   per switch\n");
+    for (uint8_t i = 0; i < sizeof(reads); i++) {
+        double plain = run_loop(0x0210, reads[i]);
+        double banked = run_loop(MAPPER_BASE, reads[i]);
+
+        printf("%22u %9.1f ms %9.1f ms %9.0f ns   (+%.1f%%)\n", reads[i], plain * 1e3, banked * 1e3,
+               (banked - plain) / (SWITCHES / 10) * 1e9, (banked - plain) / plain * 100);
+    }
+}
+
+int main(void) {
+    char path[] = "/tmp/mapper_bench.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+
+    // the last bank holds the program
+    for (uint32_t i = 0; i < sizeof(image); i++) image[i] = i / BANK_SIZE;
+    memcpy(image + sizeof(image) - (0x10000 - ROM - BANK_SIZE), loop_prog, sizeof(loop_prog));
+
+    if (write(fd, image, sizeof(image)) != (ssize_t)sizeof(image)) {
+        perror("write");
+        return 1;
+    }
+    close(fd);
+
+    struct mapper_config cfg;
+    mapper_default_config(&cfg);
+    cfg.rom = path;
+
+    cpu_init();
+    int failed = mapper_init(&cfg);
+    unlink(path);
+    if (failed) return 1;
+
+    bench_switch();
+    bench_program();
+    return 0;
+}